@@ -0,0 +1,38 @@
+#!/bin/bash
+#generate VCDs of several sizes and time each stage of vcd_hier_manip
+#
+#Results are appended to ${BENCH_RESULTS} (bench/results.jsonl) as JSON lines tagged with the current commit.
+#The file is out of bench_run, which "make clean" removes, so results of commits are kept.
+#The following variables change the set of VCDs.
+#  BENCH_SIGNALS     numbers of signals
+#  BENCH_DEPTH       depth of the module tree
+#  BENCH_FANOUT      sub modules of each module
+#  BENCH_NAME_LEN    length of module and signal names
+#  BENCH_BODY_BYTES  size of the body
+#  BENCH_TOGGLE      ratio of signals changing at each timestamp
+#  BENCH_REPEAT      number of runs of each stage
+#  BENCH_THREADS     number of threads to parse a header
+set -e
+
+readonly root=$(realpath $(dirname $0)/..)
+readonly run_dir=${root}/bench_run
+readonly signals=${BENCH_SIGNALS:-1000 10000 100000 1000000 10000000}
+readonly depth=${BENCH_DEPTH:-4}
+readonly fanout=${BENCH_FANOUT:-8}
+readonly name_len=${BENCH_NAME_LEN:-8}
+readonly body_bytes=${BENCH_BODY_BYTES:-67108864}
+readonly toggle=${BENCH_TOGGLE:-0.01}
+readonly results=${BENCH_RESULTS:-${root}/bench/results.jsonl}
+readonly tag=$(git -C "${root}" describe --always --dirty 2> /dev/null || echo unknown)
+
+mkdir -p "${run_dir}"
+for n in ${signals}; do
+    #generated files are reused while the parameters are the same
+    vcd=${run_dir}/gen_${n}_${depth}_${fanout}_${name_len}_${body_bytes}_${toggle}.vcd
+    if test ! -f "${vcd}"; then
+        echo "Generating ${vcd}" >&2
+        "${root}/bench/vcd_gen" --signals ${n} --depth ${depth} --fanout ${fanout} --name-len ${name_len} \
+            --body-bytes ${body_bytes} --toggle ${toggle} "${vcd}"
+    fi
+    "${root}/bench/vcd_bench" --repeat ${BENCH_REPEAT:-3} --threads ${BENCH_THREADS:-1} --tag "${tag}" "${vcd}" | tee -a "${results}"
+done
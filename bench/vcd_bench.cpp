@@ -0,0 +1,239 @@
+//! benchmark driver that times each stage of vcd_hier_manip
+//
+//! Every stage is run --repeat times for each VCD and the best time is reported.
+//! One JSON object is written per line so that results of different commits can be compared.
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <getopt.h>
+
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+
+namespace{
+
+//! stages to be timed
+enum stage{
+    stage_scan,
+    stage_parse,
+    stage_hierarchy,
+    stage_to_str,
+    stage_flatten,
+    stage_inplace,
+    stage_output,
+    num_stages
+};
+
+//! names of stages in the result
+const char *const stage_names[num_stages] = {
+    "get_vcd_header_size",
+    "parse_vcd_header",
+    "make_hierarchy",
+    "to_str",
+    "flatten",
+    "inplace_mod",
+    "make_new_file_and_write"
+};
+
+//! get the monotonic time in seconds
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! copy the head of a file to a new file
+//
+//! @return false if failed
+bool copy_head(const char *src, const char *dst, size_t len){
+    fd_raii ifd(open(src, O_RDONLY));
+    fd_raii ofd(open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ifd < 0 || ofd < 0) return false;
+    std::vector<char> buf(len);
+    return pread(ifd, &buf.front(), len, 0) == static_cast<ssize_t>(len) && write(ofd, &buf.front(), len) == static_cast<ssize_t>(len);
+}
+
+//! result of a VCD
+struct bench_result{
+    //! best time of each stage in seconds, negative if not measured
+    double times[num_stages];
+    size_t file_size;
+    size_t header_size;
+    size_t num_signals;
+    size_t hier_size;
+    size_t flat_size;
+    bench_result() : file_size(0), header_size(0), num_signals(0), hier_size(0), flat_size(0){
+        std::fill(times, times + num_stages, -1.0);
+    }
+    //! record a time keeping the best one
+    void record(stage s, double t){
+        if(times[s] < 0 || t < times[s]) times[s] = t;
+    }
+};
+
+//! run all stages once
+//
+//! @return false if the file cannot be processed
+bool run_once(const char *vcd, unsigned int num_threads, bench_result &r){
+    double t = now();
+    mmap_manager vcd_file(vcd, false, header_scan_window);
+    size_t header_size;
+    if(vcd_file.get_error() || !get_vcd_header_size(vcd_file, header_size)){
+        std::cerr << vcd << ": cannot find the header" << std::endl;
+        return false;
+    }
+    r.record(stage_scan, now() - t);
+    r.file_size = vcd_file.get_file_size();
+    r.header_size = header_size;
+    const string_view all(static_cast<const char *>(vcd_file.get_ptr()), header_size);
+
+    t = now();
+    vcd_header *const header = parse_vcd_header(all, false, num_threads);
+    r.record(stage_parse, now() - t);
+    std::vector<const vcd_signal *> sigs;
+    header->get_signals(sigs);
+    r.num_signals = sigs.size();
+
+    t = now();
+    header->make_hierarchy();
+    r.record(stage_hierarchy, now() - t);
+
+    std::vector<char> hier;
+    t = now();
+    header->to_str(hier, 0);
+    r.record(stage_to_str, now() - t);
+    r.hier_size = hier.size();
+
+    std::vector<char> flat;
+    t = now();
+    header->flatten(flat, 0);
+    r.record(stage_flatten, now() - t);
+    r.flat_size = flat.size();
+    delete header;
+
+    //in-place modification of a copy of the header, with the size level chosen like --fit
+    const std::string tmp = std::string(vcd) + ".bench.tmp";
+    if(!copy_head(vcd, tmp.c_str(), header_size)){
+        std::perror(tmp.c_str());
+        return false;
+    }
+    {
+        mmap_manager copy(tmp.c_str(), true);
+        const string_view copy_all(static_cast<const char *>(copy.get_ptr()), header_size);
+        vcd_header *const h = parse_vcd_header(copy_all, true, num_threads);
+        size_t sizes[vcd_header::max_size_level + 1];
+        h->get_sizes(false, sizes);
+        for(int level = 0; level <= vcd_header::max_size_level; ++level){
+            if(sizes[level] > header_size) continue;
+            header_writer counter;
+            counter.set_guard(copy_all);
+            write_header(*h, counter, false, level);
+            t = now();
+            inplace_mod(copy.get_ptr(), *h, false, level, counter.size(), counter.is_overwritten(), header_size);
+            copy.mark_dirty(0, header_size);
+            r.record(stage_inplace, now() - t);
+            break;
+        }
+        delete h;
+    }
+    unlink(tmp.c_str());
+
+    t = now();
+    const int ret = make_new_file_and_write(vcd, tmp.c_str(), hier, header_size);
+    r.record(stage_output, now() - t);
+    unlink(tmp.c_str());
+    return ret == 0;
+}
+
+//! write a string as a JSON string
+void write_json_string(std::ostream &os, const std::string &s){
+    os << '"';
+    for(size_t i = 0; i < s.size(); ++i){
+        if(s[i] == '"' || s[i] == '\\') os << '\\';
+        os << s[i];
+    }
+    os << '"';
+}
+
+void usage(const char *prog){
+    std::cerr
+        << "usage: " << prog << " [options] file.vcd ...\n"
+        << "  --repeat N   number of runs of each stage, the best time is reported (3)\n"
+        << "  --threads N  number of threads to parse a header, 0 for the number of CPUs (1)\n"
+        << "  --tag TAG    label of the results such as a commit hash\n";
+}
+
+} //end of unnamed namespace
+
+int main(int argc, char *argv[]){
+    unsigned int repeat = 3, num_threads = 1;
+    std::string tag;
+    for(;;){
+        struct option long_options[] = {
+            {"repeat", 1, NULL, 0},
+            {"threads", 1, NULL, 1},
+            {"tag", 1, NULL, 2},
+            {0, 0, 0, 0}
+        };
+        int opt_idx = -1;
+        const int c = getopt_long(argc, argv, "", long_options, &opt_idx);
+        if(c == -1) break;
+        switch(opt_idx){
+            case 0: repeat = std::max(1ul, std::strtoul(optarg, NULL, 10)); break;
+            case 1: num_threads = std::strtoul(optarg, NULL, 10); break;
+            case 2: tag = optarg; break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if(optind >= argc){
+        usage(argv[0]);
+        return -1;
+    }
+    int ret = 0;
+    for(int i = optind; i < argc; ++i){
+        bench_result r;
+        bool ok = true;
+        for(unsigned int n = 0; n < repeat && ok; ++n){
+            ok = run_once(argv[i], num_threads, r);
+        }
+        if(!ok){
+            ret = 1;
+            continue;
+        }
+        std::cout << "{\"tag\":";
+        write_json_string(std::cout, tag);
+        std::cout << ",\"file\":";
+        write_json_string(std::cout, argv[i]);
+        std::cout
+            << ",\"file_bytes\":" << r.file_size
+            << ",\"header_bytes\":" << r.header_size
+            << ",\"signals\":" << r.num_signals
+            << ",\"hier_bytes\":" << r.hier_size
+            << ",\"flat_bytes\":" << r.flat_size
+            << ",\"threads\":" << num_threads
+            << ",\"repeat\":" << repeat;
+        for(int s = 0; s < num_stages; ++s){
+            std::cout << ",\"" << stage_names[s] << "\":";
+            if(r.times[s] < 0) std::cout << "null";
+            else std::cout << r.times[s];
+        }
+        std::cout << "}" << std::endl;
+    }
+    return ret;
+}
@@ -0,0 +1,207 @@
+//! synthetic VCD generator for benchmarks
+//
+//! Signals are spread over a module tree of the given depth and fan-out.
+//! By default all signals are written in one scope named "SystemC" with dotted names,
+//! like the ASI(OSCI) SystemC simulator does, which is the input vcd_hier_manip fixes.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <getopt.h>
+
+#include "vcd_body.h"
+
+namespace{
+
+//! parameters of the generated VCD
+struct gen_params{
+    //! number of signals
+    uint64_t num_signals;
+    //! depth of the module tree below the top module
+    unsigned int depth;
+    //! number of sub modules of each module
+    unsigned int fanout;
+    //! length of module and signal names
+    unsigned int name_len;
+    //! approximate size of the body in Byte
+    uint64_t body_bytes;
+    //! ratio of signals that change at each timestamp
+    double toggle;
+    //! seed of the random numbers
+    uint64_t seed;
+    //! true to write $scope hierarchy instead of dotted names
+    bool hier;
+    gen_params() : num_signals(1000), depth(4), fanout(4), name_len(8), body_bytes(0), toggle(0.01), seed(1), hier(false){}
+};
+
+//! xorshift64 random number generator
+class random_gen{
+    uint64_t s;
+    public:
+    explicit random_gen(uint64_t seed) : s(seed ? seed : 1){}
+    uint64_t next(){
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s;
+    }
+};
+
+//! make a name of the given length from a prefix and an index
+std::string make_name(const char *prefix, uint64_t idx, unsigned int len){
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%s%llu", prefix, static_cast<unsigned long long>(idx));
+    std::string name(buf);
+    if(name.size() < len) name.append(len - name.size(), '_');
+    return name;
+}
+
+//! bit width of a signal, mostly 1 bit with some buses
+unsigned int signal_width(uint64_t idx){
+    return idx % 32 == 31 ? 32 : idx % 8 == 7 ? 8 : 1;
+}
+
+//! write a random value change of a signal
+void write_change(FILE *fp, random_gen &rnd, unsigned int width, const std::string &code){
+    if(width == 1){
+        std::fprintf(fp, "%c%s\n", static_cast<char>('0' + (rnd.next() & 1)), code.c_str());
+        return;
+    }
+    char bits[33];
+    const uint64_t r = rnd.next();
+    for(unsigned int i = 0; i < width; ++i){
+        bits[i] = '0' + (r >> i & 1);
+    }
+    bits[width] = '\0';
+    std::fprintf(fp, "b%s %s\n", bits, code.c_str());
+}
+
+//! write the header
+//
+//! Signal i belongs to the leaf module i % (number of leaves), whose path is the digits of the index in base fan-out.
+void write_header(FILE *fp, const gen_params &p, const std::vector<std::string> &codes){
+    std::fprintf(fp, "$date\n     Jan 01, 2024       00:00:00\n$end\n\n$version\n SystemC 2.3.0-ASI --- synthetic\n$end\n\n$timescale\n     1 ps\n$end\n\n");
+    std::fprintf(fp, "$scope module SystemC $end\n");
+    uint64_t num_leaves = 1;
+    for(unsigned int d = 0; d < p.depth && num_leaves < p.num_signals; ++d) num_leaves *= p.fanout;
+    std::vector<std::string> path;
+    if(p.hier){
+        //signals are grouped by leaf so that each scope is opened once
+        for(uint64_t leaf = 0; leaf < num_leaves && leaf < p.num_signals; ++leaf){
+            std::vector<std::string> segs;
+            for(uint64_t l = leaf, d = 0; d < p.depth; ++d, l /= p.fanout) segs.insert(segs.begin(), make_name("u", l % p.fanout, p.name_len));
+            size_t common = 0;
+            while(common < path.size() && path[common] == segs[common]) ++common;
+            for(size_t i = path.size(); i > common; --i) std::fprintf(fp, "$upscope $end\n");
+            for(size_t i = common; i < segs.size(); ++i) std::fprintf(fp, "$scope module %s $end\n", segs[i].c_str());
+            path.swap(segs);
+            for(uint64_t i = leaf; i < p.num_signals; i += num_leaves){
+                std::fprintf(fp, "$var wire %u %s %s $end\n", signal_width(i), codes[i].c_str(), make_name("sig", i, p.name_len).c_str());
+            }
+        }
+        for(size_t i = 0; i < path.size(); ++i) std::fprintf(fp, "$upscope $end\n");
+    }
+    else{
+        for(uint64_t i = 0; i < p.num_signals; ++i){
+            std::string name;
+            for(uint64_t l = i % num_leaves, d = 0; d < p.depth; ++d, l /= p.fanout){
+                name = make_name("u", l % p.fanout, p.name_len) + "." + name;
+            }
+            name += make_name("sig", i, p.name_len);
+            std::fprintf(fp, "$var wire %u %s %s $end\n", signal_width(i), codes[i].c_str(), name.c_str());
+        }
+    }
+    std::fprintf(fp, "$upscope $end\n$enddefinitions $end\n");
+}
+
+//! write the body of the given size
+void write_body(FILE *fp, const gen_params &p, const std::vector<std::string> &codes){
+    if(p.body_bytes == 0) return;
+    random_gen rnd(p.seed);
+    std::fprintf(fp, "$dumpvars\n");
+    for(uint64_t i = 0; i < p.num_signals; ++i) write_change(fp, rnd, signal_width(i), codes[i]);
+    std::fprintf(fp, "$end\n");
+    const uint64_t per_time = std::max<uint64_t>(1, static_cast<uint64_t>(p.toggle * p.num_signals));
+    for(uint64_t t = 1; static_cast<uint64_t>(ftello(fp)) < p.body_bytes; ++t){
+        std::fprintf(fp, "#%llu\n", static_cast<unsigned long long>(t * 10));
+        for(uint64_t n = 0; n < per_time; ++n){
+            const uint64_t i = rnd.next() % p.num_signals;
+            write_change(fp, rnd, signal_width(i), codes[i]);
+        }
+    }
+}
+
+void usage(const char *prog){
+    std::fprintf(stderr,
+        "usage: %s [options] output.vcd\n"
+        "  --signals N     number of signals (1000)\n"
+        "  --depth N       depth of the module tree (4)\n"
+        "  --fanout N      sub modules of each module (4)\n"
+        "  --name-len N    length of module and signal names (8)\n"
+        "  --body-bytes N  approximate size of the body (0)\n"
+        "  --toggle R      ratio of signals changing at each timestamp (0.01)\n"
+        "  --seed N        seed of the random numbers (1)\n"
+        "  --hier          write $scope hierarchy instead of dotted names\n", prog);
+}
+
+} //end of unnamed namespace
+
+int main(int argc, char *argv[]){
+    gen_params p;
+    for(;;){
+        struct option long_options[] = {
+            {"signals", 1, NULL, 0},
+            {"depth", 1, NULL, 1},
+            {"fanout", 1, NULL, 2},
+            {"name-len", 1, NULL, 3},
+            {"body-bytes", 1, NULL, 4},
+            {"toggle", 1, NULL, 5},
+            {"seed", 1, NULL, 6},
+            {"hier", 0, NULL, 7},
+            {0, 0, 0, 0}
+        };
+        int opt_idx = -1;
+        const int c = getopt_long(argc, argv, "", long_options, &opt_idx);
+        if(c == -1) break;
+        switch(opt_idx){
+            case 0: p.num_signals = std::strtoull(optarg, NULL, 10); break;
+            case 1: p.depth = std::strtoul(optarg, NULL, 10); break;
+            case 2: p.fanout = std::strtoul(optarg, NULL, 10); break;
+            case 3: p.name_len = std::strtoul(optarg, NULL, 10); break;
+            case 4: p.body_bytes = std::strtoull(optarg, NULL, 10); break;
+            case 5: p.toggle = std::strtod(optarg, NULL); break;
+            case 6: p.seed = std::strtoull(optarg, NULL, 10); break;
+            case 7: p.hier = true; break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if(optind + 1 != argc || p.num_signals == 0 || p.fanout < 2){
+        usage(argv[0]);
+        return -1;
+    }
+    FILE *const fp = std::fopen(argv[optind], "w");
+    if(!fp){
+        std::perror(argv[optind]);
+        return -1;
+    }
+    std::vector<std::string> codes(p.num_signals);
+    code_generator gen;
+    for(uint64_t i = 0; i < p.num_signals; ++i) codes[i] = gen.next();
+    write_header(fp, p, codes);
+    //the body size is counted from the end of the header
+    if(p.body_bytes) p.body_bytes += ftello(fp);
+    write_body(fp, p, codes);
+    if(std::fclose(fp)){
+        std::perror(argv[optind]);
+        return -1;
+    }
+    return 0;
+}
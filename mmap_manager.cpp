@@ -1,74 +1,155 @@
-#include <sys/mman.h>//mmap, munmap
+#include <sys/mman.h>//mmap, munmap, madvise
 #include <sys/stat.h>//open
-#include <fcntl.h>//O_RDWR, O_RDONLY
-#include <unistd.h> //close
+#include <fcntl.h>//O_RDWR, O_RDONLY, fallocate
+#include <linux/falloc.h>//FALLOC_FL_INSERT_RANGE
+#include <unistd.h> //close, sysconf
 #include <cstdlib>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
-#include <iostream>
-#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <stdint.h> //SIZE_MAX
 #include "mmap_manager.h"
-
-namespace{
-
-//! Get the size of file
-//
-//! @param fn filename to check the size
-//! @return file size in Byte
-size_t get_filesize(const char *fn){
-    std::ifstream ifs(fn);
-    if(!ifs){
-        std::cerr << "Failed to open " << fn << std::endl;
-        std::abort();
-    }
-    return ifs.seekg(0, std::ios::end).tellg();
-}
-
-} //end of unnamed namespace
+#include "vcd_stats.h"
 
 struct mmap_manager::impl{
     //! File descriptor of mapped file
     int fd;
-    //! The head of mapped area
+    //! how the file is mapped
+    const map_mode mode;
+    //! hints of the access
+    const unsigned int hints;
+    //! size of a page, to which the mapping is aligned
+    const size_t page_size;
+    //! The head of the window
     void *mapped_area;
-    //! Mapped size
+    //! Size of the window
     size_t mapped_size;
-    impl(const char *, bool, size_t);
+    //! Offset of the window in the file
+    size_t offset;
+    //! Distance from the page boundary before the window to the window
+    size_t lead;
+    //! Size of the mapped file
+    size_t file_size;
+    //! ranges of the file modified through the mapping, aligned to pages
+    std::vector<std::pair<size_t, size_t> > dirty;
+    //! true if mark_dirty() has been called, otherwise the whole window of read_write is synchronized
+    bool tracked;
+    //! errno of the failure in opening or mapping, 0 if succeeded
+    int error;
+    impl(const char *, map_mode, size_t, unsigned int);
     ~impl();
+    bool map(size_t, size_t);
+    void sync();
+    void unmap();
+    void advise();
 };
 
 //! Constructor
 //
+//! The file size is taken by fstat() on the opened descriptor.
+//! Failures are recorded in error instead of aborting, so that other files can be processed.
+//! Only a read_write file is opened with O_SYNC, which makes the insertion at the head durable.
 //! @param filename filename to be mapped
-//! @param is_writable accessibility of the mapped region
-//! @param size size of mapped region in Byte
-mmap_manager::impl::impl(const char *filename, bool is_writable, size_t size){
-    fd = open(filename, O_SYNC | (is_writable ? O_RDWR : O_RDONLY));
-    if(fd < 0){
-        perror(filename);
-        std::abort();
-    }
-    mapped_size = size;
-    mapped_area = mmap(NULL, size, PROT_READ | (is_writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
-    if(mapped_area == MAP_FAILED){
-        perror(filename);
-        std::abort();
+//! @param m how the file is mapped
+//! @param size size of mapped region in Byte, which is clipped to the file size
+//! @param h hints of the access
+mmap_manager::impl::impl(const char *filename, map_mode m, size_t size, unsigned int h) : mode(m), hints(h), page_size(sysconf(_SC_PAGESIZE)), mapped_area(NULL), mapped_size(0), offset(0), lead(0), file_size(0), tracked(false), error(0){
+    fd = open(filename, m == read_write ? O_SYNC | O_RDWR : O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st)){
+        error = errno;
+        return;
     }
+    file_size = st.st_size;
+    map(0, size);
 }
 
 //! Destructor
+//
+//! Only the modified ranges are synchronized, see mark_dirty().
 mmap_manager::impl::~impl(){
-    if(msync(mapped_area, mapped_size, MS_SYNC)){
-        perror("msync");
+    if(fd < 0) return;
+    unmap();
+    if(close(fd)){
+        perror("close");
         std::abort();
     }
-    if(munmap(mapped_area, mapped_size)){
-        perror("munmap");
-        std::abort();
+}
+
+//! map a window of the file
+//
+//! The window must not be mapped.
+//! @param off offset of the window in the file
+//! @param size size of the window in Byte, which is clipped to the file size
+//! @return false if mmap() failed, see error
+bool mmap_manager::impl::map(size_t off, size_t size){
+    offset = std::min(off, file_size);
+    lead = offset % page_size;
+    mapped_size = std::min(size, file_size - offset);
+    if(mapped_size == 0) return true;
+    const int prot = mode == read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    const int flags = (mode == copy_on_write ? MAP_PRIVATE : MAP_SHARED) | (hints & populate ? MAP_POPULATE : 0);
+    void *const area = mmap(NULL, lead + mapped_size, prot, flags, fd, offset - lead);
+    if(area == MAP_FAILED){
+        error = errno;
+        mapped_area = NULL;
+        mapped_size = 0;
+        return false;
     }
-    if(close(fd)){
-        perror("close");
+    mapped_area = static_cast<char *>(area) + lead;
+    count_mapped(mapped_size);
+    advise();
+    return true;
+}
+
+//! give the hints of the access to the kernel, which may ignore them
+void mmap_manager::impl::advise(){
+    void *const area = static_cast<char *>(mapped_area) - lead;
+    const size_t len = lead + mapped_size;
+    if(hints & sequential) madvise(area, len, MADV_SEQUENTIAL);
+    if(hints & will_need) madvise(area, len, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if(hints & huge_pages) madvise(area, len, MADV_HUGEPAGE);
+#endif
+}
+
+//! write the modified ranges in the window back to the file
+//
+//! A read_write window is synchronized wholly if no range has been marked.
+//! The duration of msync() is added to the I/O counters.
+void mmap_manager::impl::sync(){
+    if(!mapped_area || mode != read_write) return;
+    const size_t begin = offset - lead, end = offset + mapped_size;
+    std::vector<std::pair<size_t, size_t> > ranges;
+    if(tracked) ranges.swap(dirty);
+    else ranges.push_back(std::make_pair(begin, end));
+    if(ranges.empty()) return;
+    const double start = get_monotonic_time();
+    for(size_t i = 0; i < ranges.size(); ++i){
+        //ranges out of the window were synchronized when the window moved
+        const size_t b = std::max(ranges[i].first, begin), e = std::min(ranges[i].second, end);
+        if(b >= e) continue;
+        if(msync(static_cast<char *>(mapped_area) - lead + (b - begin), e - b, MS_SYNC)){
+            perror("msync");
+            std::abort();
+        }
+    }
+    count_msync(static_cast<uint64_t>((get_monotonic_time() - start) * 1e9));
+}
+
+//! synchronize and unmap the window
+void mmap_manager::impl::unmap(){
+    if(!mapped_area) return;
+    sync();
+    if(munmap(static_cast<char *>(mapped_area) - lead, lead + mapped_size)){
+        perror("munmap");
         std::abort();
     }
+    mapped_area = NULL;
+    mapped_size = 0;
 }
 
 //! Constructor (Map the whole file)
@@ -78,7 +159,7 @@ mmap_manager::impl::~impl(){
 //! @arg true the file is mapped as a readable/writable
 //! @arg false the file cannnot be modified. If the area is modified, you will receive SIGSEGV.
 mmap_manager::mmap_manager(const char *filename, bool is_writable){
-    pimpl = new impl(filename, is_writable, get_filesize(filename));
+    pimpl = new impl(filename, is_writable ? read_write : read_only, SIZE_MAX, no_hint);
 }
 
 //! Constructor (Map specied length from the head of the file)
@@ -89,7 +170,20 @@ mmap_manager::mmap_manager(const char *filename, bool is_writable){
 //! @arg false the file cannnot be modified. If the area is modified, you will receive SIGSEGV.
 //! @param map_size the size of mapped region in Byte
 mmap_manager::mmap_manager(const char *filename, bool is_writable, size_t map_size){
-    pimpl = new impl(filename, is_writable, std::min(get_filesize(filename), map_size));
+    pimpl = new impl(filename, is_writable ? read_write : read_only, map_size, no_hint);
+}
+
+//! Constructor (Map specified length from the head of the file with hints)
+//
+//! @param filename name of existing file to map
+//! @param mode how the file is mapped
+//! @arg read_only the file cannot be modified. If the area is modified, you will receive SIGSEGV.
+//! @arg read_write the file is mapped as readable/writable
+//! @arg copy_on_write the area can be modified, but the file is not
+//! @param map_size the size of mapped region in Byte, 0 to map nothing until slide()
+//! @param hints map_hint combined by bitwise or, which are given again when the window moves
+mmap_manager::mmap_manager(const char *filename, map_mode mode, size_t map_size, unsigned int hints){
+    pimpl = new impl(filename, mode, map_size, hints);
 }
 
 //! Destructor
@@ -99,14 +193,117 @@ mmap_manager::~mmap_manager(){
 
 //! Get the head address of mapped memory
 //
-//! @return the head of memory area
+//! @return the head of the window, which is at get_offset() of the file
 void * mmap_manager::get_ptr()const{
     return pimpl->mapped_area;
 }
 
+//! Get the error in opening or mapping the file
+//
+//! @return errno of the failure, 0 if the file is mapped successfully
+int mmap_manager::get_error()const{
+    return pimpl->error;
+}
+
 //! Get memory mapped size
 //
 //! @return mapped area in Byte
 size_t mmap_manager::get_size()const{
     return pimpl->mapped_size;
 }
+
+//! Get the offset of the window in the file
+//
+//! @return offset in Byte, 0 unless the window has been moved by slide()
+size_t mmap_manager::get_offset()const{
+    return pimpl->offset;
+}
+
+//! Get the size of the mapped file
+//
+//! @return file size in Byte, which can be larger than the mapped area
+size_t mmap_manager::get_file_size()const{
+    return pimpl->file_size;
+}
+
+//! Change the length of the mapped region
+//
+//! The region may move, so the pointer returned by get_ptr() before this call must not be used anymore.
+//! Data already mapped is kept, so a caller can grow the window without reading the file again.
+//! @param map_size new size of mapped region in Byte, which is clipped to the file size
+//! @return new mapped size in Byte, the current size if mremap() failed, see get_error()
+size_t mmap_manager::remap(size_t map_size){
+    impl &m = *pimpl;
+    if(!m.mapped_area){
+        m.map(m.offset, map_size);
+        return m.mapped_size;
+    }
+    map_size = std::min(m.file_size - m.offset, map_size);
+    if(map_size == m.mapped_size) return map_size;
+    if(map_size < m.mapped_size) m.sync();
+    void *const new_area = mremap(static_cast<char *>(m.mapped_area) - m.lead, m.lead + m.mapped_size, m.lead + map_size, MREMAP_MAYMOVE);
+    if(new_area == MAP_FAILED){
+        m.error = errno;
+        return m.mapped_size;
+    }
+    if(map_size > m.mapped_size) count_mapped(map_size - m.mapped_size);
+    m.mapped_area = static_cast<char *>(new_area) + m.lead;
+    m.mapped_size = map_size;
+    m.advise();
+    return map_size;
+}
+
+//! Move the window to another part of the file
+//
+//! The old window is synchronized and unmapped, so the pointer returned by get_ptr() before this call must not be used anymore.
+//! A file larger than the address space or the memory is read through a window of a bounded size.
+//! @param off offset of the new window in the file, which does not need to be aligned
+//! @param map_size size of the new window in Byte, which is clipped to the file size
+//! @return mapped size in Byte, 0 if mmap() failed, see get_error()
+size_t mmap_manager::slide(size_t off, size_t map_size){
+    pimpl->unmap();
+    pimpl->map(off, map_size);
+    return pimpl->mapped_size;
+}
+
+//! Record a range modified through a read_write mapping
+//
+//! Once a range is marked, only the marked ranges are synchronized when the window is unmapped.
+//! @param off offset of the range from get_ptr()
+//! @param len length of the range in Byte
+void mmap_manager::mark_dirty(size_t off, size_t len){
+    impl &m = *pimpl;
+    m.tracked = true;
+    if(len == 0) return;
+    const size_t begin = (m.offset + off) / m.page_size * m.page_size;
+    const size_t end = m.offset + off + len;
+    m.dirty.push_back(std::make_pair(begin, end));
+}
+
+//! Insert blocks at the head of the file without moving the data
+//
+//! The length is rounded up to the block size because FALLOC_FL_INSERT_RANGE works only in blocks.
+//! The inserted region reads as zeros and the mapped window grows by the inserted length,
+//! so the pointer returned by get_ptr() before this call must not be used anymore.
+//! @param len minimum length to insert in Byte
+//! @return inserted length in Byte, 0 if the filesystem does not support the insertion or the file is not read_write
+size_t mmap_manager::insert_head(size_t len){
+#ifdef FALLOC_FL_INSERT_RANGE
+    struct stat st;
+    if(len == 0 || pimpl->mode != read_write || pimpl->offset != 0 || fstat(pimpl->fd, &st)) return 0;
+    const size_t block_size = st.st_blksize > 0 ? st.st_blksize : 4096;
+    const size_t inserted = (len + block_size - 1) / block_size * block_size;
+    if(fallocate(pimpl->fd, FALLOC_FL_INSERT_RANGE, 0, inserted)) return 0;
+    pimpl->file_size += inserted;
+    //the marked data has moved with the rest of the file
+    for(size_t i = 0; i < pimpl->dirty.size(); ++i){
+        pimpl->dirty[i].first += inserted;
+        pimpl->dirty[i].second += inserted;
+    }
+    remap(pimpl->mapped_size + inserted);
+    return inserted;
+#else
+    (void)len;
+    return 0;
+#endif
+}
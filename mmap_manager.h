@@ -1,16 +1,50 @@
 #ifndef MMAP_MANAGER_H
 #define MMAP_MANAGER_H
+#include <cstddef>
 
 //! Manages the memory mapped file
+//
+//! Check get_error() after construction because a failure in opening or mapping does not abort.
+//! The mapping is a window of the file, which starts at the head unless it is moved by slide().
 class mmap_manager{
     struct impl;
     impl *pimpl;
     public:
+    //! how the file is opened and mapped
+    enum map_mode{
+        //! shared mapping that cannot be modified
+        read_only,
+        //! shared mapping whose modification is written back to the file
+        read_write,
+        //! private mapping whose modification is not written back to the file
+        copy_on_write
+    };
+    //! hints of the access, combined by bitwise or
+    enum map_hint{
+        //! no hint
+        no_hint = 0,
+        //! the window is read sequentially (MADV_SEQUENTIAL)
+        sequential = 1,
+        //! the window is read soon (MADV_WILLNEED)
+        will_need = 2,
+        //! the pages are read in mapping (MAP_POPULATE)
+        populate = 4,
+        //! transparent huge pages are used if the kernel supports them for the file (MADV_HUGEPAGE)
+        huge_pages = 8
+    };
     mmap_manager(const char *, bool);
     mmap_manager(const char *, bool, size_t);
+    mmap_manager(const char *, map_mode, size_t, unsigned int = no_hint);
     ~mmap_manager();
+    int get_error()const;
     void *get_ptr()const;
     size_t get_size()const;
+    size_t get_offset()const;
+    size_t get_file_size()const;
+    size_t remap(size_t);
+    size_t slide(size_t, size_t);
+    void mark_dirty(size_t, size_t);
+    size_t insert_head(size_t);
 };
 
 #endif
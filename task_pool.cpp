@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include "task_pool.h"
+
+namespace{
+
+//! tasks owned by a worker
+//
+//! The owner takes tasks from the front and other workers steal from the back,
+//! so a thief takes the tasks that the owner would process last.
+struct task_queue{
+    //! protects tasks
+    pthread_mutex_t mutex;
+    //! indices of tasks not started yet
+    std::deque<size_t> tasks;
+    task_queue(){
+        pthread_mutex_init(&mutex, NULL);
+    }
+    ~task_queue(){
+        pthread_mutex_destroy(&mutex);
+    }
+    //! take a task
+    //
+    //! @param from_front true for the owner, false for a thief
+    //! @param task index of the task is stored
+    //! @return false if the queue is empty
+    bool pop(bool from_front, size_t &task){
+        pthread_mutex_lock(&mutex);
+        const bool found = !tasks.empty();
+        if(found){
+            if(from_front){
+                task = tasks.front();
+                tasks.pop_front();
+            }
+            else{
+                task = tasks.back();
+                tasks.pop_back();
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        return found;
+    }
+};
+
+//! state shared by the workers of run_tasks()
+struct pool_context{
+    //! one queue per worker
+    task_queue *queues;
+    //! number of workers
+    unsigned int num_workers;
+    //! function to run tasks
+    task_func func;
+    //! context passed to func
+    void *arg;
+};
+
+//! argument of a worker thread
+struct worker_arg{
+    //! shared state
+    pool_context *ctx;
+    //! index of the worker
+    unsigned int id;
+};
+
+//! run tasks of own queue, then steal from the others until all queues are empty
+//
+//! No task is added while running, so all queues being empty means that the work is finished.
+void *worker_main(void *p){
+    const worker_arg &w = *static_cast<worker_arg *>(p);
+    pool_context &ctx = *w.ctx;
+    for(;;){
+        size_t task;
+        bool found = ctx.queues[w.id].pop(true, task);
+        for(unsigned int i = 1; !found && i < ctx.num_workers; ++i){
+            found = ctx.queues[(w.id + i) % ctx.num_workers].pop(false, task);
+        }
+        if(!found) break;
+        ctx.func(task, ctx.arg);
+    }
+    return NULL;
+}
+
+} //end of unnamed namespace
+
+//! get the number of online CPUs
+//
+//! @return number of CPUs, at least 1
+unsigned int get_num_cpus(){
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+//! run tasks concurrently on a work-stealing pool
+//
+//! Tasks are distributed to the workers as contiguous ranges first.
+//! A worker whose queue becomes empty steals tasks from the others,
+//! so a few slow tasks do not leave the other workers idle.
+//! The calling thread also works as one of the workers and this function returns when all tasks are done.
+//! @param num_workers number of workers, 0 for the number of CPUs
+//! @param num_tasks number of tasks
+//! @param func function called with the index of each task, which must be thread-safe
+//! @param arg context passed to func
+void run_tasks(unsigned int num_workers, size_t num_tasks, task_func func, void *arg){
+    if(num_workers == 0) num_workers = get_num_cpus();
+    if(num_workers > num_tasks) num_workers = num_tasks;
+    if(num_workers <= 1){
+        for(size_t i = 0; i < num_tasks; ++i) func(i, arg);
+        return;
+    }
+    pool_context ctx;
+    ctx.queues = new task_queue[num_workers];
+    ctx.num_workers = num_workers;
+    ctx.func = func;
+    ctx.arg = arg;
+    for(unsigned int i = 0; i < num_workers; ++i){
+        for(size_t t = num_tasks * i / num_workers, end = num_tasks * (i + 1) / num_workers; t < end; ++t){
+            ctx.queues[i].tasks.push_back(t);
+        }
+    }
+    std::vector<worker_arg> args(num_workers);
+    std::vector<pthread_t> threads(num_workers);
+    for(unsigned int i = 0; i < num_workers; ++i){
+        args[i].ctx = &ctx;
+        args[i].id = i;
+    }
+    //worker 0 runs on the calling thread
+    for(unsigned int i = 1; i < num_workers; ++i){
+        if(pthread_create(&threads[i], NULL, worker_main, &args[i])){
+            perror("pthread_create");
+            std::abort();
+        }
+    }
+    worker_main(&args[0]);
+    for(unsigned int i = 1; i < num_workers; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    delete [] ctx.queues;
+}
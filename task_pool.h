@@ -0,0 +1,13 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+#include <cstddef>
+
+//! function to run a task
+//
+//! The first argument is the index of the task and the second is the context given to run_tasks().
+typedef void (*task_func)(size_t, void *);
+
+unsigned int get_num_cpus();
+void run_tasks(unsigned int, size_t, task_func, void *);
+
+#endif
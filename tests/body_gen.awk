@@ -0,0 +1,28 @@
+#body of tests/t_000.vcd whose signals aaa, aad and aab change every step, appended to the header by the tests
+#awk -v steps=N [-v options] -f body_gen.awk
+#  steps       number of timestamps, 10 apart
+#  vector_x    the upper bit of aad is x every vector_x steps if given
+#  unknown     value of aab every 3 steps, x by default
+#  real_every  aac gets a real value every real_every steps if given
+#  cut_every   a one-line $comment is written every cut_every steps if given
+#  comment     lines separated by "," written in a $comment at every step if given
+#  dumpall     a $dumpall section is written at the end if 1
+BEGIN{
+    if(unknown == "") unknown = "x";
+    num_lines = comment == "" ? 0 : split(comment, lines, ",");
+    print "$dumpvars"; print "0aaa"; print "b0 aad"; print "x!ab"; print "$end";
+    for(t = 0; t < steps; ++t){
+        print "#" t * 10;
+        print (t % 2) "aaa";
+        print "b" (vector_x && t % vector_x == 0 ? "x" : int(t / 3) % 2) (t % 2) " aad";
+        if(t % 7 == 0) print (t % 3 == 0 ? unknown : "1") "aab";
+        if(real_every && t % real_every == 0) print "r" t / 4 " aac";
+        if(cut_every && t % cut_every == 0) print "$comment cut " t " $end";
+        if(num_lines){
+            print "$comment";
+            for(i = 1; i <= num_lines; ++i) print lines[i];
+            print "$end";
+        }
+    }
+    if(dumpall == 1){print "$dumpall"; print "1aaa"; print "$end";}
+}
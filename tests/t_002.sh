@@ -0,0 +1,25 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+cp -p ${root}/tests/${test_name}.vcd 0.vcd
+cp -p 0.vcd 1.vcd
+#the flattened header is larger than the original one by blank lines, which is fixed by --fit
+${hier_manip} --flatten --fit 1.vcd
+
+if test $(stat -c %s 0.vcd) -eq $(stat -c %s 1.vcd) && diff -w -B 0.vcd 1.vcd; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
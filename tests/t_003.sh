@@ -0,0 +1,44 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#batch mode, the same result as processing one by one is expected
+cp -p ${root}/tests/t_000.vcd 0.vcd
+cp -p 0.vcd expected.vcd
+${hier_manip} expected.vcd
+for i in 1 2 3 4 5 6 7 8; do cp -p 0.vcd ${i}.vcd; echo ${i}.vcd; done > list.txt
+echo missing.vcd >> list.txt
+
+result=0
+${hier_manip} --jobs 3 --files-from list.txt 2> report.txt || result=$?
+same=1
+for i in 1 2 3 4 5 6 7 8; do cmp -s expected.vcd ${i}.vcd || same=0; done
+
+#warnings of the parser are reported in the log of the file, also from the parser of multiple threads
+awk 'BEGIN{
+    print "$scope module top $end\n$comment inside $end"
+    for(i = 0; i < 10000; ++i) printf "$var wire 1 s%d a.u%d.sig_%d $end\n", i, i % 7, i
+    print "$upscope $end\n$enddefinitions $end"
+}' > w.vcd
+printf '$scope module top $end\n$comment inside $end\n$var wire 1 ! a.b $end\n$upscope $end\n$enddefinitions $end\n' > s.vcd
+${hier_manip} --jobs 2 --threads 2 w.vcd s.vcd 2> warn.txt
+logged=1
+test "$(grep -c '^    Warning Not supported parameter' warn.txt)" -eq 2 || logged=0
+grep -q '^Warning' warn.txt && logged=0
+
+if test ${result} -ne 0 && test ${same} -eq 1 && test ${logged} -eq 1 && grep -q "9 files, 1 failed" report.txt; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
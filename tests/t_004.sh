@@ -0,0 +1,61 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#a header large enough to be parsed by multiple threads
+awk 'BEGIN{
+    print "$date\n today\n$end\n$version\n SystemC 2.3.0-ASI\n$end\n$timescale\n 1 ps\n$end"
+    print "$scope module SystemC $end"
+    for(i = 0; i < 20000; ++i){
+        printf "$var wire 1 s%d u_top%d.u_sub%d.blk%d.sig_%d $end\n", i, i % 3, i % 7, i % 13, i
+        if(i == 10000) print "$scope module u_top1 $end\n$var wire 8 x0 u_sub1.bus $end\n$var wire 8 x1 extra $end\n$upscope $end"
+    }
+    print "$upscope $end\n$enddefinitions $end\n#0\n1s0\n#10\n0s0"
+}' > 0.vcd
+
+#scopes opened again, which are merged only when the hierarchy is established
+awk 'BEGIN{
+    print "$timescale 1 ps $end"
+    for(n = 0; n < 2; ++n){
+        print "$scope module top $end"
+        print "$scope module sub $end"
+        for(i = 0; i < 5000; ++i) printf "$var wire 1 r%d_%d sig_%d $end\n", n, i, i
+        print "$upscope $end"
+        for(i = 0; i < 100; ++i) printf "$var wire 1 t%d_%d blk%d.sig_%d $end\n", n, i, i % 3, i
+        print "$upscope $end"
+        #out of scopes, which is dropped with warnings
+        printf "$var wire 1 o%d outer $end\n$var wire 4 p%d outer_bus [3:0] $end\n", n, n
+    }
+    print "$enddefinitions $end\n#0\n1r0_0"
+}' > 5.vcd
+
+result=0
+for vcd in 0.vcd 5.vcd; do
+    for mode in "" "--flatten"; do
+        ${hier_manip} --threads 1 ${mode} --output 1.vcd ${vcd} 2> 1.txt
+        ${hier_manip} --threads 4 ${mode} --output 4.vcd ${vcd} 2> 4.txt
+        cmp -s 1.vcd 4.vcd || result=1
+        #the same warnings in the same format
+        cmp -s 1.txt 4.txt || result=1
+    done
+done
+${hier_manip} --threads 4 --flatten --output 4.vcd 5.vcd 2> /dev/null
+test "$(grep -c '^\$scope module top' 4.vcd)" -eq 2 || result=1
+test "$(grep -c "^Warning Not supported parameter key:\$var val:'wire" 4.txt)" -eq 4 || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
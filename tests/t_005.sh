@@ -0,0 +1,89 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#random value changes with repeated values and vectors with redundant leading bits
+awk 'BEGIN{
+    srand(1)
+    print "$date\n today\n$end\n$version\n SystemC 2.3.0-ASI\n$end\n$timescale\n 1 ps\n$end"
+    print "$scope module SystemC $end"
+    for(i = 0; i < 150; ++i){
+        if(i % 10 == 0) printf "$var wire 8 v%d u_top.blk%d.bus_%d $end\n", i, i % 3, i
+        else printf "$var wire 1 s%d u_top.blk%d.sig_%d $end\n", i, i % 3, i
+    }
+    print "$upscope $end\n$enddefinitions $end\n$dumpvars"
+    for(i = 0; i < 150; ++i){
+        if(i % 10 == 0) printf "b00000000 v%d\n", i
+        else printf "xs%d\n", i
+    }
+    print "$end"
+    for(t = 1; t <= 300; ++t){
+        printf "#%d\n", t * 10
+        for(n = 0; n < 20; ++n){
+            i = int(rand() * (rand() < 0.5 ? 8 : 150))
+            if(i % 10 == 0){
+                v = ""
+                for(b = 0; b < 8; ++b) v = v (b < 3 ? (t % 7 == 0 ? "x" : "0") : (rand() < 0.5 ? "0" : (rand() < 0.8 ? "1" : "z")))
+                printf "b%s v%d\n", v, i
+            }
+            else printf "%ds%d\n", rand() < 0.5, i
+        }
+        if(t == 150) print "$comment checkpoint $end"
+    }
+}' > 0.vcd
+
+#print the value changes that do not repeat the current value, by the full path of signals
+dump_changes(){
+    awk 'BEGIN{RS = "[ \t\n]+"}
+    !body && $0 == "$scope"{getline; getline; scope[++depth] = $0; next}
+    !body && $0 == "$upscope"{--depth; next}
+    !body && $0 == "$var"{
+        getline; getline; w = $0; getline; code = $0; width[code] = w
+        path = scope[1]
+        for(d = 2; d <= depth; ++d) path = path "." scope[d]
+        for(getline; $0 != "$end"; getline) path = path "." $0
+        name[code] = path
+        next
+    }
+    $0 == "$enddefinitions"{body = 1; next}
+    !body{next}
+    /^#/{time = $0; next}
+    {c = ""}
+    /^[01xz]/{v = substr($0, 1, 1); c = substr($0, 2)}
+    /^b/{
+        #extend the value to the width of the signal
+        v = substr($0, 2)
+        getline
+        c = $0
+        pad = (v ~ /^[xz]/) ? substr(v, 1, 1) : "0"
+        while(length(v) < width[c]) v = pad v
+    }
+    c != "" && last[c] != v{print time, name[c], v}
+    c != ""{last[c] = v}' $1
+}
+
+dump_changes 0.vcd > 0.txt
+result=0
+for mode in "" "--flatten"; do
+    ${hier_manip} ${mode} --compact --output 1.vcd 0.vcd 2> /dev/null
+    test $(stat -c %s 1.vcd) -lt $(stat -c %s 0.vcd) || result=1
+    dump_changes 1.vcd > 1.txt
+    cmp -s 0.txt 1.txt || result=1
+done
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,51 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#signal i is in u_top.blk(i % 3), and value changes in $comment must be kept
+awk 'BEGIN{
+    print "$date\n today\n$end\n$version\n SystemC 2.3.0-ASI\n$end\n$timescale\n 1 ps\n$end"
+    print "$scope module SystemC $end"
+    for(i = 0; i < 30; ++i) printf "$var wire 1 s%d u_top.blk%d.sig_%d $end\n", i, i % 3, i
+    print "$var wire 4 v0 u_top.blk1.bus $end"
+    print "$upscope $end\n$enddefinitions $end\n$dumpvars"
+    for(i = 0; i < 30; ++i) printf "0s%d\n", i
+    print "b0000 v0\n$end"
+    for(t = 1; t <= 1000; ++t){
+        printf "#%d\n", t * 10
+        for(i = t % 5; i < 30; i += 5) printf "%ds%d\n", t % 2, i
+        printf "b%d%d%d%d v0\n", t % 2, t % 3 == 0, t % 5 == 0, t % 7 == 0
+        if(t == 500) print "$comment\n1s0\n1s2\n$end"
+    }
+}' > 0.vcd
+
+#value changes of the dropped signals are removed and the rest of the body is kept as it is
+awk '/^\$comment/{comment = 1}
+    /^\$end/{comment = 0}
+    !comment && body && /^[01]s/{i = substr($0, 3); if(i % 3 != 1 || i == 1) next}
+    /^\$enddefinitions/{body = 1}
+    body' 0.vcd > expected.txt
+
+result=0
+for threads in 1 4; do
+    ${hier_manip} --threads ${threads} --keep 'u_top.blk1.*' --drop '*.sig_1' --output 1.vcd 0.vcd 2> /dev/null
+    test $(grep -c '\$var' 1.vcd) -eq 10 || result=1
+    sed -n '/^\$enddefinitions/,$p' 1.vcd | cmp -s - expected.txt || result=1
+done
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,39 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+result=0
+#statistics must not change the result
+cp "${root}/tests/t_000.vcd" 0.vcd
+cp "${root}/tests/t_000.vcd" 1.vcd
+${hier_manip} 0.vcd 2> /dev/null
+${hier_manip} --stats=json 1.vcd > stats.json 2> /dev/null
+cmp -s 0.vcd 1.vcd || result=1
+
+#one JSON object with the phases and the counters
+test $(wc -l < stats.json) -eq 1 || result=1
+for key in '"file":"1.vcd"' '"name":"parse"' '"name":"write"' '"arena":' '"bytes_written":' '"minor_faults":' '"msync_calls":1'; do
+    grep -q -F "${key}" stats.json || result=1
+done
+
+#text report is written to the standard error
+${hier_manip} --stats --output 2.vcd 0.vcd 2> stats.txt > stdout.txt
+grep -q "^Stats of the run" stats.txt || result=1
+test -s stdout.txt && result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,53 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#a body of several compressed blocks
+awk 'BEGIN{
+    print "$timescale\n 1 ps\n$end"
+    print "$scope module SystemC $end"
+    for(i = 0; i < 100; ++i) printf "$var wire 1 s%d u_top.blk%d.sig_%d $end\n", i, i % 5, i
+    print "$upscope $end\n$enddefinitions $end"
+    for(t = 0; t < 100000; ++t){
+        printf "#%d\n", t * 10
+        for(i = t % 3; i < 100; i += 17) printf "%d%s\n", (t + i) % 2, "s" i
+    }
+}' > 0.vcd
+${hier_manip} --output ref.vcd 0.vcd 2> /dev/null
+gzip -c 0.vcd > 0.vcd.gz
+
+result=0
+#plain to compressed, on 1 and 4 threads
+${hier_manip} --threads 1 --output 1.vcd.gz 0.vcd 2> /dev/null
+${hier_manip} --threads 4 --output 4.vcd.gz 0.vcd 2> /dev/null
+gzip -t 1.vcd.gz || result=1
+cmp -s 1.vcd.gz 4.vcd.gz || result=1
+zcat 1.vcd.gz | cmp -s - ref.vcd || result=1
+
+#compressed to plain and to compressed
+${hier_manip} --output 2.vcd 0.vcd.gz 2> /dev/null
+cmp -s 2.vcd ref.vcd || result=1
+${hier_manip} --output 3.vcd.gz 1.vcd.gz 2> /dev/null
+zcat 3.vcd.gz | cmp -s - ref.vcd || result=1
+
+#compressed VCD cannot be modified in-place
+cp 0.vcd.gz 5.vcd.gz
+${hier_manip} 5.vcd.gz 2> /dev/null && result=1
+cmp -s 0.vcd.gz 5.vcd.gz || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
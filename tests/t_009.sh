@@ -0,0 +1,57 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+cp "${root}/tests/t_000.vcd" 0.vcd
+${hier_manip} --output ref.vcd 0.vcd 2> /dev/null
+${hier_manip} --flatten --output ref_flat.vcd 0.vcd 2> /dev/null
+
+result=0
+#the first run writes the index and the second run loads it
+${hier_manip} --index --output 1.vcd 0.vcd 2> log1.txt
+test -f 0.vcd.idx || result=1
+grep -q "Index is written" log1.txt || result=1
+${hier_manip} --index --output 2.vcd 0.vcd 2> log2.txt
+grep -q "Header is loaded" log2.txt || result=1
+cmp -s 1.vcd ref.vcd || result=1
+cmp -s 2.vcd ref.vcd || result=1
+
+#the index of the other mode is not used but replaced
+${hier_manip} --index --flatten --output 3.vcd 0.vcd 2> log3.txt
+grep -q "Header is loaded" log3.txt && result=1
+${hier_manip} --index --flatten --output 4.vcd 0.vcd 2> log4.txt
+grep -q "Header is loaded" log4.txt || result=1
+cmp -s 3.vcd ref_flat.vcd || result=1
+cmp -s 4.vcd ref_flat.vcd || result=1
+
+#a changed header makes the index out of date
+sed -i 's/\$timescale/$timescale /' 0.vcd
+${hier_manip} --flatten --output ref5_flat.vcd 0.vcd 2> /dev/null
+${hier_manip} --output ref5.vcd 0.vcd 2> /dev/null
+${hier_manip} --index --flatten --output 5.vcd 0.vcd 2> log5.txt
+grep -q "out of date" log5.txt || result=1
+cmp -s 5.vcd ref5_flat.vcd || result=1
+
+#a truncated index is rejected
+${hier_manip} --index --output 6.vcd 0.vcd 2> /dev/null
+truncate -s -3 0.vcd.idx
+${hier_manip} --index --output 7.vcd 0.vcd 2> log7.txt
+grep -q "broken" log7.txt || result=1
+cmp -s 7.vcd ref5.vcd || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
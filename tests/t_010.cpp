@@ -0,0 +1,103 @@
+//test of the library: parse and write headers in memory
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+#include "vcd_lib.h"
+
+namespace{
+
+//! number of heap allocations
+size_t num_allocs = 0;
+
+//! append the header to a string
+bool append(const char *s, size_t len, void *arg){
+    static_cast<std::string *>(arg)->append(s, len);
+    return true;
+}
+
+//! parse a VCD and write it with the new header
+bool fix(vcd_hier_parser &parser, const std::vector<char> &vcd, bool flatten, std::vector<char> &buf, std::string &out){
+    size_t len;
+    if(parser.parse(&vcd.front(), vcd.size(), flatten) != vcd_ok) return false;
+    if(parser.write(&buf.front(), buf.size(), 0, len) != vcd_ok) return false;
+    out.assign(&buf.front(), len);
+    out.append(&vcd.front() + parser.get_header_size(), vcd.size() - parser.get_header_size());
+    return true;
+}
+
+} //end of unnamed namespace
+
+void *operator new(size_t size){
+    ++num_allocs;
+    void *const p = std::malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw(){
+    std::free(p);
+}
+
+int main(int argc, char *argv[]){
+    if(argc != 4) return 2;
+    std::ifstream is(argv[1], std::ios::binary);
+    const std::vector<char> vcd((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    std::vector<char> buf(vcd.size() * 2);
+    int result = 0;
+    vcd_hier_parser parser;
+    const char *const files[] = {argv[2], argv[3]};
+    for(int flatten = 0; flatten < 2; ++flatten){
+        std::string out;
+        //the first round allocates the memory kept by the parser
+        if(!fix(parser, vcd, flatten, buf, out)) result = 1;
+        const size_t allocs = num_allocs;
+        if(!fix(parser, vcd, flatten, buf, out)) result = 1;
+        if(num_allocs != allocs){
+            std::printf("%lu allocations in the second round\n", static_cast<unsigned long>(num_allocs - allocs));
+            result = 1;
+        }
+        std::ofstream(files[flatten], std::ios::binary) << out;
+    }
+
+    //the header through a callback is the same as that in the buffer
+    std::string s;
+    size_t len;
+    if(parser.write(append, &s, 1) != vcd_ok || parser.write(&buf.front(), buf.size(), 1, len) != vcd_ok) result = 1;
+    if(s != std::string(&buf.front(), len)) result = 1;
+    if(parser.write(&buf.front(), len - 1, 1, len) != vcd_buffer_too_small || len != s.size()) result = 1;
+    if(parser.write(&buf.front(), buf.size(), 5, len) != vcd_invalid_argument) result = 1;
+
+    //errors are returned
+    struct{
+        const char *vcd;
+        vcd_status status;
+        size_t offset;
+    } const cases[] = {
+        {"$scope module top $end\n$upscope $end\n", vcd_no_enddefinitions, 0},
+        {"$scope module $end\n$upscope $end\n$enddefinitions $end\n", vcd_syntax_error, 0},
+        {"$scope task top $end\n$upscope $end\n$enddefinitions $end\n", vcd_unsupported, 0},
+        {"$scope module top $end\n$var reg 1 ! a $end\n$upscope $end\n$enddefinitions $end\n", vcd_unsupported, 23},
+        {"$scope module top $end\n$var wire x ! a $end\n$upscope $end\n$enddefinitions $end\n", vcd_syntax_error, 23},
+        {"$date a $end\n$date b $end\n$enddefinitions $end\n", vcd_syntax_error, 13},
+        {"$date a $end\nstray\n$enddefinitions $end\n", vcd_syntax_error, 13},
+        {"$var wire 1 ! a $end\n$enddefinitions $end\n", vcd_unsupported, 0},
+        {"$upscope $end\n$enddefinitions $end\n", vcd_unsupported, 0},
+        {"$attrbegin a $end\n$enddefinitions $end\n", vcd_unsupported, 0},
+        {"$scope module top $end\n$comment c $end\n$upscope $end\n$enddefinitions $end\n", vcd_unsupported, 23},
+        {"$scope module top $end\n$var wire 1 ! x. $end\n$upscope $end\n$enddefinitions $end\n", vcd_unsupported, 23},
+    };
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i){
+        const vcd_status st = parser.parse(cases[i].vcd, std::strlen(cases[i].vcd), false);
+        if(st != cases[i].status || parser.get_error_offset() != cases[i].offset){
+            std::printf("case %lu: %s at %lu\n", static_cast<unsigned long>(i), get_status_str(st), static_cast<unsigned long>(parser.get_error_offset()));
+            result = 1;
+        }
+    }
+    if(parser.write(append, &s, 0) != vcd_invalid_argument) result = 1;
+    return result;
+}
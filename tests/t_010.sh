@@ -0,0 +1,34 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#the program is linked with the static library
+${CXX:-g++} -O2 -Wall -I"${root}" -o lib_test "${root}/tests/${test_name}.cpp" "${root}/libvcdhier.a" -lpthread -lz
+
+cp "${root}/tests/t_000.vcd" 0.vcd
+${hier_manip} --output ref.vcd 0.vcd 2> /dev/null
+${hier_manip} --flatten --output ref_flat.vcd 0.vcd 2> /dev/null
+
+result=0
+./lib_test 0.vcd 1.vcd 2.vcd 2> err.txt || result=1
+#the library reports everything as vcd_status
+test -s err.txt && result=1
+cmp -s 1.vcd ref.vcd || result=1
+cmp -s 2.vcd ref_flat.vcd || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,51 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+cp "${root}/tests/t_000.vcd" 0.vcd
+cp 0.vcd orig.vcd
+
+result=0
+test "$(${hier_manip} --count 0.vcd)" = "339 signals in 10 modules" || result=1
+${hier_manip} --list '' 0.vcd > all.txt
+test $(wc -l < all.txt) -eq 339 || result=1
+grep -q "^u_tb.reset_n	aaa	1$" all.txt || result=1
+
+#scopes are matched by segments with wildcards, with and without the hierarchy
+test "$(${hier_manip} --list 'u_tb.u_ahb2tlm*' --count 0.vcd)" = "56 signals in 2 modules" || result=1
+test "$(${hier_manip} --flatten --list 'u_tb.u_ahb2tlm*' --count 0.vcd)" = "56 signals in 1 modules" || result=1
+test "$(${hier_manip} --list 'u_tb.u_ahb2tlm' --count 0.vcd)" = "0 signals in 0 modules" || result=1
+${hier_manip} --list u_tb.u_apb_slave 0.vcd | cut -f1 | sort > apb.txt
+grep "^u_tb.u_apb_slave\." all.txt | cut -f1 | sort | cmp -s - apb.txt || result=1
+
+#signals are found by a pattern of the full path, "**" matches any levels
+test "$(${hier_manip} --find '**.*clk*' --count 0.vcd)" = "16 signals in 10 modules" || result=1
+test "$(${hier_manip} --flatten --find '**.*clk*' --count 0.vcd)" = "16 signals in 1 modules" || result=1
+${hier_manip} --find 'u_tb.?_ahb_*.h*' 0.vcd | cut -f1 | sort > found.txt
+grep -E "^u_tb\.u_ahb_[^.]*\.h[^.]*	" all.txt | cut -f1 | sort | cmp -s - found.txt || result=1
+
+#the index is written and used by queries, and the VCD is not modified
+${hier_manip} --index --list '' 0.vcd > 1.txt 2> /dev/null
+${hier_manip} --index --list '' 0.vcd > 2.txt 2> log.txt
+grep -q "Header is loaded" log.txt || result=1
+cmp -s all.txt 1.txt || result=1
+cmp -s all.txt 2.txt || result=1
+cmp -s 0.vcd orig.vcd || result=1
+${hier_manip} --list '' --output 3.vcd 0.vcd 2> /dev/null && result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,84 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#a body of a few MB has several checkpoints
+cp "${root}/tests/t_000.vcd" 0.vcd
+awk -v steps=200000 -v cut_every=1000 -f "${root}/tests/body_gen.awk" >> 0.vcd
+cp 0.vcd orig.vcd
+
+#the values at from and the lines after from to to, replayed from the head by awk
+#"!ab" is not in the header and has no value in $dumpvars
+slice_ref(){
+    awk -v from=$1 -v to=$2 '
+        /^\$enddefinitions/{body = 1; next}
+        !body{next}
+        /^#/{t = substr($0, 2) + 0; if(t > to) exit; if(t > from && !copy){copy = 1; for(c in v) print v[c] | "sort > dumpvars_ref.txt"}}
+        copy{print > "window_ref.txt"; next}
+        /^[01xz]a/{v[substr($0, 2)] = $0}
+        /^b/{v[$2] = $0}
+        END{if(!copy) for(c in v) print v[c] | "sort > dumpvars_ref.txt"}
+    ' 0.vcd
+    touch window_ref.txt
+}
+
+#compare a slice with the reference
+check_slice(){
+    local from=$1 to=$2 out=$3
+    rm -f dumpvars_ref.txt window_ref.txt
+    slice_ref ${from} ${to}
+    sed -n '/^\$enddefinitions/,$p' ${out} > body.txt
+    test "$(sed -n 2p body.txt)" = "#${from}" || return 1
+    sed -n '/^\$dumpvars/,/^\$end/p' body.txt | sed '1d;$d' | sort | cmp -s - dumpvars_ref.txt || return 1
+    sed '1,/^\$end/d' body.txt | cmp -s - window_ref.txt || return 1
+    ${hier_manip} 0.vcd --output full.vcd 2> /dev/null
+    sed '/^\$enddefinitions/,$d' full.vcd | cmp -s - <(sed '/^\$enddefinitions/,$d' ${out}) || return 1
+}
+
+result=0
+${hier_manip} --from 1000 --to 2000 0.vcd --output 1.vcd 2> /dev/null
+check_slice 1000 2000 1.vcd || result=1
+${hier_manip} --from 1005 --to 1005 0.vcd --output 2.vcd 2> /dev/null
+check_slice 1005 1005 2.vcd || result=1
+
+#the time index is written by the first cut and used by the later cuts
+${hier_manip} --index --from 1500000 --to 1600000 0.vcd --output 3.vcd 2> log.txt
+grep -q "Time index is written" log.txt || result=1
+check_slice 1500000 1600000 3.vcd || result=1
+${hier_manip} --index --from 1500000 --to 1600000 0.vcd --output 4.vcd 2> log.txt
+grep -q "Time index is loaded" log.txt || result=1
+cmp -s 3.vcd 4.vcd || result=1
+${hier_manip} --index --from 1234567 --to 1300000 0.vcd --output 5.vcd 2> log.txt
+check_slice 1234567 1300000 5.vcd || result=1
+${hier_manip} --index --from 1999990 0.vcd --output 6.vcd 2> /dev/null
+check_slice 1999990 18446744073709551615 6.vcd || result=1
+${hier_manip} --index --to 0 0.vcd --output 7.vcd 2> /dev/null
+check_slice 0 0 7.vcd || result=1
+cmp -s 0.vcd orig.vcd || result=1
+
+#a stale index is rebuilt
+echo "#2000000" >> 0.vcd
+${hier_manip} --index --from 1234567 --to 1300000 0.vcd --output 8.vcd 2> log.txt
+grep -q "Time index is out of date" log.txt || result=1
+cmp -s 5.vcd 8.vcd || result=1
+
+${hier_manip} --from 20 --to 10 0.vcd --output 9.vcd 2> /dev/null && result=1
+${hier_manip} --from 1x 0.vcd --output 9.vcd 2> /dev/null && result=1
+${hier_manip} --from 10 0.vcd 2> /dev/null && result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,43 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#a body of a few MB is split into several chunks, which often start in a $comment of several lines
+cp "${root}/tests/t_000.vcd" 0.vcd
+awk -v steps=150000 -v comment='1aaa,b1 aad' -v dumpall=1 -f "${root}/tests/body_gen.awk" >> 0.vcd
+cp 0.vcd orig.vcd
+
+result=0
+${hier_manip} --activity=3 0.vcd > 1.txt 2> log.txt
+printf "signal\t150000\tu_tb.reset_n\taaa\nsignal\t150000\tu_tb.ahb0_htrans [1:0]\taad\nsignal\t21429\tu_tb.ahb0_hsel\taab\n" > top.txt
+head -3 1.txt | cmp -s - top.txt || result=1
+grep -q "^scope	321429	u_tb$" 1.txt || result=1
+test $(grep -c "^scope	0	u_tb\." 1.txt) -eq 9 || result=1
+grep -q "^321429 value changes" log.txt || result=1
+grep -q "^150000 value changes of signals not in the header" log.txt && result=1
+
+#the result does not depend on the number of threads
+for n in 2 5 7; do
+    ${hier_manip} --threads ${n} --activity=3 0.vcd 2> /dev/null | cmp -s - 1.txt || result=1
+done
+test $(${hier_manip} --activity 0.vcd 2> /dev/null | grep -c "^signal") -eq 20 || result=1
+${hier_manip} --flatten --activity=1 0.vcd 2> /dev/null | head -1 | cmp -s - <(head -1 top.txt) || result=1
+cmp -s 0.vcd orig.vcd || result=1
+${hier_manip} --activity --output 2.vcd 0.vcd 2> /dev/null && result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
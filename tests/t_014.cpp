@@ -0,0 +1,33 @@
+//test of the library: read columns of a columnar store
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "vcd_header.h"
+#include "vcd_columnar.h"
+
+//usage: lib_test STORE CODE [TIME]
+//writes the changes of CODE as the time and the value separated by tab, from the last change at or before TIME if given
+int main(int argc, char *argv[]){
+    if(argc != 3 && argc != 4) return 2;
+    const columnar_store store(argv[1]);
+    if(!store.is_valid()){
+        std::printf("%s is broken\n", argv[1]);
+        return 1;
+    }
+    const uint32_t col = store.find_column(string_view(argv[2], std::strlen(argv[2])));
+    if(col == columnar_store::npos){
+        std::printf("%s is not found\n", argv[2]);
+        return 3;
+    }
+    column_cursor cursor(store, col);
+    if(argc == 4 && !cursor.seek(std::strtoull(argv[3], NULL, 10))) return 1;
+    uint64_t n = 0;
+    while(cursor.next()){
+        std::printf("%llu\t%s\n", static_cast<unsigned long long>(cursor.get_time()), cursor.get_value().c_str());
+        ++n;
+    }
+    if(cursor.is_broken()) return 1;
+    //the whole column has as many changes as the store records
+    if(argc == 3 && n != store.get_num_changes(col)) return 1;
+    return 0;
+}
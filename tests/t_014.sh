@@ -0,0 +1,64 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#the program is linked with the static library
+${CXX:-g++} -O2 -Wall -I"${root}" -o lib_test "${root}/tests/${test_name}.cpp" "${root}/libvcdhier.a" -lpthread -lz
+
+#columns of scalars, vectors with x and reals span several blocks
+cp "${root}/tests/t_000.vcd" 0.vcd
+awk -v steps=100000 -v vector_x=5 -v unknown=z -v real_every=1000 -v comment=1aaa -f "${root}/tests/body_gen.awk" >> 0.vcd
+
+#changes of a code after $enddefinitions except in $comment
+extract(){
+    awk -v code=$1 -v t=0 'body == 0{if(/^\$enddefinitions/) body = 1; next}
+        /^#/{t = substr($0, 2); next}
+        /^\$comment/{c = 1; next} /^\$end/{c = 0; next} c{next}
+        /^[brs]/{if($2 == code) print t "\t" $1; next}
+        /^[01xz]/{if(substr($0, 2) == code) print t "\t" substr($0, 1, 1)}' 0.vcd
+}
+
+result=0
+${hier_manip} --export-columnar 0.vcd --output 0.col 2> log.txt
+grep -q "^Body size .*, 214388 value changes in 339 columns" log.txt || result=1
+grep -q "not in the header" log.txt || result=1
+for code in aaa aab aac aad; do
+    extract ${code} > ${code}.txt
+    ./lib_test 0.col ${code} | cmp -s - ${code}.txt || result=1
+done
+
+#seek reads only from the last change at or before the time
+./lib_test 0.col aab 5000 | cmp -s - <(awk -F '\t' '$1 >= 4970' aab.txt) || result=1
+./lib_test 0.col aaa 999995 | cmp -s - <(tail -1 aaa.txt) || result=1
+./lib_test 0.col aac 0 | cmp -s - aac.txt || result=1
+./lib_test 0.col aae > /dev/null || result=1
+test -z "$(./lib_test 0.col aae)" || result=1
+./lib_test 0.col nocode > /dev/null && result=1
+
+#only the selected signals have changes
+${hier_manip} --export-columnar --keep 'u_tb.reset_n' 0.vcd --output 1.col 2> /dev/null
+./lib_test 1.col aaa | cmp -s - aaa.txt || result=1
+./lib_test 1.col aad > /dev/null && result=1
+
+#a truncated store is rejected
+head -c 100000 0.col > 2.col
+./lib_test 2.col aaa > /dev/null && result=1
+${hier_manip} --export-columnar 0.vcd 2> /dev/null && result=1
+${hier_manip} --export-columnar --output 3.col.gz 0.vcd 2> /dev/null && result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
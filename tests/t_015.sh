@@ -0,0 +1,88 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#three VCDs with colliding identifier codes, the first and the last share their times
+#gen NAME MODULE START STEP
+gen(){
+    printf '$timescale %s $end\n$scope module %s $end\n' "${5:-1ns}" $2 > $1
+    printf '$var wire 1 ! clk $end\n$var wire 4 " data $end\n$var wire 1 # alias $end\n$var wire 1 # alias2 $end\n' >> $1
+    printf '$var real 64 %% level $end\n$upscope $end\n$enddefinitions $end\n' >> $1
+    awk -v start=$3 -v step=$4 'BEGIN{
+        print "$dumpvars"; print "0!"; print "bx \""; print "z#"; print "r0 %"; print "$end";
+        for(t = 0; t < 30000; ++t){
+            print "#" start + t * step;
+            print (t % 2) "!";
+            if(t % 3 == 0) print "b" (t % 2) (t % 5 == 0 ? "x" : "1") " \"";
+            if(t % 7 == 0){print (t % 2) "#"; print "r" t / 8 " %"}
+            if(t % 1000 == 0) print "$comment mark " t " $end";
+        }
+    }' >> $1
+}
+
+#changes of each signal as the path, the time and the value in the order of the body
+#norm VCD PREFIX
+norm(){
+    ${hier_manip} --find '**' $1 2> /dev/null > codes.txt
+    awk -v prefix=$2 -v t=0 -F '\t' 'NR == FNR{path[$2] = prefix $1; next}
+        body == 0{if(/^\$enddefinitions/) body = 1; next}
+        /^#/{t = substr($0, 2); next}
+        /^\$comment/{next} /^\$/{next}
+        /^[brs]/{split($0, f, " "); print path[f[2]] " " t " " f[1]; next}
+        {print path[substr($0, 2)] " " t " " substr($0, 1, 1)}' codes.txt $1 | sort -s -t ' ' -k1,1
+}
+
+gen a.vcd top 0 10
+gen b.vcd cpu 5 15
+gen c.vcd dma 0 10
+
+result=0
+${hier_manip} --merge a.vcd b.vcd c.vcd --output m.vcd 2> log.txt
+grep -q "^Merged 3 files: .*, 50000 timestamps from 90000$" log.txt || result=1
+#codes are renamed only when they collide, and aliases are kept
+test "$(grep -c '\$var' m.vcd)" -eq 15 || result=1
+test "$(awk '/\$var/{print $4}' m.vcd | sort -u | wc -l)" -eq 12 || result=1
+grep -q '^\$scope module b \$end' <(sed 's/^\t*//' m.vcd) || result=1
+#timestamps increase strictly
+grep '^#' m.vcd | awk '{t = substr($0, 2) + 0; if(NR > 1 && t <= last) exit 1; last = t}' || result=1
+test "$(grep -c '^\$dumpvars' m.vcd)" -eq 3 || result=1
+test "$(grep -c '^\$enddefinitions' m.vcd)" -eq 1 || result=1
+
+#every signal has the same changes as in its input
+norm a.vcd top. > ref.txt
+norm b.vcd cpu. >> ref.txt
+norm c.vcd dma. >> ref.txt
+norm m.vcd "" > out.txt
+sort -s -t ' ' -k1,1 ref.txt | cmp -s - out.txt || result=1
+test -s out.txt || result=1
+
+#the merged VCD is parsed again with the same header
+${hier_manip} --output m2.vcd m.vcd 2> /dev/null
+cmp -s m.vcd m2.vcd || result=1
+
+${hier_manip} --merge --merge-scope x --merge-scope y a.vcd b.vcd --output n.vcd 2> /dev/null
+grep -q 'scope module y ' n.vcd || result=1
+${hier_manip} --merge --merge-scope x a.vcd b.vcd --output n.vcd 2> /dev/null && result=1
+${hier_manip} --merge a.vcd b.vcd 2> /dev/null && result=1
+gen d.vcd top 0 10 1ps
+${hier_manip} --merge a.vcd d.vcd --output n.vcd 2> /dev/null && result=1
+cp a.vcd e.vcd
+${hier_manip} --merge a.vcd e.vcd --output e.vcd 2> /dev/null && result=1
+cmp -s a.vcd e.vcd || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,86 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#every signal changes in turn, a few at each time
+cp "${root}/tests/t_000.vcd" 0.vcd
+${hier_manip} --find '**' 0.vcd 2> /dev/null | cut -f 2 > codes.txt
+awk 'NR == FNR{code[n++] = $1; next} END{
+    print "$dumpvars"; for(i = 0; i < n; ++i) print "x" code[i]; print "$end";
+    for(t = 0; t < 40000; ++t){
+        print "#" t * 10;
+        for(i = 0; i < 3; ++i){
+            c = code[(t * 7 + i * 131) % n];
+            if(i == 1) print "b" (t % 2) "1 " c; else print (t % 2) c;
+        }
+        if(t % 5000 == 0) print "$comment mark " t " $end";
+    }
+}' codes.txt /dev/null >> 0.vcd
+
+#changes of each signal as the path, the time and the value in the order of the body
+#norm VCD [SCOPE]
+norm(){
+    ${hier_manip} --find '**' $1 2> /dev/null > $1.paths
+    awk -v scope="$2" -v t=0 -F '\t' 'NR == FNR{path[$2] = $1; next}
+        body == 0{if(/^\$enddefinitions/) body = 1; next}
+        /^#/{t = substr($0, 2); next}
+        /^\$/ || NF == 0{next}
+        /^[brs]/{split($0, f, " "); p = path[f[2]]; v = f[1]}
+        /^[^brs]/{p = path[substr($0, 2)]; v = substr($0, 1, 1)}
+        index(p, scope) == 1{print p " " t " " v}' $1.paths $1 | sort -s -t ' ' -k1,1
+}
+
+result=0
+${hier_manip} --split 'u_tb.ahb0_*=a.vcd' --split 'u_tb.u_tlm2ahb?=t.vcd.gz' --split 'u_tb.u_ahb_slave=s.vcd' 0.vcd 2> log.txt
+grep -q "^a.vcd: 11 signals, " log.txt || result=1
+grep -q "^t.vcd.gz: 88 signals, " log.txt || result=1
+grep -q "^s.vcd: 14 signals, " log.txt || result=1
+grep -q "is split into 3 files, " log.txt || result=1
+zcat t.vcd.gz > t.vcd
+for f in a t s; do
+    #no timestamp is written without a change after it
+    awk '/^#/{if(stamp) exit 1; stamp = 1; next} {stamp = 0}' ${f}.vcd || result=1
+    test "$(grep -c '^\$comment mark' ${f}.vcd)" -eq 8 || result=1
+    #the output is parsed again with the same header
+    ${hier_manip} --output ${f}2.vcd ${f}.vcd 2> /dev/null
+    cmp -s ${f}.vcd ${f}2.vcd || result=1
+done
+norm 0.vcd u_tb.ahb0_ | cmp -s - <(norm a.vcd) || result=1
+norm 0.vcd u_tb.u_tlm2ahb | cmp -s - <(norm t.vcd) || result=1
+norm 0.vcd u_tb.u_ahb_slave. | cmp -s - <(norm s.vcd) || result=1
+test -s s.vcd || result=1
+
+#a file for each scope at the depth
+${hier_manip} --split-at 1 0.vcd --output p.vcd 2> /dev/null
+norm 0.vcd | cmp -s - <(norm p.u_tb.vcd) || result=1
+${hier_manip} --split-at 2 0.vcd --output q.vcd 2> log.txt
+test "$(ls q.u_tb.*.vcd | wc -l)" -eq 9 || result=1
+norm 0.vcd u_tb.u_ahb2tlm1. | cmp -s - <(norm q.u_tb.u_ahb2tlm1.vcd) || result=1
+
+${hier_manip} --split 'u_tb.nothing=n.vcd' 0.vcd 2> /dev/null && result=1
+${hier_manip} --split 'u_tb.ahb0_*=a.vcd' 0.vcd --output o.vcd 2> /dev/null && result=1
+${hier_manip} --split 'a.vcd' 0.vcd 2> /dev/null && result=1
+${hier_manip} --split-at 1 0.vcd 2> /dev/null && result=1
+#the input is not truncated when it is also an output, even through another name
+cp -p 0.vcd in.vcd
+ln -s in.vcd link.vcd
+${hier_manip} --split 'u_tb.ahb0_*=x.vcd' --split 'u_tb.u_ahb_slave=link.vcd' in.vcd 2> /dev/null && result=1
+cmp -s 0.vcd in.vcd || result=1
+test -e x.vcd && result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
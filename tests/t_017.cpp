@@ -0,0 +1,37 @@
+//test of the library: windows and modes of mmap_manager
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "mmap_manager.h"
+
+//usage: lib_test FILE WINDOW
+//writes FILE to the standard output through windows of WINDOW bytes at offsets that are not aligned to pages,
+//then writes "cow" to the head through a private mapping, which must not change FILE,
+//and "rw" to the head through a shared mapping with the dirty range marked
+int main(int argc, char *argv[]){
+    if(argc != 3) return 2;
+    const size_t window = std::strtoul(argv[2], NULL, 10);
+    {
+        mmap_manager m(argv[1], mmap_manager::read_only, 0, mmap_manager::sequential | mmap_manager::will_need);
+        if(m.get_error() || m.get_size() != 0) return 1;
+        for(size_t off = 0; off < m.get_file_size(); off += m.get_size()){
+            if(m.slide(off, window) == 0 || m.get_offset() != off) return 1;
+            std::fwrite(m.get_ptr(), 1, m.get_size(), stdout);
+        }
+    }
+    {
+        mmap_manager m(argv[1], mmap_manager::copy_on_write, window, mmap_manager::populate);
+        if(m.get_error() || m.get_size() < 3) return 1;
+        std::memcpy(m.get_ptr(), "cow", 3);
+        //the window grows with the private copy kept
+        if(m.remap(window * 2) < 3 || std::memcmp(m.get_ptr(), "cow", 3) != 0) return 1;
+    }
+    {
+        mmap_manager m(argv[1], mmap_manager::read_write, window);
+        if(m.get_error() || m.get_size() < 2) return 1;
+        std::memcpy(m.get_ptr(), "rw", 2);
+        m.mark_dirty(0, 2);
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#the program is linked with the static library
+${CXX:-g++} -O2 -Wall -I"${root}" -o lib_test "${root}/tests/${test_name}.cpp" "${root}/libvcdhier.a" -lpthread -lz
+
+result=0
+cp "${root}/tests/t_000.vcd" 0.vcd
+#windows of 5000 and 4096 bytes cross the pages at various offsets
+for w in 5000 4096 1000000; do
+    cp 0.vcd 1.vcd
+    ./lib_test 1.vcd ${w} > out.vcd || result=1
+    cmp -s 0.vcd out.vcd || result=1
+    #only the shared mapping changes the file
+    test "$(head -c 2 1.vcd)" = "rw" || result=1
+    cmp -s <(tail -c +3 0.vcd) <(tail -c +3 1.vcd) || result=1
+done
+
+#the header modified in-place is the same as that written to --output
+cp 0.vcd 2.vcd
+${hier_manip} 2.vcd 2> /dev/null
+${hier_manip} 0.vcd --output 3.vcd 2> /dev/null
+${hier_manip} 2.vcd --output 4.vcd 2> /dev/null
+cmp -s 3.vcd 4.vcd || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,39 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#names whose last segment is empty are kept as they are, in a header large enough to be parsed by multiple threads
+awk 'BEGIN{
+    print "$timescale 1 ps $end\n$scope module top $end"
+    print "$var wire 1 ! x. $end\n$var wire 1 \" . $end\n$var wire 1 # a.b. $end"
+    for(i = 0; i < 10000; ++i) printf "$var wire 1 s%d a.u%d.sig_%d $end\n", i, i % 7, i
+    print "$upscope $end\n$enddefinitions $end\n#0\n1!"
+}' > 0.vcd
+
+result=0
+for n in 1 4; do
+    ${hier_manip} --threads ${n} --output ${n}.vcd 0.vcd 2> /dev/null || result=1
+    #every $var has a reference
+    awk '/\$var/ && NF != 6{exit 1}' ${n}.vcd || result=1
+    for ref in 'x\.' '\.' 'a\.b\.'; do
+        grep -q "^	*\$var wire 1 [^ ]* ${ref} \$end" ${n}.vcd || result=1
+    done
+done
+cmp -s 1.vcd 4.vcd || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,49 @@
+#!/bin/bash
+set -e
+
+readonly test_name=$(basename -s .sh $0)
+readonly root=$(realpath $(dirname $0)/..)
+readonly hier_manip=${root}/vcd_hier_manip
+
+rm -rf "${root}/test_run/${test_name}"
+mkdir -p "${root}/test_run/${test_name}"
+
+pushd "${root}/test_run/${test_name}" > /dev/null
+
+#identifier codes longer than 255 Byte and references longer than 64 KB are rejected without modifying the VCD
+make_vcd(){
+    awk -v code_len=$1 -v ref_len=$2 'function rep(c, n,  s){s = ""; while(n-- > 0) s = s c; return s}
+    BEGIN{
+        print "$timescale 1 ps $end\n$scope module top $end"
+        for(i = 0; i < 5000; ++i) printf "$var wire 1 s%d a.u%d.sig_%d $end\n", i, i % 7, i
+        printf "$var wire 1 %s %s $end\n", rep("c", code_len), rep("r", ref_len)
+        print "$upscope $end\n$enddefinitions $end\n#0\n1s0"
+    }'
+}
+make_vcd 255 65535 > ok.vcd
+make_vcd 256 1 > code.vcd
+make_vcd 1 65536 > ref.vcd
+gzip -c code.vcd > code.vcd.gz
+
+result=0
+for n in 1 4; do
+    cp -p ok.vcd ok_${n}.vcd
+    ${hier_manip} --threads ${n} ok_${n}.vcd 2> /dev/null || result=1
+    for f in code ref; do
+        cp -p ${f}.vcd ${f}_${n}.vcd
+        if ${hier_manip} --threads ${n} ${f}_${n}.vcd 2> ${f}_${n}.txt; then result=1; fi
+        cmp -s ${f}.vcd ${f}_${n}.vcd || result=1
+        grep -q "at offset" ${f}_${n}.txt || result=1
+    done
+done
+if ${hier_manip} code.vcd.gz --output out.vcd 2> gz.txt; then result=1; fi
+grep -q "at offset" gz.txt || result=1
+
+if test ${result} -eq 0; then
+    echo "Test ${test_name} Pass"
+else
+    echo "Test ${test_name} Fail"
+    exit 1
+fi
+
+popd > /dev/null
@@ -0,0 +1,259 @@
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h> //SIZE_MAX
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "task_pool.h"
+#include "vcd_activity.h"
+
+namespace{
+
+//! length of the body tokenized at once, which keeps the token boundaries in the cache
+const size_t activity_block_size = 1024 * 1024;
+
+//! part of the body scanned by a thread
+struct activity_chunk{
+    //! head of the part
+    const char *begin;
+    //! end of the part
+    const char *end;
+    //! number of value changes of each code
+    std::vector<uint64_t> counts;
+    //! number of value changes of the codes not in the header
+    uint64_t num_unknown;
+    //! state of the lexer at the head, and at the end after scanning
+    body_lexer lexer;
+    //! true if the head is in a section like $dumpvars, and the same at the end after scanning
+    bool in_dump;
+};
+
+//! chunks scanned concurrently
+struct activity_batch{
+    //! index of identifier codes
+    const code_table *table;
+    //! one chunk for each thread
+    std::vector<activity_chunk> chunks;
+};
+
+//! check if the keyword starts a section of value changes
+bool is_dump_keyword(const string_view &key){
+    return key == "$dumpvars" || key == "$dumpall" || key == "$dumpon" || key == "$dumpoff";
+}
+
+//! count the value changes of a chunk from the state at its head
+//
+//! The chunk is tokenized block by block, each of which ends at a line boundary.
+//! Values in $dumpvars, $dumpall, $dumpon and $dumpoff are not counted because they are not changes.
+//! @param c chunk, whose lexer and in_dump have the state at the head
+//! @param table index of identifier codes
+void count_changes(activity_chunk &c, const code_table &table){
+    c.counts.assign(table.size(), 0);
+    c.num_unknown = 0;
+    body_token tok;
+    for(const char *p = c.begin; p < c.end; ){
+        const char *next = p + std::min<size_t>(activity_block_size, c.end - p);
+        if(next < c.end){
+            const char *nl = static_cast<const char *>(memrchr(p, '\n', next - p));
+            if(!nl) nl = static_cast<const char *>(std::memchr(next, '\n', c.end - next));
+            next = nl ? nl + 1 : c.end;
+        }
+        c.lexer.feed(string_view(p, next - p));
+        while(c.lexer.next(tok)){
+            switch(tok.kind){
+                case body_token::keyword:
+                    if(is_dump_keyword(tok.value)) c.in_dump = true;
+                    else if(tok.value == "$end") c.in_dump = false;
+                    break;
+                case body_token::scalar:
+                case body_token::vector:
+                case body_token::real:
+                case body_token::string:
+                    if(!c.in_dump){
+                        const uint32_t idx = table.find(tok.code);
+                        if(idx != code_table::npos) ++c.counts[idx];
+                        else ++c.num_unknown;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        p = next;
+    }
+    c.lexer.feed(string_view());
+}
+
+//! count the value changes of a chunk assuming that nothing continues from the previous chunk, called by the workers
+//
+//! @param idx index of the chunk
+//! @param arg activity_batch
+void count_task(size_t idx, void *arg){
+    activity_batch &b = *static_cast<activity_batch *>(arg);
+    activity_chunk &c = b.chunks[idx];
+    c.lexer = body_lexer();
+    c.in_dump = false;
+    count_changes(c, *b.table);
+}
+
+//! append the path of a module from the child of the top module, followed by '.'
+void append_path(const vcd_module &mod, std::string &path){
+    if(!mod.get_parent()) return;
+    append_path(*mod.get_parent(), path);
+    const string_view name = mod.get_name();
+    if(name.size()) path.append(&name[0], name.size());
+    path.push_back('.');
+}
+
+//! total value changes of a scope
+struct scope_total{
+    //! path from the child of the top module
+    std::string path;
+    //! value changes of the signals in the scope and its descendants
+    uint64_t changes;
+};
+
+//! value changes of a signal and its order in the header
+typedef std::pair<uint64_t, size_t> signal_rank;
+
+//! functor used to sort signals by the number of value changes in descending order
+struct busier{
+    bool operator () (const signal_rank &a, const signal_rank &b)const{
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    }
+};
+
+//! sum the value changes of a module and its descendants
+//
+//! The total of each module below the top modules is recorded in the depth-first order.
+//! @param mod module
+//! @param table index of identifier codes
+//! @param counts number of value changes of each code
+//! @param path path of mod followed by '.', empty for a top module
+//! @param scopes totals are appended
+//! @return value changes of mod
+uint64_t roll_up(const vcd_module &mod, const code_table &table, const std::vector<uint64_t> &counts, std::string &path, std::vector<scope_total> &scopes){
+    size_t slot = scopes.size();
+    if(mod.get_parent()){
+        scopes.push_back(scope_total());
+        scopes.back().path.assign(path, 0, path.size() - 1);
+    }
+    uint64_t total = 0;
+    for(size_t i = 0; i < mod.get_num_signals(); ++i){
+        const uint32_t idx = table.find(mod.get_signal(i).get_symbol());
+        if(idx != code_table::npos) total += counts[idx];
+    }
+    for(size_t i = 0; i < mod.get_num_sub_modules(); ++i){
+        const vcd_module &sub = mod.get_sub_module(i);
+        const string_view name = sub.get_name();
+        const size_t len = path.size();
+        if(name.size()) path.append(&name[0], name.size());
+        path.push_back('.');
+        total += roll_up(sub, table, counts, path, scopes);
+        path.resize(len);
+    }
+    if(mod.get_parent()) scopes[slot].changes = total;
+    return total;
+}
+
+} //end of unnamed namespace
+
+//! count the value changes of each signal and of each scope
+//
+//! The body is mapped and split at line boundaries into one chunk for each thread,
+//! and each thread counts the value changes into its own array indexed by the identifier codes.
+//! Each chunk is tokenized assuming that no $comment, value or $dumpvars continues from the previous chunk,
+//! and the rare chunk that breaks the assumption is counted again with the state of the previous chunk.
+//! The arrays are summed and rolled up through the hierarchy.
+//! The busiest signals are written as "signal", the value changes, the path and the identifier code separated by tab,
+//! and then every scope below the top modules as "scope", the value changes and the path in the depth-first order.
+//! @param vcd_filename VCD file
+//! @param header header of the VCD
+//! @param header_size size of the header
+//! @param top number of the busiest signals to be written
+//! @param num_threads number of threads, 0 for the number of CPUs
+//! @param os output stream of the result
+//! @param log stream for messages
+//! @return 0 if succeeded
+int report_activity(const char *vcd_filename, const vcd_header &header, size_t header_size, size_t top, unsigned int num_threads, std::ostream &os, std::ostream &log){
+    std::vector<const vcd_signal *> sigs;
+    header.get_signals(sigs);
+    code_table table;
+    if(!table.build(sigs)){
+        log << vcd_filename << ": identifier codes that are not base-94 integers cannot be counted" << std::endl;
+        return -1;
+    }
+    const mmap_manager body(vcd_filename, mmap_manager::read_only, SIZE_MAX, mmap_manager::sequential);
+    if(body.get_error()){
+        log << vcd_filename << ": " << std::strerror(body.get_error()) << std::endl;
+        return -1;
+    }
+    const char *const head = static_cast<const char *>(body.get_ptr()) + header_size;
+    const size_t body_size = body.get_size() - header_size;
+
+    const unsigned int num_workers = num_threads ? num_threads : get_num_cpus();
+    const size_t n = std::min<size_t>(num_workers, (body_size + activity_block_size - 1) / activity_block_size);
+    activity_batch b;
+    b.table = &table;
+    b.chunks.resize(n);
+    const char *const end = head + body_size;
+    for(size_t i = 0; i < n; ++i){
+        b.chunks[i].begin = i ? b.chunks[i - 1].end : head;
+        const char *e = head + body_size / n * (i + 1);
+        if(i + 1 == n || e <= b.chunks[i].begin){
+            e = (i + 1 == n) ? end : b.chunks[i].begin;
+        }
+        else{
+            const char *const nl = static_cast<const char *>(std::memchr(e - 1, '\n', end - (e - 1)));
+            e = nl ? nl + 1 : end;
+        }
+        b.chunks[i].end = e;
+    }
+    run_tasks(num_workers, n, count_task, &b);
+    std::vector<uint64_t> counts(table.size());
+    uint64_t num_changes = 0, num_unknown = 0;
+    for(size_t i = 0; i < n; ++i){
+        activity_chunk &c = b.chunks[i];
+        if(i > 0 && (!b.chunks[i - 1].lexer.is_initial() || b.chunks[i - 1].in_dump)){
+            c.lexer = b.chunks[i - 1].lexer;
+            c.in_dump = b.chunks[i - 1].in_dump;
+            count_changes(c, table);
+        }
+        for(size_t j = 0; j < counts.size(); ++j){
+            counts[j] += c.counts[j];
+        }
+        num_unknown += c.num_unknown;
+    }
+    for(size_t j = 0; j < counts.size(); ++j){
+        num_changes += counts[j];
+    }
+
+    std::vector<signal_rank> ranks(sigs.size());
+    for(size_t i = 0; i < sigs.size(); ++i){
+        ranks[i] = signal_rank(counts[table.find(sigs[i]->get_symbol())], i);
+    }
+    top = std::min(top, ranks.size());
+    std::partial_sort(ranks.begin(), ranks.begin() + top, ranks.end(), busier());
+    std::string path;
+    for(size_t i = 0; i < top; ++i){
+        const vcd_signal &sig = *sigs[ranks[i].second];
+        path.clear();
+        append_path(*sig.get_parent(), path);
+        os << "signal\t" << ranks[i].first << '\t' << path << sig.get_name() << '\t' << sig.get_symbol() << '\n';
+    }
+    std::vector<scope_total> scopes;
+    for(size_t i = 0; i < header.get_num_top_modules(); ++i){
+        path.clear();
+        roll_up(header.get_top_module(i), table, counts, path, scopes);
+    }
+    for(size_t i = 0; i < scopes.size(); ++i){
+        os << "scope\t" << scopes[i].changes << '\t' << scopes[i].path << '\n';
+    }
+    os.flush();
+    log << num_changes << " value changes of " << table.size() << " identifier codes in " << body_size << " bytes of body on " << n << " threads" << std::endl;
+    if(num_unknown) log << num_unknown << " value changes of signals not in the header are ignored" << std::endl;
+    return 0;
+}
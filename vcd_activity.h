@@ -0,0 +1,10 @@
+#ifndef VCD_ACTIVITY_H
+#define VCD_ACTIVITY_H
+#include <iosfwd>
+#include <cstddef>
+
+class vcd_header;
+
+int report_activity(const char *, const vcd_header &, size_t, size_t, unsigned int, std::ostream &, std::ostream &);
+
+#endif
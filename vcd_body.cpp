@@ -0,0 +1,552 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <zlib.h>
+#include "vcd_body.h"
+#include "vcd_tokenizer.h"
+#include "vcd_stats.h"
+#include "task_pool.h"
+
+namespace{
+
+//! initial size of the buffer of body_reader
+const size_t reader_buffer_size = 4 * 1024 * 1024;
+//! size of the buffer of body_writer, which is also the size of a gzip member
+const size_t writer_buffer_size = 1024 * 1024;
+//! size of the compressed input buffer of gz_reader
+const size_t gz_input_size = 256 * 1024;
+
+//! check if c is one of ' ', '\t' and '\n'
+inline bool is_separator(char c){
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+//! buffers compressed by compress_task()
+struct compress_batch{
+    //! data to be compressed, which is replaced with the compressed data
+    std::vector<std::vector<char> > *blocks;
+    //! errno of the failure, 0 if not failed
+    int error;
+};
+
+//! compress a buffer to a gzip member, called by the workers
+//
+//! @param idx index of the buffer
+//! @param arg compress_batch
+void compress_task(size_t idx, void *arg){
+    compress_batch &b = *static_cast<compress_batch *>(arg);
+    std::vector<char> &block = (*b.blocks)[idx];
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    //16 is added to the window bits to write the gzip header and trailer
+    if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+        b.error = ENOMEM;
+        return;
+    }
+    std::vector<char> out(deflateBound(&zs, block.size()));
+    zs.next_in = reinterpret_cast<Bytef *>(block.empty() ? NULL : &block.front());
+    zs.avail_in = block.size();
+    zs.next_out = reinterpret_cast<Bytef *>(&out.front());
+    zs.avail_out = out.size();
+    const int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    if(ret != Z_STREAM_END){
+        b.error = EIO;
+        return;
+    }
+    block.swap(out);
+}
+
+} //end of unnamed namespace
+
+// ********** body_reader **********
+
+//! constructor
+//
+//! @param f file to be read
+//! @param begin offset of the range
+//! @param e end of the range
+body_reader::body_reader(int f, off_t begin, off_t e) : fd(f), pos(begin), end(e), buf(reader_buffer_size), filled(0), consumed(0), error(0){
+    posix_fadvise(fd, begin, end - begin, POSIX_FADV_SEQUENTIAL);
+}
+
+//! read the next chunk
+//
+//! @param chunk the chunk is stored, which is valid until the next call
+//! @return false at the end of the range or on failure, see get_error()
+bool body_reader::next(string_view &chunk){
+    //the incomplete token at the tail of the last chunk is moved to the head
+    std::memmove(&buf.front(), &buf.front() + consumed, filled - consumed);
+    filled -= consumed;
+    consumed = 0;
+    for(;;){
+        if(pos >= end){
+            if(filled == 0) return false;
+            chunk = string_view(&buf.front(), filled);
+            consumed = filled;
+            return true;
+        }
+        if(filled == buf.size()) buf.resize(buf.size() * 2);
+        const size_t len = std::min<off_t>(buf.size() - filled, end - pos);
+        const ssize_t r = pread(fd, &buf.front() + filled, len, pos);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0){
+            error = r < 0 ? errno : EIO;
+            return false;
+        }
+        count_read(r);
+        pos += r;
+        filled += r;
+        size_t cut = filled;
+        if(pos < end){
+            while(cut > 0 && !is_separator(buf[cut - 1])) --cut;
+        }
+        if(cut > 0){
+            chunk = string_view(&buf.front(), cut);
+            consumed = cut;
+            return true;
+        }
+    }
+}
+
+//! get errno of the failure, 0 if not failed
+int body_reader::get_error()const{
+    return error;
+}
+
+// ********** body_writer **********
+
+//! constructor
+//
+//! @param f file to be written
+//! @param c true to compress the data to gzip members
+//! @param n number of threads to compress, 0 for the number of CPUs
+body_writer::body_writer(int f, bool c, unsigned int n) : fd(f), compress(c), num_threads(n), buf(writer_buffer_size), used(0), written(0), error(0), num_blocks(0){
+    if(compress) blocks.resize(2 * (num_threads ? num_threads : get_num_cpus()));
+}
+
+//! write data to the file
+void body_writer::write_out(const char *p, size_t left){
+    while(left > 0 && !error){
+        const ssize_t w = ::write(fd, p, left);
+        if(w < 0){
+            if(errno != EINTR) error = errno;
+            continue;
+        }
+        count_written(w);
+        p += w;
+        left -= w;
+    }
+}
+
+//! compress the waiting buffers concurrently and write them in order
+void body_writer::compress_blocks(){
+    if(num_blocks == 0) return;
+    std::vector<std::vector<char> > batch(num_blocks);
+    for(size_t i = 0; i < num_blocks; ++i){
+        batch[i].swap(blocks[i]);
+    }
+    compress_batch b = {&batch, 0};
+    run_tasks(num_threads, num_blocks, compress_task, &b);
+    if(b.error && !error) error = b.error;
+    for(size_t i = 0; i < num_blocks; ++i){
+        if(!batch[i].empty()) write_out(&batch[i].front(), batch[i].size());
+        //the memory is reused by the next batch
+        batch[i].clear();
+        blocks[i].swap(batch[i]);
+    }
+    num_blocks = 0;
+}
+
+//! write the buffer to the file, or queue it for compression
+void body_writer::drain(){
+    if(used == 0) return;
+    if(!compress){
+        write_out(&buf.front(), used);
+        used = 0;
+        return;
+    }
+    std::vector<char> &block = blocks[num_blocks++];
+    block.swap(buf);
+    block.resize(used);
+    buf.resize(writer_buffer_size);
+    used = 0;
+    if(num_blocks == blocks.size()) compress_blocks();
+}
+
+//! append data
+//
+//! @param p data
+//! @param len length of data
+void body_writer::write(const char *p, size_t len){
+    written += len;
+    while(len > 0){
+        if(used == buf.size()) drain();
+        const size_t n = std::min(len, buf.size() - used);
+        std::memcpy(&buf.front() + used, p, n);
+        used += n;
+        p += n;
+        len -= n;
+    }
+}
+
+//! append a string
+void body_writer::write(const string_view &s){
+    if(s.size()) write(&s[0], s.size());
+}
+
+//! append a character
+void body_writer::put(char c){
+    if(used == buf.size()) drain();
+    buf[used++] = c;
+    ++written;
+}
+
+//! write the buffered data to the file
+//
+//! @return false if any write failed, see get_error()
+bool body_writer::flush(){
+    drain();
+    compress_blocks();
+    return !error;
+}
+
+//! get the number of characters written so far
+uint64_t body_writer::get_written()const{
+    return written;
+}
+
+//! get errno of the failure, 0 if not failed
+int body_writer::get_error()const{
+    return error;
+}
+
+// ********** gz_reader **********
+
+struct gz_reader::impl{
+    //! file to be read
+    int fd;
+    //! state of zlib
+    z_stream zs;
+    //! compressed data read from the file
+    std::vector<unsigned char> in;
+    //! true if the end of the file is reached
+    bool eof;
+    //! true if the last member is complete
+    bool member_end;
+    //! errno of the failure, 0 if not failed
+    int error;
+};
+
+//! constructor
+//
+//! @param fd gzip file to be read from the current position
+gz_reader::gz_reader(int fd) : pimpl(new impl){
+    pimpl->fd = fd;
+    std::memset(&pimpl->zs, 0, sizeof(pimpl->zs));
+    pimpl->in.resize(gz_input_size);
+    pimpl->eof = false;
+    pimpl->member_end = false;
+    pimpl->error = 0;
+    //16 is added to the window bits to accept only gzip
+    if(inflateInit2(&pimpl->zs, 16 + MAX_WBITS) != Z_OK) pimpl->error = ENOMEM;
+}
+
+//! destructor
+gz_reader::~gz_reader(){
+    inflateEnd(&pimpl->zs);
+    delete pimpl;
+}
+
+//! read decompressed data
+//
+//! @param p buffer to store the data
+//! @param len size of the buffer
+//! @return length of the data, 0 at the end of the file, -1 on failure, see get_error()
+ssize_t gz_reader::read(char *p, size_t len){
+    impl &g = *pimpl;
+    z_stream &zs = g.zs;
+    if(g.error) return -1;
+    for(;;){
+        if(zs.avail_in == 0 && !g.eof){
+            const ssize_t r = ::read(g.fd, &g.in.front(), g.in.size());
+            if(r < 0){
+                if(errno == EINTR) continue;
+                g.error = errno;
+                return -1;
+            }
+            count_read(r);
+            g.eof = (r == 0);
+            zs.next_in = &g.in.front();
+            zs.avail_in = r;
+        }
+        if(g.member_end){
+            if(zs.avail_in == 0) return 0;
+            //another member follows
+            inflateReset(&zs);
+            g.member_end = false;
+        }
+        zs.next_out = reinterpret_cast<Bytef *>(p);
+        zs.avail_out = len;
+        const int ret = inflate(&zs, Z_NO_FLUSH);
+        const size_t produced = len - zs.avail_out;
+        if(ret == Z_STREAM_END){
+            g.member_end = true;
+        }
+        else if(ret == Z_BUF_ERROR && zs.avail_in == 0 && g.eof){
+            g.error = EIO; //truncated
+            return -1;
+        }
+        else if(ret != Z_OK && ret != Z_BUF_ERROR){
+            g.error = (ret == Z_MEM_ERROR) ? ENOMEM : EINVAL;
+            return -1;
+        }
+        if(produced > 0) return produced;
+    }
+}
+
+//! get errno of the failure, 0 if not failed
+int gz_reader::get_error()const{
+    return pimpl->error;
+}
+
+//! check the magic number of gzip
+//
+//! @param p head of the file
+//! @param len length of the data at p
+bool is_gzip_data(const char *p, size_t len){
+    return len >= 2 && static_cast<unsigned char>(p[0]) == 0x1f && static_cast<unsigned char>(p[1]) == 0x8b;
+}
+
+// ********** body_lexer **********
+
+//! constructor
+body_lexer::body_lexer() : base(NULL), cur(0), pending_kind(body_token::text), has_pending(false), in_text(false){}
+
+//! give the next chunk
+//
+//! @param chunk chunk that ends at a separator except the last one, which must be kept until next() returns false
+void body_lexer::feed(const string_view &chunk){
+    base = chunk.size() ? &chunk[0] : NULL;
+    bounds.clear();
+    cur = 0;
+    if(chunk.size()) find_token_boundaries(base, 0, chunk.size(), bounds);
+}
+
+//! get the next token
+//
+//! @param tok the token is stored, which is valid until the next call
+//! @return false if the chunk is exhausted
+bool body_lexer::next(body_token &tok){
+    if(cur == bounds.size()) return false;
+    const char *const head = base + bounds[cur];
+    const string_view t(head, bounds[cur + 1] - bounds[cur]);
+    cur += 2;
+    if(has_pending){
+        has_pending = false;
+        tok.kind = pending_kind;
+        tok.value = string_view(pending.data(), pending.size());
+        tok.code = t;
+        return true;
+    }
+    tok.value = t;
+    tok.code = string_view();
+    if(in_text){
+        in_text = (t != "$end");
+        tok.kind = in_text ? body_token::text : body_token::keyword;
+        return true;
+    }
+    switch(*head){
+        case '#':
+            tok.kind = body_token::timestamp;
+            return true;
+        case '0': case '1': case 'x': case 'X': case 'z': case 'Z':
+            if(t.size() < 2) break;
+            tok.kind = body_token::scalar;
+            tok.value = string_view(head, 1);
+            tok.code = string_view(head + 1, t.size() - 1);
+            return true;
+        case 'b': case 'B': case 'r': case 'R': case 's': case 'S':{
+            const char c = *head | 0x20;
+            tok.kind = c == 'b' ? body_token::vector : c == 'r' ? body_token::real : body_token::string;
+            if(cur == bounds.size()){
+                //the code is in the next chunk
+                pending.assign(head, t.size());
+                pending_kind = tok.kind;
+                has_pending = true;
+                return false;
+            }
+            tok.code = string_view(base + bounds[cur], bounds[cur + 1] - bounds[cur]);
+            cur += 2;
+            return true;
+        }
+        case '$':
+            tok.kind = body_token::keyword;
+            in_text = t != "$end" && t != "$dumpvars" && t != "$dumpall" && t != "$dumpon" && t != "$dumpoff";
+            return true;
+        default:
+            break;
+    }
+    tok.kind = body_token::text;
+    return true;
+}
+
+//! get the value left without its code at the end of the body
+//
+//! @param tok the value is stored as text
+//! @return false if there is no such value
+bool body_lexer::finish(body_token &tok){
+    if(!has_pending) return false;
+    has_pending = false;
+    tok.kind = body_token::text;
+    tok.value = string_view(pending.data(), pending.size());
+    tok.code = string_view();
+    return true;
+}
+
+//! check if a value is waiting for its identifier code in the next chunk
+bool body_lexer::has_pending_value()const{
+    return has_pending;
+}
+
+//! check if the lexer is in the state at the head of the body
+//
+//! A chunk can be tokenized independently of the previous chunks if the state at its head is initial.
+bool body_lexer::is_initial()const{
+    return !has_pending && !in_text;
+}
+
+//! parse the time of a timestamp like "#100"
+//
+//! @param tok timestamp token including '#'
+//! @param t the time is stored
+//! @return false if the time is not a decimal number or overflows
+bool parse_timestamp(const string_view &tok, uint64_t &t){
+    if(tok.size() < 2) return false;
+    uint64_t v = 0;
+    for(size_t i = 1; i < tok.size(); ++i){
+        if(tok[i] < '0' || '9' < tok[i]) return false;
+        const uint64_t d = tok[i] - '0';
+        if(v > (UINT64_MAX - d) / 10) return false;
+        v = v * 10 + d;
+    }
+    t = v;
+    return true;
+}
+
+// ********** code_table **********
+
+const uint32_t code_table::npos;
+
+//! constructor
+code_table::code_table() : num_codes(0){}
+
+//! index the symbols of signals
+//
+//! Signals that share a symbol get the same index.
+//! @param sigs signals
+//! @return false if a symbol cannot be decoded by decode_id_code()
+bool code_table::build(const std::vector<const vcd_signal *> &sigs){
+    std::vector<uint64_t> codes(sigs.size());
+    for(size_t i = 0; i < sigs.size(); ++i){
+        if(!decode_id_code(sigs[i]->get_symbol(), codes[i])) return false;
+    }
+    std::sort(codes.begin(), codes.end());
+    codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+    assert(codes.size() < npos);
+    num_codes = codes.size();
+    dense.clear();
+    sparse.clear();
+    if(codes.empty()) return true;
+    if(codes.back() < 4 * static_cast<uint64_t>(codes.size()) + 1024){
+        dense.assign(codes.back() + 1, npos);
+        for(size_t i = 0; i < codes.size(); ++i){
+            dense[codes[i]] = i;
+        }
+    }
+    else{
+        sparse.resize(codes.size());
+        for(size_t i = 0; i < codes.size(); ++i){
+            sparse[i] = std::make_pair(codes[i], static_cast<uint32_t>(i));
+        }
+    }
+    return true;
+}
+
+//! get the index of an identifier code
+//
+//! @param code identifier code
+//! @return index, or npos if the code is not in the table
+uint32_t code_table::find(const string_view &code)const{
+    uint64_t v;
+    if(!decode_id_code(code, v)) return npos;
+    if(!dense.empty()) return v < dense.size() ? dense[v] : npos;
+    const std::vector<std::pair<uint64_t, uint32_t> >::const_iterator i =
+        std::lower_bound(sparse.begin(), sparse.end(), std::make_pair(v, static_cast<uint32_t>(0)));
+    return i != sparse.end() && i->first == v ? i->second : npos;
+}
+
+//! get the number of distinct codes
+uint32_t code_table::size()const{
+    return num_codes;
+}
+
+// ********** code_set **********
+
+//! make the set of the symbols of signals
+//
+//! @param sigs signals
+//! @return false if a symbol cannot be decoded by decode_id_code()
+bool code_set::build(const std::vector<const vcd_signal *> &sigs){
+    std::vector<uint64_t> codes(sigs.size());
+    for(size_t i = 0; i < sigs.size(); ++i){
+        if(!decode_id_code(sigs[i]->get_symbol(), codes[i])) return false;
+    }
+    std::sort(codes.begin(), codes.end());
+    codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+    bits.clear();
+    sparse.clear();
+    if(codes.empty()) return true;
+    //a bitmap is used unless it is much larger than the array
+    if(codes.back() < std::max<uint64_t>(64 * 64 * codes.size(), 1 << 24)){
+        bits.assign(codes.back() / 64 + 1, 0);
+        for(size_t i = 0; i < codes.size(); ++i){
+            bits[codes[i] / 64] |= static_cast<uint64_t>(1) << (codes[i] % 64);
+        }
+    }
+    else{
+        sparse.swap(codes);
+    }
+    return true;
+}
+
+//! check if the set contains an identifier code
+bool code_set::contains(const string_view &code)const{
+    uint64_t v;
+    if(!decode_id_code(code, v)) return false;
+    if(sparse.empty()) return v / 64 < bits.size() && (bits[v / 64] >> (v % 64) & 1);
+    return std::binary_search(sparse.begin(), sparse.end(), v);
+}
+
+// ********** code_generator **********
+
+//! generate the next code
+//
+//! Codes are generated in the order of decode_id_code() skipping those that contain '$'.
+//! @return the code, which is valid until the next call
+const std::string &code_generator::next(){
+    for(size_t i = code.size(); i-- > 0; ){
+        char &c = code[i];
+        if(c != '~'){
+            c = (c == '#') ? '%' : c + 1;
+            return code;
+        }
+        c = '!';
+    }
+    code.insert(code.begin(), '!');
+    return code;
+}
@@ -0,0 +1,194 @@
+#ifndef VCD_BODY_H
+#define VCD_BODY_H
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "vcd_header.h"
+
+//! reads a range of file chunk by chunk
+//
+//! Each chunk ends at a separator, so no token straddles two chunks.
+//! Only one buffer is used to bound the memory regardless of the file size.
+class body_reader{
+    //! file to be read
+    const int fd;
+    //! offset of the next read
+    off_t pos;
+    //! end of the range
+    const off_t end;
+    //! buffer, which grows only if a token is longer than the buffer
+    std::vector<char> buf;
+    //! number of valid characters in buf
+    size_t filled;
+    //! number of characters in buf returned by the last next()
+    size_t consumed;
+    //! errno of the failure, 0 if not failed
+    int error;
+    body_reader(const body_reader &);
+    body_reader & operator = (const body_reader &);
+    public:
+    body_reader(int, off_t, off_t);
+    bool next(string_view &);
+    int get_error()const;
+};
+
+//! writes a file sequentially through a buffer
+//
+//! If compression is enabled, each buffer is compressed as an independent gzip member,
+//! so the buffers of a batch are compressed on multiple threads.
+//! Concatenated members are a valid gzip file.
+class body_writer{
+    //! file to be written
+    const int fd;
+    //! true to write gzip members instead of the data
+    const bool compress;
+    //! number of threads to compress, 0 for the number of CPUs
+    const unsigned int num_threads;
+    //! buffer
+    std::vector<char> buf;
+    //! number of characters in buf
+    size_t used;
+    //! number of characters written including buf
+    uint64_t written;
+    //! errno of the failure, 0 if not failed
+    int error;
+    //! buffers waiting for compression
+    std::vector<std::vector<char> > blocks;
+    //! number of buffers in blocks
+    size_t num_blocks;
+    void drain();
+    void write_out(const char *, size_t);
+    void compress_blocks();
+    body_writer(const body_writer &);
+    body_writer & operator = (const body_writer &);
+    public:
+    explicit body_writer(int, bool = false, unsigned int = 1);
+    void write(const char *, size_t);
+    void write(const string_view &);
+    void put(char);
+    bool flush();
+    uint64_t get_written()const;
+    int get_error()const;
+};
+
+//! reads a gzip file as one stream
+//
+//! Concatenated gzip members, such as those written by body_writer, are read in sequence.
+class gz_reader{
+    struct impl;
+    impl *pimpl;
+    gz_reader(const gz_reader &);
+    gz_reader & operator = (const gz_reader &);
+    public:
+    explicit gz_reader(int);
+    ~gz_reader();
+    ssize_t read(char *, size_t);
+    int get_error()const;
+};
+
+bool is_gzip_data(const char *, size_t);
+
+//! token in VCD body
+struct body_token{
+    //! kind of token
+    enum kind_type{
+        //! "#" followed by the time
+        timestamp,
+        //! value change of a scalar like "1!"
+        scalar,
+        //! value change of a vector like "b101 !"
+        vector,
+        //! value change of a real like "r1.5 !"
+        real,
+        //! value change of a string like "sabc !"
+        string,
+        //! keyword like "$dumpvars" or "$end"
+        keyword,
+        //! other tokens such as the contents of $comment
+        text
+    };
+    //! kind of this token
+    kind_type kind;
+    //! the token, or the value including the prefix for value changes
+    string_view value;
+    //! identifier code of value changes
+    string_view code;
+};
+
+//! splits VCD body into tokens
+//
+//! The body is given chunk by chunk, and a value change whose code is in the next chunk
+//! is completed when the next chunk is fed.
+//! The boundaries of tokens in a chunk are found at once by find_token_boundaries().
+class body_lexer{
+    //! head of the chunk
+    const char *base;
+    //! offsets of tokens from base. Even entries are the heads and odd entries are the ends.
+    std::vector<uint32_t> bounds;
+    //! index in bounds of the next token
+    size_t cur;
+    //! value waiting for its identifier code in the next chunk
+    std::string pending;
+    //! kind of pending
+    body_token::kind_type pending_kind;
+    //! true if pending is valid
+    bool has_pending;
+    //! true inside a keyword section whose contents are plain text such as $comment
+    bool in_text;
+    public:
+    body_lexer();
+    void feed(const string_view &);
+    bool next(body_token &);
+    bool finish(body_token &);
+    bool has_pending_value()const;
+    bool is_initial()const;
+};
+
+bool parse_timestamp(const string_view &, uint64_t &);
+
+//! maps identifier codes to dense indices
+//
+//! Codes are decoded by decode_id_code() and indexed in the order of the decoded integers.
+//! A flat table is used when the codes are dense, which is the usual case.
+class code_table{
+    //! index of each decoded code
+    std::vector<uint32_t> dense;
+    //! pairs of decoded code and index sorted by code, used if codes are sparse
+    std::vector<std::pair<uint64_t, uint32_t> > sparse;
+    //! number of distinct codes
+    uint32_t num_codes;
+    public:
+    //! index of unknown codes
+    static const uint32_t npos = UINT32_MAX;
+    code_table();
+    bool build(const std::vector<const vcd_signal *> &);
+    uint32_t find(const string_view &)const;
+    uint32_t size()const;
+};
+
+//! set of identifier codes
+//
+//! Codes are decoded by decode_id_code() and tested against a bitmap indexed by the decoded integers,
+//! so no string is compared. A sorted array is used instead if the codes are too sparse for a bitmap.
+class code_set{
+    //! bit n is set if the code decoded as n is in the set
+    std::vector<uint64_t> bits;
+    //! decoded codes sorted, used if codes are sparse
+    std::vector<uint64_t> sparse;
+    public:
+    bool build(const std::vector<const vcd_signal *> &);
+    bool contains(const string_view &)const;
+};
+
+//! generates identifier codes from the shortest one
+//
+//! '$' is not used so that no code looks like a keyword.
+class code_generator{
+    //! the last generated code
+    std::string code;
+    public:
+    const std::string &next();
+};
+
+#endif
@@ -0,0 +1,619 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_index.h"
+#include "vcd_columnar.h"
+
+//! column of an identifier code in a columnar store
+struct columnar_column{
+    //! index of the first block in the block index
+    uint64_t first_block;
+    //! number of blocks
+    uint64_t num_blocks;
+    //! number of value changes
+    uint64_t num_changes;
+};
+
+//! block of value changes of a column
+//
+//! A change is the time from the previous change as a varint, followed by a varint of the kind in the lower 2 bits
+//! and the value or the length in the others, and the packed value if any.
+//! Kind 0 is a scalar whose value is 0, 1, 2 (x) or 3 (z), kind 1 is a vector of the length
+//! followed by 2 bits for each bit from the left, and kind 2 is the text of the length such as "r1.5".
+struct columnar_block{
+    //! offset in the store
+    uint64_t offset;
+    //! time of the first change, whose delta is 0
+    uint64_t first_time;
+    //! length of the block
+    uint32_t size;
+    //! number of value changes
+    uint32_t num_changes;
+};
+
+namespace{
+
+//! magic number at the head of a columnar store
+const char columnar_magic[8] = {'V', 'C', 'D', 'C', 'O', 'L', '\n', '\0'};
+//! written as is to detect a store of another byte order
+const uint32_t columnar_byte_order = 0x01020304;
+//! format version of the columnar store
+const uint32_t columnar_version = 1;
+//! length of a block at which it is written
+const size_t columnar_block_size = 64 * 1024;
+//! total length of the blocks kept in memory, all blocks are written when exceeded
+const size_t columnar_pending_limit = 64 * 1024 * 1024;
+//! kind of a change of a scalar
+const unsigned int scalar_kind = 0;
+//! kind of a change of a vector of 0, 1, x and z
+const unsigned int vector_kind = 1;
+//! kind of a change stored as text
+const unsigned int text_kind = 2;
+//! characters of the 2-bit values
+const char bit_chars[] = "01xz";
+
+//! head of a columnar store, followed by the blocks, the columns, the block index and the header
+struct columnar_file_header{
+    //! columnar_magic
+    char magic[8];
+    //! columnar_byte_order
+    uint32_t byte_order;
+    //! columnar_version
+    uint32_t version;
+    //! size of the store to detect a truncated store
+    uint64_t file_size;
+    //! offset of the columns
+    uint64_t columns_off;
+    //! number of columns, which is the number of distinct identifier codes
+    uint64_t num_columns;
+    //! offset of the block index
+    uint64_t blocks_off;
+    //! number of blocks
+    uint64_t num_blocks;
+    //! offset of the modules of the header
+    uint64_t modules_off;
+    //! number of modules
+    uint64_t num_modules;
+    //! number of top modules
+    uint64_t num_tops;
+    //! offset of the signals of the header
+    uint64_t signals_off;
+    //! number of signals
+    uint64_t num_signals;
+    //! offset of the strings of the header
+    uint64_t strings_off;
+    //! length of the strings
+    uint64_t strings_size;
+    //! offsets and lengths of $date, $version, $timescale and $comment in the strings
+    uint32_t sections[8];
+    //! 1 if the hierarchy was established from the signal names
+    uint32_t hierarchy;
+    //! always 0
+    uint32_t reserved;
+};
+
+//! append an unsigned integer in LEB128
+void put_varint(std::vector<unsigned char> &out, uint64_t v){
+    for(; v >= 0x80; v >>= 7){
+        out.push_back(static_cast<unsigned char>(v | 0x80));
+    }
+    out.push_back(static_cast<unsigned char>(v));
+}
+
+//! read an unsigned integer in LEB128
+//
+//! @return false if the integer is broken
+bool get_varint(const unsigned char *&p, const unsigned char *end, uint64_t &v){
+    v = 0;
+    for(unsigned int shift = 0; p < end && shift < 64; shift += 7){
+        const unsigned char c = *p++;
+        v |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if(!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+//! get the 2-bit value of a bit, 4 if it is not one of 0, 1, x and z
+inline unsigned int bit_value(char c){
+    switch(c){
+        case '0': return 0;
+        case '1': return 1;
+        case 'x': case 'X': return 2;
+        case 'z': case 'Z': return 3;
+        default: return 4;
+    }
+}
+
+//! value changes of a column waiting to be written as a block
+struct pending_block{
+    //! encoded changes
+    std::vector<unsigned char> data;
+    //! time of the first change
+    uint64_t first_time;
+    //! time of the last change
+    uint64_t last_time;
+    //! number of changes
+    uint32_t num_changes;
+};
+
+//! encodes value changes into the blocks of columns and writes the blocks when they are filled
+//
+//! Blocks of different columns are interleaved in the store and the block index is sorted by column at the end.
+//! All blocks are written when the blocks in memory exceed the limit, so the memory does not depend on the number of signals.
+class column_builder{
+    //! output
+    body_writer &out;
+    //! block being filled of each column
+    std::vector<pending_block> pending;
+    //! number of value changes of each column
+    std::vector<uint64_t> num_changes;
+    //! blocks written in the order of writing
+    std::vector<columnar_block> blocks;
+    //! column of each block in blocks
+    std::vector<uint32_t> block_columns;
+    //! total length of the blocks being filled
+    size_t pending_size;
+    //! encoded change being appended
+    std::vector<unsigned char> change;
+    void flush(uint32_t);
+    public:
+    column_builder(body_writer &, size_t);
+    void append(uint32_t, uint64_t, const body_token &);
+    void flush_all();
+    void get_index(std::vector<columnar_column> &, std::vector<columnar_block> &)const;
+};
+
+//! constructor
+//
+//! @param o output, whose position is the offset of the next block
+//! @param n number of columns
+column_builder::column_builder(body_writer &o, size_t n) : out(o), pending(n), num_changes(n), pending_size(0){
+}
+
+//! write the block of a column
+void column_builder::flush(uint32_t col){
+    pending_block &p = pending[col];
+    const columnar_block b = {out.get_written(), p.first_time, static_cast<uint32_t>(p.data.size()), p.num_changes};
+    out.write(reinterpret_cast<const char *>(&p.data.front()), p.data.size());
+    blocks.push_back(b);
+    block_columns.push_back(col);
+    pending_size -= p.data.size();
+    std::vector<unsigned char>().swap(p.data);
+}
+
+//! add a value change
+//
+//! @param col column of the identifier code
+//! @param time time of the change, which must not be earlier than the previous change
+//! @param tok value change
+void column_builder::append(uint32_t col, uint64_t time, const body_token &tok){
+    pending_block &p = pending[col];
+    if(p.data.empty()){
+        p.first_time = p.last_time = time;
+        p.num_changes = 0;
+    }
+    //the change is encoded apart not to grow the block a byte at a time
+    change.clear();
+    put_varint(change, time - p.last_time);
+    p.last_time = time;
+    const string_view &v = tok.value;
+    bool packed = tok.kind == body_token::scalar || tok.kind == body_token::vector;
+    for(size_t i = (tok.kind == body_token::vector) ? 1 : 0; packed && i < v.size(); ++i){
+        packed = bit_value(v[i]) < 4;
+    }
+    if(packed && tok.kind == body_token::scalar){
+        put_varint(change, bit_value(v[0]) << 2 | scalar_kind);
+    }
+    else if(packed && v.size() > 1){
+        const size_t n = v.size() - 1;
+        put_varint(change, static_cast<uint64_t>(n) << 2 | vector_kind);
+        const size_t head = change.size();
+        change.resize(head + (n + 3) / 4, 0);
+        for(size_t i = 0; i < n; ++i){
+            change[head + i / 4] |= bit_value(v[i + 1]) << (i % 4 * 2);
+        }
+    }
+    else{
+        put_varint(change, static_cast<uint64_t>(v.size()) << 2 | text_kind);
+        change.insert(change.end(), &v[0], &v[0] + v.size());
+    }
+    p.data.insert(p.data.end(), change.begin(), change.end());
+    ++p.num_changes;
+    ++num_changes[col];
+    pending_size += change.size();
+    if(p.data.size() >= columnar_block_size || p.num_changes == UINT32_MAX) flush(col);
+    if(pending_size >= columnar_pending_limit) flush_all();
+}
+
+//! write the blocks of all columns
+void column_builder::flush_all(){
+    for(size_t i = 0; i < pending.size(); ++i){
+        if(!pending[i].data.empty()) flush(i);
+    }
+}
+
+//! get the columns and the block index sorted by column
+//
+//! @param columns columns are stored
+//! @param index blocks are stored, which keep the order of time in each column
+void column_builder::get_index(std::vector<columnar_column> &columns, std::vector<columnar_block> &index)const{
+    columns.assign(pending.size(), columnar_column());
+    for(size_t i = 0; i < block_columns.size(); ++i){
+        ++columns[block_columns[i]].num_blocks;
+    }
+    uint64_t first = 0;
+    for(size_t i = 0; i < columns.size(); ++i){
+        columns[i].first_block = first;
+        columns[i].num_changes = num_changes[i];
+        first += columns[i].num_blocks;
+    }
+    std::vector<uint64_t> next(columns.size());
+    for(size_t i = 0; i < columns.size(); ++i){
+        next[i] = columns[i].first_block;
+    }
+    index.resize(blocks.size());
+    for(size_t i = 0; i < blocks.size(); ++i){
+        index[next[block_columns[i]]++] = blocks[i];
+    }
+}
+
+//! write an array aligned to 8 Byte
+//
+//! @return offset of the array
+template<typename T>
+uint64_t write_aligned(body_writer &out, const T *p, size_t n){
+    static const char zeros[8] = {0};
+    out.write(zeros, (8 - out.get_written() % 8) % 8);
+    const uint64_t off = out.get_written();
+    if(n) out.write(reinterpret_cast<const char *>(p), n * sizeof(T));
+    return off;
+}
+
+//! check if a range is in the store
+inline bool in_store(uint64_t off, uint64_t num, uint64_t size, uint64_t file_size){
+    return off <= file_size && num <= file_size && num * size <= file_size - off;
+}
+
+} //end of unnamed namespace
+
+//! write the value changes of a VCD as a columnar store
+//
+//! The body is read once with a fixed size buffer. The changes of each identifier code are appended to its column,
+//! whose times are delta-encoded and whose values are packed in 2 bits for each bit,
+//! and each column is written block by block with an index of the blocks.
+//! The header is stored as the records of vcd_header::pack(), so the store is self-contained.
+//! Value changes in $dumpvars and similar sections are stored as changes at the time of the section.
+//! @param orig_vcd original VCD file
+//! @param output_file store to be written
+//! @param header header of orig_vcd, whose signals may be selected
+//! @param hierarchy true if the hierarchy of header was established from the signal names
+//! @param header_size size of the original header
+//! @param log stream for messages
+//! @return 0 if succeeded
+int export_columnar(const char *orig_vcd, const char *output_file, const vcd_header &header, bool hierarchy, size_t header_size, std::ostream &log){
+    std::vector<const vcd_signal *> sigs;
+    header.get_signals(sigs);
+    code_table table;
+    if(!table.build(sigs)){
+        log << orig_vcd << ": identifier codes that are not base-94 integers cannot be exported" << std::endl;
+        return -1;
+    }
+    if(is_gzip_name(output_file)){
+        log << output_file << ": columnar store cannot be compressed because it is mapped to be read" << std::endl;
+        return -1;
+    }
+    fd_raii ifd(open(orig_vcd, O_RDONLY));
+    struct stat st;
+    if(ifd < 0 || fstat(ifd, &st)){
+        perror(orig_vcd);
+        return -1;
+    }
+    const off_t file_size = st.st_size;
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    columnar_file_header h;
+    std::memset(&h, 0, sizeof(h));
+    body_writer out(ofd);
+    //the head is written again at the end
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+    column_builder builder(out, table.size());
+    body_reader reader(ifd, header_size, file_size);
+    body_lexer lexer;
+    body_token tok;
+    uint64_t time = 0, num_unknown = 0;
+    for(string_view chunk; reader.next(chunk); ){
+        lexer.feed(chunk);
+        while(lexer.next(tok)){
+            if(tok.kind == body_token::timestamp){
+                uint64_t t;
+                if(!parse_timestamp(tok.value, t)) continue;
+                if(t < time){
+                    log << orig_vcd << ": time goes back from #" << time << " to " << tok.value << std::endl;
+                    return -1;
+                }
+                time = t;
+            }
+            else if(tok.kind == body_token::scalar || tok.kind == body_token::vector || tok.kind == body_token::real || tok.kind == body_token::string){
+                const uint32_t idx = table.find(tok.code);
+                if(idx != code_table::npos) builder.append(idx, time, tok);
+                else ++num_unknown;
+            }
+        }
+    }
+    if(reader.get_error()){
+        errno = reader.get_error();
+        perror(orig_vcd);
+        return -1;
+    }
+    builder.flush_all();
+
+    std::vector<columnar_column> columns;
+    std::vector<columnar_block> blocks;
+    builder.get_index(columns, blocks);
+    std::vector<char> strings;
+    std::vector<packed_module> modules;
+    std::vector<packed_signal> signals;
+    packed_header p;
+    header.pack(strings, modules, signals, p);
+    std::memcpy(h.magic, columnar_magic, sizeof(h.magic));
+    h.byte_order = columnar_byte_order;
+    h.version = columnar_version;
+    h.num_columns = columns.size();
+    h.columns_off = write_aligned(out, columns.empty() ? NULL : &columns.front(), columns.size());
+    h.num_blocks = blocks.size();
+    h.blocks_off = write_aligned(out, blocks.empty() ? NULL : &blocks.front(), blocks.size());
+    h.num_modules = p.num_modules;
+    h.num_tops = p.num_tops;
+    h.modules_off = write_aligned(out, modules.empty() ? NULL : &modules.front(), modules.size());
+    h.num_signals = p.num_signals;
+    h.signals_off = write_aligned(out, signals.empty() ? NULL : &signals.front(), signals.size());
+    h.strings_size = p.strings_size;
+    h.strings_off = write_aligned(out, strings.empty() ? NULL : &strings.front(), strings.size());
+    std::memcpy(h.sections, p.sections, sizeof(h.sections));
+    h.hierarchy = hierarchy ? 1 : 0;
+    h.file_size = out.get_written();
+    if(!out.flush()){
+        errno = out.get_error();
+        perror(output_file);
+        return -1;
+    }
+    if(pwrite(ofd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))){
+        perror(output_file);
+        return -1;
+    }
+    uint64_t num_changes = 0;
+    for(size_t i = 0; i < columns.size(); ++i){
+        num_changes += columns[i].num_changes;
+    }
+    log << "Body size " << file_size - header_size << " -> store size " << h.file_size
+        << ", " << num_changes << " value changes in " << columns.size() << " columns of " << h.num_blocks << " blocks" << std::endl;
+    if(num_unknown) log << num_unknown << " value changes of signals not in the header are dropped" << std::endl;
+    return 0;
+}
+
+// ********** columnar_store **********
+
+const uint32_t columnar_store::npos;
+
+//! constructor
+//
+//! The head and the header are checked here, and the blocks of a column are checked when they are read.
+//! @param filename store written by export_columnar(), check is_valid() after the construction
+columnar_store::columnar_store(const char *filename) : map(new mmap_manager(filename, false)), columns(NULL), num_columns(0), blocks(NULL), num_blocks(0), header(NULL), table(NULL){
+    if(map->get_error()) return;
+    const char *const base = static_cast<const char *>(map->get_ptr());
+    const uint64_t size = map->get_size();
+    columnar_file_header h;
+    if(size < sizeof(h)) return;
+    std::memcpy(&h, base, sizeof(h));
+    if(std::memcmp(h.magic, columnar_magic, sizeof(h.magic)) != 0 || h.byte_order != columnar_byte_order || h.version != columnar_version) return;
+    if(h.file_size != size) return;
+    if(!in_store(h.columns_off, h.num_columns, sizeof(columnar_column), size) || !in_store(h.blocks_off, h.num_blocks, sizeof(columnar_block), size)) return;
+    if(!in_store(h.modules_off, h.num_modules, sizeof(packed_module), size) || !in_store(h.signals_off, h.num_signals, sizeof(packed_signal), size)) return;
+    if(!in_store(h.strings_off, h.strings_size, 1, size)) return;
+    packed_header p;
+    p.strings = base + h.strings_off;
+    p.strings_size = h.strings_size;
+    p.modules = reinterpret_cast<const packed_module *>(base + h.modules_off);
+    p.num_modules = h.num_modules;
+    p.num_tops = h.num_tops;
+    p.signals = reinterpret_cast<const packed_signal *>(base + h.signals_off);
+    p.num_signals = h.num_signals;
+    std::memcpy(p.sections, h.sections, sizeof(p.sections));
+    if(!check_packed_header(p)) return;
+    vcd_header *const hdr = new vcd_header(p);
+    std::vector<const vcd_signal *> sigs;
+    hdr->get_signals(sigs);
+    code_table *const t = new code_table;
+    if(!t->build(sigs) || t->size() != h.num_columns){
+        delete t;
+        delete hdr;
+        return;
+    }
+    header = hdr;
+    table = t;
+    columns = reinterpret_cast<const columnar_column *>(base + h.columns_off);
+    num_columns = h.num_columns;
+    blocks = reinterpret_cast<const columnar_block *>(base + h.blocks_off);
+    num_blocks = h.num_blocks;
+}
+
+//! destructor
+//
+//! Cursors of the store must be destroyed before this.
+columnar_store::~columnar_store(){
+    delete table;
+    delete header;
+    delete map;
+}
+
+//! check if the store is mapped and its head and header are valid
+bool columnar_store::is_valid()const{
+    return header != NULL;
+}
+
+//! get the header, is_valid() must be true
+const vcd_header &columnar_store::get_header()const{
+    return *header;
+}
+
+//! get the number of columns
+size_t columnar_store::get_num_columns()const{
+    return num_columns;
+}
+
+//! get the column of an identifier code
+//
+//! @param code identifier code of a signal in the header
+//! @return column, or npos if the code is not in the header
+uint32_t columnar_store::find_column(const string_view &code)const{
+    return table ? table->find(code) : npos;
+}
+
+//! get the number of value changes of a column
+uint64_t columnar_store::get_num_changes(uint32_t col)const{
+    return col < num_columns ? columns[col].num_changes : 0;
+}
+
+// ********** column_cursor **********
+
+//! constructor
+//
+//! The cursor is placed before the first change of the column.
+//! @param s store, whose is_valid() is true
+//! @param col column to be read
+column_cursor::column_cursor(const columnar_store &s, uint32_t col) : store(s), first(NULL), block(NULL), last(NULL), cur(NULL), end(NULL), time(0), broken(false){
+    if(col >= store.num_columns) return;
+    const columnar_column &c = store.columns[col];
+    if(c.first_block > store.num_blocks || c.num_blocks > store.num_blocks - c.first_block){
+        broken = true;
+        return;
+    }
+    first = block = store.blocks + c.first_block;
+    last = first + c.num_blocks;
+    if(block != last) enter(block);
+}
+
+//! start reading a block
+//
+//! @return false if the block is out of the store
+bool column_cursor::enter(const columnar_block *b){
+    block = b;
+    cur = end = NULL;
+    if(b->offset > store.map->get_size() || b->size > store.map->get_size() - b->offset){
+        broken = true;
+        return false;
+    }
+    cur = static_cast<const unsigned char *>(store.map->get_ptr()) + b->offset;
+    end = cur + b->size;
+    time = b->first_time;
+    return true;
+}
+
+//! read the change at cur
+//
+//! @return false if the change is broken
+bool column_cursor::decode(){
+    uint64_t delta, head;
+    if(!get_varint(cur, end, delta) || !get_varint(cur, end, head)){
+        broken = true;
+        return false;
+    }
+    time += delta;
+    const uint64_t n = head >> 2;
+    switch(head & 3){
+        case scalar_kind:
+            value.assign(1, bit_chars[n & 3]);
+            return true;
+        case vector_kind:
+            if((n + 3) / 4 > static_cast<uint64_t>(end - cur)) break;
+            value.assign(1, 'b');
+            for(uint64_t i = 0; i < n; ++i){
+                value.push_back(bit_chars[cur[i / 4] >> (i % 4 * 2) & 3]);
+            }
+            cur += (n + 3) / 4;
+            return true;
+        case text_kind:
+            if(n > static_cast<uint64_t>(end - cur)) break;
+            value.assign(reinterpret_cast<const char *>(cur), n);
+            cur += n;
+            return true;
+        default:
+            break;
+    }
+    broken = true;
+    return false;
+}
+
+//! read the next change
+//
+//! @return false at the end of the column or if the column is broken, see is_broken()
+bool column_cursor::next(){
+    if(broken || block == last) return false;
+    while(cur == end){
+        if(block + 1 == last) return false;
+        if(!enter(block + 1)) return false;
+    }
+    return decode();
+}
+
+//! move to the last change at or before a time
+//
+//! The blocks are found by binary search on their first times, and only one block is decoded.
+//! The next call of next() reads the last change at or before t, or the first change if all changes are later.
+//! @param t time
+//! @return false if the column is broken
+bool column_cursor::seek(uint64_t t){
+    if(broken || first == last) return !broken;
+    const columnar_block *lo = first, *hi = last;
+    while(hi - lo > 1){
+        const columnar_block *const mid = lo + (hi - lo) / 2;
+        if(mid->first_time <= t) lo = mid;
+        else hi = mid;
+    }
+    if(!enter(lo)) return false;
+    const unsigned char *mark = cur;
+    uint64_t mark_time = time;
+    while(cur != end){
+        const unsigned char *const before = cur;
+        const uint64_t before_time = time;
+        if(!decode()) return false;
+        if(time > t) break;
+        mark = before;
+        mark_time = before_time;
+    }
+    cur = mark;
+    time = mark_time;
+    return true;
+}
+
+//! get the time of the last change read
+uint64_t column_cursor::get_time()const{
+    return time;
+}
+
+//! get the value of the last change read, see the class description for the format
+const std::string &column_cursor::get_value()const{
+    return value;
+}
+
+//! check if a broken block was found
+bool column_cursor::is_broken()const{
+    return broken;
+}
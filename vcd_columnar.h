@@ -0,0 +1,86 @@
+#ifndef VCD_COLUMNAR_H
+#define VCD_COLUMNAR_H
+#include <iosfwd>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+class mmap_manager;
+class vcd_header;
+class string_view;
+class code_table;
+struct columnar_column;
+struct columnar_block;
+
+int export_columnar(const char *, const char *, const vcd_header &, bool, size_t, std::ostream &);
+
+//! columnar store of value changes written by export_columnar(), mapped read-only
+//
+//! Each identifier code has a column of value changes split into blocks,
+//! and reading a column touches only its entry in the column table, its block index and its blocks.
+//! The header is rebuilt from the store, so the store is read without the VCD.
+class columnar_store{
+    //! mapped store, NULL if the store cannot be mapped
+    mmap_manager *map;
+    //! column of each identifier code
+    const columnar_column *columns;
+    //! number of columns
+    size_t num_columns;
+    //! index of all blocks, which are grouped by column
+    const columnar_block *blocks;
+    //! number of blocks
+    size_t num_blocks;
+    //! header rebuilt from the store, NULL if the store is broken
+    vcd_header *header;
+    //! index of the identifier codes in the header, which are the columns
+    code_table *table;
+    columnar_store(const columnar_store &);
+    columnar_store & operator = (const columnar_store &);
+    friend class column_cursor;
+    public:
+    //! column of unknown codes
+    static const uint32_t npos = UINT32_MAX;
+    explicit columnar_store(const char *);
+    ~columnar_store();
+    bool is_valid()const;
+    const vcd_header &get_header()const;
+    size_t get_num_columns()const;
+    uint32_t find_column(const string_view &)const;
+    uint64_t get_num_changes(uint32_t)const;
+};
+
+//! reads the value changes of a column in the order of time
+//
+//! Values are given as in VCD: "0", "1", "x" or "z" for scalars, "b" followed by the bits for vectors,
+//! and "r" or "s" followed by the text for reals and strings.
+class column_cursor{
+    //! store of the column
+    const columnar_store &store;
+    //! first block of the column
+    const columnar_block *first;
+    //! block being read
+    const columnar_block *block;
+    //! end of the blocks of the column
+    const columnar_block *last;
+    //! next change in the block
+    const unsigned char *cur;
+    //! end of the block
+    const unsigned char *end;
+    //! time of the last change read
+    uint64_t time;
+    //! value of the last change read
+    std::string value;
+    //! true if a broken block is found
+    bool broken;
+    bool enter(const columnar_block *);
+    bool decode();
+    public:
+    column_cursor(const columnar_store &, uint32_t);
+    bool seek(uint64_t);
+    bool next();
+    uint64_t get_time()const;
+    const std::string &get_value()const;
+    bool is_broken()const;
+};
+
+#endif
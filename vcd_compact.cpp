@@ -0,0 +1,282 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_compact.h"
+
+namespace{
+
+//! strip the leading bits of a vector value that are restored by the left extension
+//
+//! VCD extends a value with '0' if its leftmost bit is '0' or '1', and with 'x' or 'z' if it is 'x' or 'z'.
+//! So a '0' can be dropped if the next bit is '0' or '1', and an 'x' or a 'z' can be dropped if the next bit is the same.
+//! @param value value including the prefix 'b' or 'B'
+//! @param scratch buffer to store the result
+//! @return the stripped value with the prefix 'b'
+string_view normalize_vector(const string_view &value, std::string &scratch){
+    size_t i = 1;
+    for(; i + 1 < value.size(); ++i){
+        const char c = value[i], n = value[i + 1];
+        const bool redundant = (c == '0') ? (n == '0' || n == '1') : (c == n && (c == 'x' || c == 'X' || c == 'z' || c == 'Z'));
+        if(!redundant) break;
+    }
+    scratch.assign(1, 'b');
+    if(i < value.size()) scratch.append(&value[i], value.size() - i);
+    return string_view(scratch.data(), scratch.size());
+}
+
+//! check if the keyword starts a section of value changes
+bool is_dump_keyword(const string_view &key){
+    return key == "$dumpvars" || key == "$dumpall" || key == "$dumpon" || key == "$dumpoff";
+}
+
+//! rewrites the value changes of VCD body
+//
+//! A value change is dropped if it repeats the current value of the signal,
+//! except in $dumpvars, $dumpall, $dumpon and $dumpoff sections.
+//! The same instance is used for both passes so that they drop exactly the same changes.
+class body_compactor{
+    //! index of identifier codes
+    const code_table &table;
+    //! current value of each code
+    std::vector<std::string> values;
+    //! number of value changes left for each code
+    std::vector<uint64_t> counts;
+    //! new identifier code of each code, NULL if nothing is written
+    const std::vector<std::string> *codes;
+    //! output, NULL if nothing is written
+    body_writer *out;
+    //! buffer for normalized vector values
+    std::string scratch;
+    //! true inside a section of value changes like $dumpvars
+    bool in_dump;
+    //! number of value changes read
+    uint64_t num_changes;
+    //! number of value changes dropped because they repeat the current value
+    uint64_t num_dropped;
+    //! number of value changes dropped because their codes are not defined in the header
+    uint64_t num_unknown;
+    public:
+    //! constructor
+    //
+    //! @param t index of identifier codes defined in the header
+    explicit body_compactor(const code_table &t) : table(t), values(t.size()), counts(t.size()), codes(NULL), out(NULL), in_dump(false), num_changes(0), num_dropped(0), num_unknown(0){}
+    //! start a pass
+    //
+    //! @param c new identifier code of each code, NULL to count the value changes only
+    //! @param w output, NULL to count the value changes only
+    void start(const std::vector<std::string> *c, body_writer *w){
+        codes = c;
+        out = w;
+        values.assign(table.size(), std::string());
+        counts.assign(table.size(), 0);
+        in_dump = false;
+        num_changes = num_dropped = num_unknown = 0;
+    }
+    //! process a token
+    void process(const body_token &tok){
+        if(tok.kind == body_token::timestamp || tok.kind == body_token::keyword || tok.kind == body_token::text){
+            bool end_of_line = (tok.kind == body_token::timestamp);
+            if(tok.kind == body_token::keyword){
+                const bool dump = is_dump_keyword(tok.value), end = (tok.value == "$end");
+                if(dump || end) in_dump = dump;
+                //"$comment" and its text are kept in a line until "$end"
+                end_of_line = dump || end;
+            }
+            if(out){
+                out->write(tok.value);
+                out->put(end_of_line ? '\n' : ' ');
+            }
+            return;
+        }
+        ++num_changes;
+        const uint32_t idx = table.find(tok.code);
+        if(idx == code_table::npos){
+            ++num_unknown;
+            return;
+        }
+        const string_view value = (tok.kind == body_token::vector) ? normalize_vector(tok.value, scratch) : tok.value;
+        std::string &cur = values[idx];
+        if(cur.size() == value.size() && std::equal(cur.begin(), cur.end(), &value[0])){
+            if(!in_dump){
+                ++num_dropped;
+                return;
+            }
+        }
+        else{
+            cur.assign(&value[0], value.size());
+        }
+        ++counts[idx];
+        if(out){
+            out->write(value);
+            if(tok.kind != body_token::scalar) out->put(' ');
+            out->write((*codes)[idx].data(), (*codes)[idx].size());
+            out->put('\n');
+        }
+    }
+    //! get the number of value changes left for each code
+    const std::vector<uint64_t> &get_counts()const{return counts;}
+    //! get the number of value changes read
+    uint64_t get_num_changes()const{return num_changes;}
+    //! get the number of value changes dropped because they repeat the current value
+    uint64_t get_num_dropped()const{return num_dropped;}
+    //! get the number of value changes dropped because their codes are not defined
+    uint64_t get_num_unknown()const{return num_unknown;}
+};
+
+//! pass the tokens of the body to the compactor
+//
+//! @param fd VCD file
+//! @param begin offset of the body
+//! @param end size of the file
+//! @param compactor compactor to process the tokens
+//! @return false if failed to read, errno is set
+bool scan_body(int fd, off_t begin, off_t end, body_compactor &compactor){
+    body_reader reader(fd, begin, end);
+    body_lexer lexer;
+    body_token tok;
+    for(string_view chunk; reader.next(chunk); ){
+        lexer.feed(chunk);
+        while(lexer.next(tok)) compactor.process(tok);
+    }
+    if(lexer.finish(tok)) compactor.process(tok);
+    errno = reader.get_error();
+    return reader.get_error() == 0;
+}
+
+//! fanctor used to sort codes by the number of value changes in descending order
+struct more_changes{
+    const std::vector<uint64_t> &counts;
+    explicit more_changes(const std::vector<uint64_t> &c) : counts(c){}
+    bool operator () (uint32_t a, uint32_t b)const{
+        return counts[a] > counts[b];
+    }
+};
+
+//! assign shorter identifier codes to codes that change more frequently
+//
+//! Codes that change equally keep their original order.
+//! @param counts number of value changes of each code
+//! @param new_codes new identifier code of each code is stored
+void rank_codes(const std::vector<uint64_t> &counts, std::vector<std::string> &new_codes){
+    std::vector<uint32_t> order(counts.size());
+    for(size_t i = 0; i < order.size(); ++i){
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), more_changes(counts));
+    new_codes.resize(counts.size());
+    code_generator gen;
+    for(size_t i = 0; i < order.size(); ++i){
+        new_codes[order[i]] = gen.next();
+    }
+}
+
+//! context of new_symbol()
+struct symbol_map{
+    //! index of the original codes
+    const code_table *table;
+    //! new identifier code of each code
+    const std::vector<std::string> *codes;
+};
+
+//! get the new symbol of a signal, called by vcd_header::replace_symbols()
+string_view new_symbol(const string_view &old, void *arg){
+    const symbol_map &m = *static_cast<const symbol_map *>(arg);
+    const uint32_t idx = m.table->find(old);
+    assert(idx != code_table::npos);
+    const std::string &s = (*m.codes)[idx];
+    return string_view(s.data(), s.size());
+}
+
+} //end of unnamed namespace
+
+//! write a new VCD file whose body is compacted
+//
+//! The body is streamed twice with a fixed size buffer, so the memory does not depend on the body size.
+//! The first pass counts the value changes of each signal, and the most frequently changing signals
+//! get the shortest identifier codes. The second pass writes the body with the new codes,
+//! strips the leading bits of vector values restored by the left extension,
+//! and drops the value changes that repeat the current value.
+//! @param orig_vcd original VCD file
+//! @param output_file new VCD file
+//! @param header header of orig_vcd, whose symbols are replaced with the new codes
+//! @param flatten true to remove the hierarchy
+//! @param level size level of the header
+//! @param header_size size of the original header
+//! @param num_threads number of threads to compress the output if its name ends with ".gz", 0 for the number of CPUs
+//! @param log stream for messages
+//! @return 0 if succeeded
+int make_compact_file(const char *orig_vcd, const char *output_file, vcd_header &header, bool flatten, int level, size_t header_size, unsigned int num_threads, std::ostream &log){
+    std::vector<const vcd_signal *> sigs;
+    header.get_signals(sigs);
+    code_table table;
+    if(!table.build(sigs)){
+        log << orig_vcd << ": identifier codes that are not base-94 integers cannot be compacted" << std::endl;
+        return -1;
+    }
+    fd_raii ifd(open(orig_vcd, O_RDONLY));
+    struct stat st;
+    if(ifd < 0 || fstat(ifd, &st)){
+        perror(orig_vcd);
+        return -1;
+    }
+    const off_t file_size = st.st_size;
+
+    body_compactor compactor(table);
+    compactor.start(NULL, NULL);
+    if(!scan_body(ifd, header_size, file_size, compactor)){
+        perror(orig_vcd);
+        return -1;
+    }
+    std::vector<std::string> new_codes;
+    rank_codes(compactor.get_counts(), new_codes);
+    symbol_map m = {&table, &new_codes};
+    header.replace_symbols(new_symbol, &m);
+
+    std::vector<char> v;
+    header_writer w(v);
+    if(flatten) header.flatten(w, level);
+    else header.to_str(w, level);
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    body_writer out(ofd, is_gzip_name(output_file), num_threads);
+    if(!v.empty()) out.write(&v.front(), v.size());
+    compactor.start(&new_codes, &out);
+    if(!scan_body(ifd, header_size, file_size, compactor)){
+        perror(orig_vcd);
+        return -1;
+    }
+    if(!out.flush()){
+        errno = out.get_error();
+        perror(output_file);
+        return -1;
+    }
+    const uint64_t new_size = out.get_written();
+    log << "Header size " << header_size << " -> " << v.size() << "\n"
+        << "Body size " << file_size - header_size << " -> " << new_size - v.size()
+        << ", " << compactor.get_num_dropped() << " of " << compactor.get_num_changes() << " value changes dropped\n"
+        << "File size " << file_size << " -> " << new_size;
+    if(file_size > 0){
+        log << " (" << std::fixed << std::setprecision(1) << 100.0 * (1.0 - static_cast<double>(new_size) / file_size) << "% smaller)";
+    }
+    log << std::endl;
+    if(compactor.get_num_unknown()){
+        log << compactor.get_num_unknown() << " value changes of signals not in the header are dropped" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef VCD_COMPACT_H
+#define VCD_COMPACT_H
+#include <iosfwd>
+#include <cstddef>
+
+class vcd_header;
+
+int make_compact_file(const char *, const char *, vcd_header &, bool, int, size_t, unsigned int, std::ostream &);
+
+#endif
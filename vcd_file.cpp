@@ -0,0 +1,259 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_stats.h"
+
+namespace{
+
+//! keyword that ends the header
+const char enddefinitions[] = "$enddefinitions";
+//! length of enddefinitions
+const size_t enddefinitions_len = sizeof(enddefinitions) - 1;
+
+//! look for "$enddefinitions" in the data read so far
+//
+//! @param head head of the file
+//! @param len length of the data at head
+//! @param scanned length already searched, the keyword does not start before it
+//! @param header_size size of VCD header is stored if found
+//! @return true if found
+bool find_enddefinitions(const char *head, size_t len, size_t scanned, size_t &header_size){
+    const char *const end = head + len;
+    for(const char *p = head + scanned; p < end; ++p){
+        p = static_cast<const char *>(std::memchr(p, '$', end - p));
+        if(!p || static_cast<size_t>(end - p) < enddefinitions_len) break;
+        if(std::memcmp(p, enddefinitions, enddefinitions_len) == 0){
+            const void *const nl = memrchr(head, '\n', p - head);
+            header_size = nl ? static_cast<const char *>(nl) - head + 1 : 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+//! get the length from which the search resumes after more data is read
+//
+//! The keyword may straddle the end of the data.
+size_t resume_point(size_t len){
+    return len < enddefinitions_len ? 0 : len - enddefinitions_len + 1;
+}
+
+} //end of unnamed namespace
+
+//! count the size of VCD header in Byte
+//
+//! The header is searched through the mapped window of vcd_file.
+//! The window grows geometrically until "$enddefinitions" is found,
+//! so the header is read only once and the mapping can be reused to parse the header.
+//! @param vcd_file mapped VCD file
+//! @param header_size size of VCD header, which does not include the line of "$enddefinitions", is stored
+//! @return false if "$enddefinitions" is not found
+bool get_vcd_header_size(mmap_manager &vcd_file, size_t &header_size){
+    size_t scanned = 0;
+    for(;;){
+        const char *const head = static_cast<const char *>(vcd_file.get_ptr());
+        if(find_enddefinitions(head, vcd_file.get_size(), scanned, header_size)) return true;
+        if(vcd_file.get_size() == vcd_file.get_file_size()) break;
+        scanned = resume_point(vcd_file.get_size());
+        const size_t mapped = vcd_file.get_size();
+        if(vcd_file.remap(std::max(header_scan_window, mapped * 2)) == mapped) break;
+    }
+    return false;
+}
+
+//! count the size of VCD header in a buffer
+//
+//! @param vcd head of VCD
+//! @param len length of the buffer
+//! @param header_size size of VCD header, which does not include the line of "$enddefinitions", is stored
+//! @return false if "$enddefinitions" is not found
+bool get_vcd_header_size(const char *vcd, size_t len, size_t &header_size){
+    return find_enddefinitions(vcd, len, 0, header_size);
+}
+
+//! check if a file is compressed by gzip
+//
+//! @param vcd_filename file to be checked
+//! @return true if the file starts with the magic number of gzip
+bool is_gzip_file(const char *vcd_filename){
+    fd_raii fd(open(vcd_filename, O_RDONLY));
+    char magic[2];
+    return fd >= 0 && pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && is_gzip_data(magic, sizeof(magic));
+}
+
+//! check if a file should be compressed by its name
+//
+//! @param filename name of the file
+//! @return true if the name ends with ".gz"
+bool is_gzip_name(const char *filename){
+    const size_t len = std::strlen(filename);
+    return len > 3 && std::strcmp(filename + len - 3, ".gz") == 0;
+}
+
+//! decompress a VCD until the whole header is read
+//
+//! The buffer grows geometrically like the mapped window of get_vcd_header_size().
+//! @param reader decompressed stream of the VCD
+//! @param buf decompressed data is stored, which includes the head of the body
+//! @param header_size size of VCD header is stored
+//! @return false if "$enddefinitions" is not found or decompression failed, see reader.get_error()
+bool read_gzip_header(gz_reader &reader, std::vector<char> &buf, size_t &header_size){
+    size_t filled = 0, scanned = 0;
+    buf.resize(header_scan_window);
+    for(;;){
+        if(filled == buf.size()) buf.resize(buf.size() * 2);
+        const ssize_t r = reader.read(&buf.front() + filled, buf.size() - filled);
+        if(r <= 0) break;
+        filled += r;
+        if(find_enddefinitions(&buf.front(), filled, scanned, header_size)){
+            buf.resize(filled);
+            return true;
+        }
+        scanned = resume_point(filled);
+    }
+    buf.resize(filled);
+    return false;
+}
+
+//! write a new VCD file whose body is streamed, compressing or decompressing it
+//
+//! The body is copied through body_writer, which compresses it on multiple threads if the output name ends with ".gz".
+//! @param orig_vcd original VCD file
+//! @param output_file new VCD file
+//! @param v new header
+//! @param header_size size of the original header
+//! @param num_threads number of threads to compress, 0 for the number of CPUs
+//! @param reader decompressed stream of orig_vcd positioned after decompressed, NULL if orig_vcd is not compressed
+//! @param decompressed data already decompressed from the head of orig_vcd, which contains the header
+//! @return 0 if succeeded
+int make_new_file_streamed(const char *orig_vcd, const char *output_file, const std::vector<char> &v, size_t header_size, unsigned int num_threads, gz_reader *reader, const std::vector<char> &decompressed){
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    body_writer out(ofd, is_gzip_name(output_file), num_threads);
+    if(!v.empty()) out.write(&v.front(), v.size());
+    if(reader){
+        assert(decompressed.size() >= header_size);
+        out.write(&decompressed.front() + header_size, decompressed.size() - header_size);
+        std::vector<char> buf(1024 * 1024);
+        ssize_t r;
+        while((r = reader->read(&buf.front(), buf.size())) > 0){
+            out.write(&buf.front(), r);
+        }
+        if(r < 0){
+            errno = reader->get_error();
+            perror(orig_vcd);
+            return -1;
+        }
+    }
+    else{
+        fd_raii ifd(open(orig_vcd, O_RDONLY));
+        struct stat st;
+        if(ifd < 0 || fstat(ifd, &st)){
+            perror(orig_vcd);
+            return -1;
+        }
+        body_reader in(ifd, header_size, st.st_size);
+        for(string_view chunk; in.next(chunk); ){
+            out.write(chunk);
+        }
+        if(in.get_error()){
+            errno = in.get_error();
+            perror(orig_vcd);
+            return -1;
+        }
+    }
+    if(!out.flush()){
+        errno = out.get_error();
+        perror(output_file);
+        return -1;
+    }
+    return 0;
+}
+
+//! write the new header in the requested form
+//
+//! @param header header information
+//! @param w writer of the header string
+//! @param flatten true to remove the hierarchy
+//! @param level size level
+void write_header(const vcd_header &header, header_writer &w, bool flatten, int level){
+    if(flatten) header.flatten(w, level);
+    else header.to_str(w, level);
+}
+
+//! update the header in-place
+//
+//! The new header is written directly into the mapped header when no string referred by the header
+//! is overwritten before being read. Otherwise it is staged in a buffer of the exact size.
+//! @param dst start point of VCD to be modified
+//! @param header header information that refers to dst
+//! @param flatten true to remove the hierarchy
+//! @param level size level
+//! @param new_size size of the new header, which must not exceed header_size
+//! @param overwritten true if the new header cannot be written to dst directly
+//! @param header_size VCD header size
+int inplace_mod(void *dst, const vcd_header &header, bool flatten, int level, size_t new_size, bool overwritten, size_t header_size){
+    assert(new_size <= header_size);
+    char *const p = static_cast<char *>(dst);
+    if(overwritten){
+        std::vector<char> v;
+        v.reserve(new_size);
+        header_writer w(v);
+        write_header(header, w, flatten, level);
+        assert(v.size() == new_size);
+        std::memcpy(p, &v.front(), new_size);
+    }
+    else{
+        header_writer w(p);
+        write_header(header, w, flatten, level);
+        assert(w.size() == new_size);
+    }
+    fill_padding(p + new_size, header_size - new_size);
+    count_written(header_size);
+    return 0;
+}
+
+//! update the header which is larger than the original one
+//
+//! Blocks are inserted at the head of the file so that the body is not moved.
+//! If the filesystem does not support the insertion, the whole file is rewritten.
+//! @param vcd_file mapped VCD file to be modified
+//! @param vcd_filename name of the VCD file
+//! @param v new header, which must be larger than header_size
+//! @param header_size VCD header size
+//! @param log stream for messages
+int grow_mod(mmap_manager &vcd_file, const char *vcd_filename, const std::vector<char> &v, size_t header_size, std::ostream &log){
+    assert(v.size() > header_size);
+    const size_t inserted = vcd_file.insert_head(v.size() - header_size);
+    if(inserted == 0){
+        log << "Could not insert space at the head of the file, rewriting the whole file" << std::endl;
+        return rewrite_file(vcd_filename, v, header_size);
+    }
+    const size_t new_header_size = header_size + inserted;
+    if(vcd_file.get_size() < new_header_size){
+        log << vcd_filename << ": " << std::strerror(vcd_file.get_error()) << std::endl;
+        return -1;
+    }
+    char *const p = static_cast<char *>(vcd_file.get_ptr());
+    std::memcpy(p, &v.front(), v.size());
+    fill_padding(p + v.size(), new_header_size - v.size());
+    vcd_file.mark_dirty(0, new_header_size);
+    count_written(new_header_size);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef VCD_FILE_H
+#define VCD_FILE_H
+#include <iosfwd>
+#include <vector>
+#include <cstddef>
+
+class mmap_manager;
+class vcd_header;
+class header_writer;
+class gz_reader;
+
+//! initial length of the window mapped to look for the end of the header
+const size_t header_scan_window = 1024 * 1024;
+
+bool get_vcd_header_size(mmap_manager &, size_t &);
+bool get_vcd_header_size(const char *, size_t, size_t &);
+void write_header(const vcd_header &, header_writer &, bool, int);
+int inplace_mod(void *, const vcd_header &, bool, int, size_t, bool, size_t);
+int grow_mod(mmap_manager &, const char *, const std::vector<char> &, size_t, std::ostream &);
+bool is_gzip_file(const char *);
+bool is_gzip_name(const char *);
+bool read_gzip_header(gz_reader &, std::vector<char> &, size_t &);
+int make_new_file_streamed(const char *, const char *, const std::vector<char> &, size_t, unsigned int, gz_reader *, const std::vector<char> &);
+
+#endif
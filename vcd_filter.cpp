@@ -0,0 +1,279 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "task_pool.h"
+#include "vcd_stats.h"
+#include "vcd_file.h"
+#include "vcd_filter.h"
+
+namespace{
+
+//! length of the body filtered by a task
+const size_t filter_chunk_size = 4 * 1024 * 1024;
+//! length read at once to find the head of a line
+const size_t line_scan_size = 64 * 1024;
+
+//! context of signal_matches()
+struct path_patterns{
+    //! patterns of signals to be kept, all signals are kept if empty
+    const std::vector<std::string> *keep;
+    //! patterns of signals to be dropped
+    const std::vector<std::string> *drop;
+    //! buffer for the path
+    std::vector<char> path;
+};
+
+//! check if any pattern matches the path
+bool match_any(const std::vector<std::string> &patterns, const char *path){
+    for(size_t i = 0; i < patterns.size(); ++i){
+        if(fnmatch(patterns[i].c_str(), path, 0) == 0) return true;
+    }
+    return false;
+}
+
+//! check if a signal is kept, called by vcd_header::filter_signals()
+bool signal_matches(const vcd_signal &sig, void *arg){
+    path_patterns &p = *static_cast<path_patterns *>(arg);
+    p.path.clear();
+    header_writer w(p.path);
+    sig.write_full_path(w);
+    p.path.push_back('\0');
+    const char *const path = &p.path.front();
+    return (p.keep->empty() || match_any(*p.keep, path)) && !match_any(*p.drop, path);
+}
+
+//! find the head of the line that contains an offset
+//
+//! @param fd VCD file
+//! @param pos offset to start
+//! @param end end of the range
+//! @return offset next to the first '\n' at or after pos - 1, or end if not found
+off_t find_line_head(int fd, off_t pos, off_t end){
+    std::vector<char> buf(line_scan_size);
+    for(off_t cur = pos - 1; cur < end; ){
+        const ssize_t r = pread(fd, &buf.front(), std::min<off_t>(buf.size(), end - cur), cur);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break;
+        count_read(r);
+        const char *const nl = static_cast<const char *>(std::memchr(&buf.front(), '\n', r));
+        if(nl) return cur + (nl - &buf.front()) + 1;
+        cur += r;
+    }
+    return end;
+}
+
+//! part of the body filtered by a task
+struct filter_chunk{
+    //! offset of the head
+    off_t begin;
+    //! offset of the end
+    off_t end;
+    //! data read from the file
+    std::vector<char> in;
+    //! filtered data
+    std::vector<char> out;
+    //! state of the lexer at the head, and at the end after filtering
+    body_lexer lexer;
+    //! number of value changes
+    uint64_t num_changes;
+    //! number of value changes kept
+    uint64_t num_kept;
+    //! errno of read failure, 0 if not failed
+    int error;
+};
+
+//! drop the value changes of the codes not in the set
+//
+//! The kept parts are copied as they are, and a dropped value change is removed with the rest of its line.
+//! @param c chunk to be filtered, whose lexer has the state at the head
+//! @param keep codes to be kept
+void filter_data(filter_chunk &c, const code_set &keep){
+    c.out.clear();
+    c.num_changes = c.num_kept = 0;
+    if(c.in.empty()) return;
+    const char *const base = &c.in.front(), *const end = base + c.in.size();
+    c.lexer.feed(string_view(base, c.in.size()));
+    const char *copied = base;
+    body_token tok;
+    while(c.lexer.next(tok)){
+        if(tok.kind != body_token::scalar && tok.kind != body_token::vector && tok.kind != body_token::real && tok.kind != body_token::string) continue;
+        ++c.num_changes;
+        //the value is in the previous chunk if the code is the first token of this chunk
+        const bool split = &tok.value[0] < base || end <= &tok.value[0];
+        if(keep.contains(tok.code)){
+            ++c.num_kept;
+            if(split){
+                c.out.insert(c.out.end(), &tok.value[0], &tok.value[0] + tok.value.size());
+                c.out.push_back(' ');
+                copied = &tok.code[0];
+            }
+            continue;
+        }
+        const char *const head = split ? &tok.code[0] : &tok.value[0];
+        c.out.insert(c.out.end(), copied, head);
+        const char *p = &tok.code[0] + tok.code.size();
+        while(p < end && (*p == ' ' || *p == '\t')) ++p;
+        if(p < end && *p == '\n') ++p;
+        copied = p;
+    }
+    const char *tail = end;
+    if(c.lexer.has_pending_value()){
+        //the value is written with its code by the next chunk
+        while(tail > copied && (tail[-1] == ' ' || tail[-1] == '\t' || tail[-1] == '\n')) --tail;
+        while(tail > copied && !(tail[-1] == ' ' || tail[-1] == '\t' || tail[-1] == '\n')) --tail;
+    }
+    c.out.insert(c.out.end(), copied, tail);
+    c.lexer.feed(string_view());
+}
+
+//! chunks filtered concurrently
+struct filter_batch{
+    //! VCD file
+    int fd;
+    //! codes to be kept
+    const code_set *keep;
+    //! chunks
+    std::vector<filter_chunk> chunks;
+};
+
+//! read and filter a chunk assuming the lexer is in the initial state at its head, called by the workers
+//
+//! @param idx index of the chunk
+//! @param arg filter_batch
+void filter_task(size_t idx, void *arg){
+    filter_batch &b = *static_cast<filter_batch *>(arg);
+    filter_chunk &c = b.chunks[idx];
+    c.in.resize(c.end - c.begin);
+    c.error = 0;
+    for(size_t done = 0; done < c.in.size(); ){
+        const ssize_t r = pread(b.fd, &c.in.front() + done, c.in.size() - done, c.begin + done);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0){
+            c.error = r < 0 ? errno : EIO;
+            return;
+        }
+        count_read(r);
+        done += r;
+    }
+    c.lexer = body_lexer();
+    filter_data(c, *b.keep);
+}
+
+} //end of unnamed namespace
+
+//! keep only the signals whose full paths match glob patterns
+//
+//! A signal is kept if its path matches any pattern of keep (or keep is empty) and no pattern of drop.
+//! Paths are written by vcd_signal::write_full_path() and matched by fnmatch().
+//! @param header header to be modified
+//! @param keep patterns of signals to be kept
+//! @param drop patterns of signals to be dropped
+//! @return number of signals kept
+size_t select_signals(vcd_header &header, const std::vector<std::string> &keep, const std::vector<std::string> &drop){
+    path_patterns p;
+    p.keep = &keep;
+    p.drop = &drop;
+    return header.filter_signals(signal_matches, &p);
+}
+
+//! write a new VCD file that contains only the value changes of the signals in the header
+//
+//! The body is cut into chunks at line boundaries and the chunks are filtered on multiple threads.
+//! Each chunk is tokenized assuming that no $comment or value continues from the previous chunk.
+//! The rare chunk that breaks the assumption is filtered again with the state of the previous chunk,
+//! so the result is the same as that of one thread.
+//! Only a batch of chunks is kept in memory.
+//! @param orig_vcd original VCD file
+//! @param output_file new VCD file
+//! @param header header of orig_vcd whose signals are already selected
+//! @param flatten true to remove the hierarchy
+//! @param level size level of the header
+//! @param header_size size of the original header
+//! @param num_threads number of threads to filter and to compress the output if its name ends with ".gz", 0 for the number of CPUs
+//! @param log stream for messages
+//! @return 0 if succeeded
+int make_filtered_file(const char *orig_vcd, const char *output_file, const vcd_header &header, bool flatten, int level, size_t header_size, unsigned int num_threads, std::ostream &log){
+    std::vector<const vcd_signal *> sigs;
+    header.get_signals(sigs);
+    code_set keep;
+    if(!keep.build(sigs)){
+        log << orig_vcd << ": identifier codes that are not base-94 integers cannot be filtered" << std::endl;
+        return -1;
+    }
+    fd_raii ifd(open(orig_vcd, O_RDONLY));
+    struct stat st;
+    if(ifd < 0 || fstat(ifd, &st)){
+        perror(orig_vcd);
+        return -1;
+    }
+    const off_t file_size = st.st_size;
+    posix_fadvise(ifd, header_size, file_size - header_size, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<char> v;
+    header_writer w(v);
+    if(flatten) header.flatten(w, level);
+    else header.to_str(w, level);
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    body_writer out(ofd, is_gzip_name(output_file), num_threads);
+    if(!v.empty()) out.write(&v.front(), v.size());
+
+    const unsigned int num_workers = num_threads ? num_threads : get_num_cpus();
+    filter_batch b;
+    b.fd = ifd;
+    b.keep = &keep;
+    body_lexer state;
+    uint64_t num_changes = 0, num_kept = 0;
+    for(off_t pos = header_size; pos < file_size; ){
+        b.chunks.resize(2 * num_workers);
+        size_t n = 0;
+        for(; n < b.chunks.size() && pos < file_size; ++n){
+            const off_t next = file_size - pos <= static_cast<off_t>(filter_chunk_size) ? file_size : find_line_head(ifd, pos + filter_chunk_size, file_size);
+            b.chunks[n].begin = pos;
+            b.chunks[n].end = next;
+            pos = next;
+        }
+        b.chunks.resize(n);
+        run_tasks(num_workers, n, filter_task, &b);
+        for(size_t i = 0; i < n; ++i){
+            filter_chunk &c = b.chunks[i];
+            if(c.error){
+                errno = c.error;
+                perror(orig_vcd);
+                return -1;
+            }
+            if(!state.is_initial()){
+                c.lexer = state;
+                filter_data(c, keep);
+            }
+            if(!c.out.empty()) out.write(&c.out.front(), c.out.size());
+            num_changes += c.num_changes;
+            num_kept += c.num_kept;
+            state = c.lexer;
+        }
+    }
+    body_token tok;
+    if(state.finish(tok)) out.write(tok.value);
+    if(!out.flush()){
+        errno = out.get_error();
+        perror(output_file);
+        return -1;
+    }
+    log << "Header size " << header_size << " -> " << v.size() << "\n"
+        << "Body size " << file_size - header_size << " -> " << out.get_written() - v.size()
+        << ", " << num_kept << " of " << num_changes << " value changes kept" << std::endl;
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef VCD_FILTER_H
+#define VCD_FILTER_H
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+class vcd_header;
+
+size_t select_signals(vcd_header &, const std::vector<std::string> &, const std::vector<std::string> &);
+int make_filtered_file(const char *, const char *, const vcd_header &, bool, int, size_t, unsigned int, std::ostream &);
+
+#endif
@@ -2,37 +2,28 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <memory>
+#include <cstring>
 #include "vcd_header.h"
+#include "vcd_tokenizer.h"
+#include "task_pool.h"
 
 namespace{
-const char *const separator = " \t\n";
-
-//! cut-out the token from str separated by one of sep
-//
-//! @param str string to be separated
-//! @param offset start point of returned sub-string
-//! @param sep null terminated string. one of sep is used as a delimiter.
-//! @return sub string of str, not include delimiter
-string_view get_tok(const string_view &str, size_t offset, const char *sep){
-    //assert(offset <= str.size());
-    const char *start = NULL;
-    for(size_t idx = offset, end = str.size(); idx < end; ++idx){
-        const char *s;
-        for(s = sep; *s != '\0'; ++s){
-            if(str[idx] == *s){
-                if(start)
-                    return string_view(start, idx - offset - (start - &str[offset]));
-                else{
-                    break;
-                }
-            }
-        }
-        if(*s == '\0' && !start){
-            start = &str[idx];
-        }
-    }
-    return string_view(start, start ? str.size() - offset : 0);
+//! length of the string tokenized at once by token_list
+const size_t token_chunk_size = 256 * 1024;
+//! minimum length of a chunk parsed by a thread
+const size_t parse_chunk_size = 64 * 1024;
+
+//! check if c is a separator
+inline bool is_separator(char c){
+    return c == ' ' || c == '\t' || c == '\n';
+}
 
+//! check if the last segment of a signal name separated by '.' is not empty
+//
+//! A name like "x." cannot be split into modules because the signal would have no reference.
+inline bool has_leaf_name(const string_view &name){
+    return name.size() && name[name.size() - 1] != '.';
 }
 
 //! indent
@@ -52,92 +43,239 @@ struct indent{
     indent(int i, char c) : i(i), c(c){}
 };
 
-//! append an indent to the end of string (vector of character)
+//! append an indent to the header string
 //
-//! @param v string to be appended to
+//! @param w writer of the header string
 //! @param i indent to be appended
-//! @return modified string (==v)
-std::vector<char> & operator << (std::vector<char> &v, const indent &i){
-    v.insert(v.end(), i.i, i.c);
-    return v;
+//! @return w
+header_writer & operator << (header_writer &w, const indent &i){
+    w.fill(i.c, i.i);
+    return w;
 }
 
-//! append a string to the end of string (vector of character)
+//! append a string to the header string
 //
-//! @param v string to be appended to
+//! @param w writer of the header string
 //! @param s string to be appended
-//! @return modified string (==v)
-std::vector<char> & operator << (std::vector<char> &v, const string_view &s){
-    v.insert(v.end(), &s[0], &s[0] + s.size());
-    return v;
+//! @return w
+header_writer & operator << (header_writer &w, const string_view &s){
+    w.write(s);
+    return w;
 }
 
-//! append a null-terminated string to the end of string (vector of character)
+//! append a null-terminated string to the header string
 //
-//! @param v string to be appended to
+//! @param w writer of the header string
 //! @param s string to be appended
-//! @return modified string (==v)
-std::vector<char> & operator << (std::vector<char> &v, const char *s){
-    while(*s != '\0') v.push_back(*(s++));
-    return v;
+//! @return w
+header_writer & operator << (header_writer &w, const char *s){
+    w.write(s, std::strlen(s));
+    return w;
 }
 
-//! append the full path of signal to the string (vector of character)
+//! append a decimal number to the header string
 //
-//! @param dst string to be appended to
-//! @param sig reference of signal whose path will be appended
-//! @return modified string (==dst)
-std::vector<char> & output_full_path(std::vector<char> &dst, const vcd_signal &sig){
-    std::vector<const vcd_module *> stack;
-    for(const vcd_module *m = sig.get_parent(); m; m = m->get_parent()){
-        stack.push_back(m);
-    }
-    stack.pop_back();
-    while(!stack.empty()){
-        dst << stack.back()->get_name();
-        dst.push_back('.');
-        stack.pop_back();
+//! @param w writer of the header string
+//! @param n number to be appended
+//! @return w
+header_writer & operator << (header_writer &w, uint32_t n){
+    char buf[10];
+    char *p = buf + sizeof(buf);
+    do{
+        *--p = '0' + n % 10;
+        n /= 10;
+    }while(n);
+    w.write(p, buf + sizeof(buf) - p);
+    return w;
+}
+
+//! append the path of module from the child of top module, followed by '.'
+//
+//! @param dst writer of the header string
+//! @param mod module whose path will be appended
+//! @return dst
+header_writer & output_module_path(header_writer &dst, const vcd_module *mod){
+    if(mod && mod->get_parent()){
+        output_module_path(dst, mod->get_parent()) << mod->get_name() << ".";
     }
-    return dst << sig.get_name();
+    return dst;
+}
+
+//! append the full path of signal to the header string
+//
+//! @param dst writer of the header string
+//! @param sig reference of signal whose path will be appended
+//! @return dst
+header_writer & output_full_path(header_writer &dst, const vcd_signal &sig){
+    return output_module_path(dst, sig.get_parent()) << sig.get_name();
 }
 
 //! fanctor used to sort signals by their symbol in VCD
 struct sort_by_symbol{
-    bool operator () (const vcd_signal *a, const vcd_signal *b)const{
-        return a->get_symbol() < b->get_symbol();
+    bool operator () (const vcd_signal &a, const vcd_signal &b)const{
+        return a.get_symbol() < b.get_symbol();
     }
 };
 
-} //end of unnamed namespace
-
-
-// ********** string_view **********
+//! fanctor used to sort modules by their name
+struct sort_by_name{
+    bool operator () (const vcd_module *a, const vcd_module *b)const{
+        return a->get_name() < b->get_name();
+    }
+};
 
-//! constructor
+//! fanctor used to sort signals by their symbol in the order of decode_id_code()
 //
-//! @param s start pointer of memory fragment
-//! @param l length of the fragment
-string_view::string_view(const char *s, size_t l) : ptr(s), len(l){}
+//! Shorter symbol comes first, and symbols of the same length are compared lexicographically.
+struct code_order{
+    bool operator () (const vcd_signal *a, const vcd_signal *b)const{
+        const string_view sa = a->get_symbol(), sb = b->get_symbol();
+        return sa.size() != sb.size() ? sa.size() < sb.size() : sa < sb;
+    }
+};
 
-//! default constructor (constructs empty string)
-string_view::string_view() : ptr(NULL), len(0){}
+//! signal and its symbol decoded by decode_id_code()
+typedef std::pair<uint64_t, const vcd_signal *> keyed_code;
 
-//! access n'th element
+//! sort signals by their symbol decoded as base-94 integer
 //
-//! @param idx offset from the start of the string
-//! @return reference of the element
-const char & string_view::operator[] (size_t idx)const{
-    assert(idx < len);
-    return ptr[idx];
+//! LSD radix sort is used when all symbols can be decoded by decode_id_code().
+//! @param sigs signals to be sorted
+//! @param keyed buffer of the radix sort
+//! @param tmp another buffer of the radix sort
+void sort_by_code(std::vector<const vcd_signal *> &sigs, std::vector<keyed_code> &keyed, std::vector<keyed_code> &tmp){
+    keyed.resize(sigs.size());
+    tmp.resize(sigs.size());
+    uint64_t max_key = 0;
+    for(size_t i = 0; i < sigs.size(); ++i){
+        if(!decode_id_code(sigs[i]->get_symbol(), keyed[i].first)){
+            std::stable_sort(sigs.begin(), sigs.end(), code_order());
+            return;
+        }
+        keyed[i].second = sigs[i];
+        max_key = std::max(max_key, keyed[i].first);
+    }
+    for(unsigned int shift = 0; shift < 64 && (max_key >> shift); shift += 8){
+        size_t count[257] = {0};
+        for(size_t i = 0; i < keyed.size(); ++i){
+            ++count[((keyed[i].first >> shift) & 0xff) + 1];
+        }
+        for(size_t i = 1; i < 257; ++i){
+            count[i] += count[i - 1];
+        }
+        for(size_t i = 0; i < keyed.size(); ++i){
+            tmp[count[(keyed[i].first >> shift) & 0xff]++] = keyed[i];
+        }
+        keyed.swap(tmp);
+    }
+    for(size_t i = 0; i < keyed.size(); ++i){
+        sigs[i] = keyed[i].second;
+    }
 }
 
-//! get the length of the string
+//! open addressing hash table from (parent, name) to index, used to find sub modules during construction
+class child_index{
+    //! slot of the table, the index is UINT32_MAX if the slot is empty
+    struct slot_type{
+        //! parent of the child
+        const void *parent;
+        //! name of the child
+        string_view name;
+        //! index associated with the child
+        uint32_t idx;
+    };
+    //! slots, the size is always power of 2
+    std::vector<slot_type> slots;
+    //! number of used slots
+    size_t num;
+    //! FNV-1a hash of the parent and the name
+    static size_t hash(const void *parent, const string_view &s){
+        uint64_t h = 14695981039346656037ULL ^ reinterpret_cast<uintptr_t>(parent);
+        for(size_t i = 0; i < s.size(); ++i){
+            h = (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ULL;
+        }
+        return h ^ (h >> 32);
+    }
+    //! find the slot for the child
+    size_t lookup(const void *parent, const string_view &s)const{
+        const size_t mask = slots.size() - 1;
+        size_t i = hash(parent, s) & mask;
+        while(slots[i].idx != UINT32_MAX && !(slots[i].parent == parent && slots[i].name == s)) i = (i + 1) & mask;
+        return i;
+    }
+    //! resize the table keeping the entries
+    void rehash(size_t cap){
+        slot_type empty = {NULL, string_view(), UINT32_MAX};
+        std::vector<slot_type> old(cap, empty);
+        old.swap(slots);
+        for(size_t i = 0; i < old.size(); ++i){
+            if(old[i].idx != UINT32_MAX) slots[lookup(old[i].parent, old[i].name)] = old[i];
+        }
+    }
+    public:
+    //! constructor
+    child_index() : num(0){
+        rehash(64);
+    }
+    //! remove all children keeping the table
+    void clear(){
+        if(num == 0) return;
+        const slot_type empty = {NULL, string_view(), UINT32_MAX};
+        std::fill(slots.begin(), slots.end(), empty);
+        num = 0;
+    }
+    //! find the child
+    //
+    //! @param parent parent of the child
+    //! @param s name of the child
+    //! @param idx the index is stored if found
+    //! @return true if found
+    bool find(const void *parent, const string_view &s, uint32_t &idx)const{
+        idx = slots[lookup(parent, s)].idx;
+        return idx != UINT32_MAX;
+    }
+    //! insert the child, which must not be in the table
+    //
+    //! @param parent parent of the child
+    //! @param s name of the child
+    //! @param idx index associated with the child
+    void insert(const void *parent, const string_view &s, uint32_t idx){
+        if((num + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+        const slot_type slot = {parent, s, idx};
+        slots[lookup(parent, s)] = slot;
+        ++num;
+    }
+};
+
+//! output a section like $date
 //
-//! @return length in byte
-size_t string_view::size()const{
-    return len;
+//! @param dst writer of the header string
+//! @param key keyword of the section like "$date"
+//! @param value value of the section
+//! @param collapse true to write the section in one line with runs of whitespace collapsed
+void output_section(header_writer &dst, const char *key, const string_view &value, bool collapse){
+    if(!collapse){
+        dst << key << "\n" << value << "\n$end\n";
+        return;
+    }
+    dst << key;
+    for(size_t i = 0; i < value.size(); ){
+        if(is_separator(value[i])){
+            ++i;
+            continue;
+        }
+        const size_t head = i;
+        while(i < value.size() && !is_separator(value[i])) ++i;
+        dst << " " << string_view(&value[head], i - head);
+    }
+    dst << " $end\n";
 }
 
+} //end of unnamed namespace
+
+
+// ********** string_view **********
+
 /*
 string_view & string_view::operator << (const string_view &other){
     assert(ptr + len == other.ptr);
@@ -147,56 +285,13 @@ string_view & string_view::operator << (const string_view &other){
 */
 
 
-//! get the pair of key field and its value in VCD header
-//
-//! @return pair of key,value
-string_view::param_pair_t string_view::get_param(){
-    string_view key;
-    const char *val_start = NULL;
-    size_t val_len = 0;
-
-    for(string_view tok = get_tok(*this, 0, separator); tok.size(); tok = get_tok(*this, tok.ptr - this->ptr + tok.size(), separator)){
-        if(tok[0] == '$'){
-            if(!key.size()){
-                assert(tok != "$end");
-                key = tok;
-            }
-            else{
-                assert(tok == "$end");
-                const size_t new_offset = tok.ptr - this->ptr + tok.size();
-                assert(len >= new_offset);
-                ptr += new_offset;
-                len -= new_offset;
-                val_len = val_start ? (&tok[0] - val_start - 1) : 0;
-                return std::make_pair(key, string_view(val_start, val_len));
-            }
-        }
-        else{
-            if(!val_start) val_start = &key[0] + key.size() + 1;
-        }
-    }
-    ptr += len;
-    len = 0;
-    return param_pair_t();
-}
-
 //! remove the trailing ' ', '\t' and '\n'
 //
 //! @return remaining part of the string
 string_view string_view::chomp()const{
-    for(const char *c= ptr + len - 1; c >= ptr; --c){
-        bool found = false;
-        for(const char *s = separator; *s != '\0'; ++s){
-            if(*s == *c){
-                found = true;
-                break;
-            }
-        }
-        if(!found){
-            return string_view(ptr, c - ptr + 1);
-        }
-    }
-    return string_view(ptr, 0);
+    size_t l = len;
+    while(l > 0 && is_separator(ptr[l - 1])) --l;
+    return string_view(ptr, l);
 }
 
 //! output the string_view to the stream
@@ -275,63 +370,452 @@ bool operator != (const string_view &a, const char *b){
 //! @param b string_view
 //! @return the result of comparison
 bool operator < (const string_view &a, const string_view &b){
-    for(size_t i = 0; i < std::min(a.size(), b.size()); ++i){
-        if(a[i] != b[i]) return a[i] < b[i];
+    const size_t n = std::min(a.size(), b.size());
+    const int r = n ? std::memcmp(&a[0], &b[0], n) : 0;
+    return r != 0 ? r < 0 : a.size() < b.size();
+}
+
+//! compare string_views
+//
+//! @param a string_view
+//! @param b string_view
+//! @return the result of comparison
+//! @arg true a and b are equivalent
+//! @arg false a and b have differences
+bool operator == (const string_view &a, const string_view &b){
+    return a.size() == b.size() && (a.size() == 0 || std::memcmp(&a[0], &b[0], a.size()) == 0);
+}
+
+//! decode the identifier code of a signal as base-94 integer
+//
+//! Each character from '!' to '~' is a digit from 1 to 94 (bijective numeration),
+//! so shorter codes are smaller and different codes are different integers.
+//! @param code identifier code in VCD
+//! @param val decoded integer is stored
+//! @return false if the code is empty, too long to fit in 64 bit or contains invalid characters
+bool decode_id_code(const string_view &code, uint64_t &val){
+    if(code.size() == 0 || code.size() > 9) return false;
+    uint64_t v = 0;
+    for(size_t i = 0; i < code.size(); ++i){
+        const char c = code[i];
+        if(c < '!' || c > '~') return false;
+        v = v * 94 + (c - '!' + 1);
+    }
+    val = v;
+    return true;
+}
+
+// ********** header_writer **********
+
+//! constructor, the string is only counted
+header_writer::header_writer() : vec(NULL), buf(NULL), pos(0), guard(NULL), guard_len(0), overwritten(false){}
+
+//! constructor, the string is appended to a vector
+//
+//! @param v vector to be appended to
+header_writer::header_writer(std::vector<char> &v) : vec(&v), buf(NULL), pos(0), guard(NULL), guard_len(0), overwritten(false){}
+
+//! constructor, the string is written to a buffer
+//
+//! @param b buffer large enough to hold the whole string
+header_writer::header_writer(char *b) : vec(NULL), buf(b), pos(0), guard(NULL), guard_len(0), overwritten(false){}
+
+//! set the source of strings that will be overwritten by the output
+//
+//! When the output is written to the head of source, a string in the source is destroyed
+//! if it is read after the output passes it. is_overwritten() reports such case.
+//! @param src source string, usually the mapped header
+void header_writer::set_guard(const string_view &src){
+    guard = src.size() ? &src[0] : NULL;
+    guard_len = src.size();
+}
+
+//! append characters
+//
+//! @param s head of characters
+//! @param len number of characters
+void header_writer::write(const char *s, size_t len){
+    if(vec) vec->insert(vec->end(), s, s + len);
+    else if(buf) std::memmove(buf + pos, s, len);
+    pos += len;
+}
+
+//! append a string, which may be in the guarded source
+//
+//! @param s string to be appended
+void header_writer::write(const string_view &s){
+    if(!s.size()) return;
+    const char *const p = &s[0];
+    if(guard <= p && p < guard + guard_len && static_cast<size_t>(p - guard) < pos) overwritten = true;
+    write(p, s.size());
+}
+
+//! append the same characters
+//
+//! @param c character to be appended
+//! @param n number of characters
+void header_writer::fill(char c, size_t n){
+    if(vec) vec->insert(vec->end(), n, c);
+    else if(buf) std::memset(buf + pos, c, n);
+    pos += n;
+}
+
+//! get the number of characters written so far
+size_t header_writer::size()const{
+    return pos;
+}
+
+//! check if a string in the guarded source is read after the output passed it
+//
+//! @return true if the output cannot be written over the source directly
+bool header_writer::is_overwritten()const{
+    return overwritten;
+}
+
+// ********** vcd_arena **********
+
+namespace{
+//! size of the first block of vcd_arena
+const size_t arena_first_block_size = 64 * 1024;
+//! maximum size of blocks of vcd_arena
+const size_t arena_max_block_size = 16 * 1024 * 1024;
+//! alignment of memory returned by vcd_arena
+const size_t arena_alignment = 8;
+} //end of unnamed namespace
+
+//! constructor
+//
+//! @param src source string that strings in nodes refer to
+vcd_arena::vcd_arena(const string_view &src) : source(src.size() ? &src[0] : NULL), source_len(src.size()), cur(NULL), left(0), allocated(0), num_allocs(0){
+    assert(source_len <= UINT32_MAX);
+}
+
+//! destructor, releases all nodes at once
+vcd_arena::~vcd_arena(){
+    for(std::vector<char *>::const_iterator i = blocks.begin(), end = blocks.end(); i != end; ++i){
+        delete [] *i;
+    }
+}
+
+//! release all nodes to reuse the memory for another source
+//
+//! The blocks are merged into one block of the total size,
+//! so nodes of a header of the same size are allocated without the heap next time.
+//! @param src source string that strings in new nodes refer to
+void vcd_arena::reset(const string_view &src){
+    assert(src.size() <= UINT32_MAX);
+    source = src.size() ? &src[0] : NULL;
+    source_len = src.size();
+    if(blocks.size() > 1){
+        for(std::vector<char *>::const_iterator i = blocks.begin(), end = blocks.end(); i != end; ++i){
+            delete [] *i;
+        }
+        blocks.assign(1, new char[allocated]);
+    }
+    cur = blocks.empty() ? NULL : blocks.front();
+    left = allocated;
+    num_allocs = 0;
+    pooled.clear();
+}
+
+//! allocate memory from the arena
+//
+//! @param size size in Byte
+//! @return pointer to the memory aligned to 8 Byte
+void *vcd_arena::allocate(size_t size){
+    size = (size + arena_alignment - 1) & ~(arena_alignment - 1);
+    ++num_allocs;
+    if(size > left){
+        const size_t block_size = std::max(size, std::min(arena_max_block_size, std::max(arena_first_block_size, allocated)));
+        cur = new char[block_size];
+        blocks.push_back(cur);
+        left = block_size;
+        allocated += block_size;
+    }
+    void *const p = cur;
+    cur += size;
+    left -= size;
+    return p;
+}
+
+//! take over the blocks of another arena
+//
+//! Nodes allocated from other remain valid and are released with this arena.
+//! @param other arena that has the same source, which becomes empty
+void vcd_arena::adopt(vcd_arena &other){
+    assert(source == other.source && source_len == other.source_len);
+    assert(other.pooled.empty());
+    blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+    allocated += other.allocated;
+    num_allocs += other.num_allocs;
+    other.blocks.clear();
+    other.cur = NULL;
+    other.left = 0;
+    other.allocated = 0;
+    other.num_allocs = 0;
+}
+
+//! get the offset of a string in the source
+//
+//! @param s string in the source
+//! @return offset from the head of the source
+uint32_t vcd_arena::offset_of(const string_view &s)const{
+    if(!s.size()) return 0;
+    assert(source <= &s[0] && &s[0] + s.size() <= source + source_len);
+    return static_cast<uint32_t>(&s[0] - source);
+}
+
+//! get the offset of a string, copying it to the arena if it is not in the source
+//
+//! @param s string to be stored
+//! @return offset to be passed to str()
+uint32_t vcd_arena::store(const string_view &s){
+    if(!s.size() || (source <= &s[0] && &s[0] + s.size() <= source + source_len)) return offset_of(s);
+    assert(source_len + pooled.size() < UINT32_MAX);
+    char *const p = static_cast<char *>(allocate(s.size()));
+    std::memcpy(p, &s[0], s.size());
+    pooled.push_back(p);
+    return static_cast<uint32_t>(source_len + pooled.size() - 1);
+}
+
+//! get a string in the source or copied by store()
+//
+//! @param off offset from the head of the source
+//! @param len length of the string
+//! @return the string
+string_view vcd_arena::str(uint32_t off, size_t len)const{
+    if(off >= source_len && len > 0){
+        assert(off - source_len < pooled.size());
+        return string_view(pooled[off - source_len], len);
+    }
+    assert(off + len <= source_len);
+    return string_view(source + off, len);
+}
+
+//! get the source string
+const string_view vcd_arena::get_source()const{
+    return string_view(source, source_len);
+}
+
+//! get the number of allocated blocks, which equals the number of heap allocations
+size_t vcd_arena::get_num_blocks()const{
+    return blocks.size();
+}
+
+//! get the total size of allocated blocks in Byte
+size_t vcd_arena::get_allocated_size()const{
+    return allocated;
+}
+
+//! get the number of nodes and arrays allocated from the arena
+size_t vcd_arena::get_num_allocs()const{
+    return num_allocs;
+}
+
+//! placement new to construct a node in vcd_arena
+//
+//! @param size size of the node
+//! @param arena arena to allocate from
+//! @return pointer to the memory
+void *operator new(size_t size, vcd_arena &arena){
+    return arena.allocate(size);
+}
+
+//! called only if the constructor throws, the memory is released with the arena
+void operator delete(void *, vcd_arena &){
+}
+
+// ********** token_list **********
+
+//! constructor
+//
+//! @param str string to be tokenized
+token_list::token_list(const string_view &str) : base(str.size() ? &str[0] : NULL), len(str.size()), scanned(0), first(0), cur(0){
+}
+
+//! start over with another string, the memory of the tokens is reused
+//
+//! @param str string to be tokenized
+void token_list::reset(const string_view &str){
+    base = str.size() ? &str[0] : NULL;
+    len = str.size();
+    scanned = first = cur = 0;
+    bounds.clear();
+}
+
+//! tokenize the next chunk
+//
+//! Tokens before the current parameter are dropped.
+//! @return false if the whole string has been tokenized
+bool token_list::fill(){
+    if(scanned == len) return false;
+    bounds.erase(bounds.begin(), bounds.begin() + (cur - first) * 2);
+    first = cur;
+    size_t end = std::min(len, scanned + token_chunk_size);
+    if(end < len){
+        //cut the chunk after a separator not to split a token
+        size_t e = end;
+        while(e > scanned && !is_separator(base[e - 1])) --e;
+        if(e > scanned) end = e;
+        else while(end < len && !is_separator(base[end - 1])) ++end;
+    }
+    find_token_boundaries(base, scanned, end, bounds);
+    scanned = end;
+    return true;
+}
+
+//! check if n'th token exists, tokenize the string if necessary
+//
+//! @param idx index of the token
+//! @return true if the token exists
+bool token_list::has(size_t idx){
+    while(idx >= first + bounds.size() / 2){
+        if(!fill()) return false;
+    }
+    return true;
+}
+
+//! get n'th token
+//
+//! @param idx index of the token, which must have been checked by has()
+//! @return the token
+string_view token_list::operator[] (size_t idx)const{
+    assert(first <= idx && idx < first + bounds.size() / 2);
+    const size_t i = (idx - first) * 2;
+    return string_view(base + bounds[i], bounds[i + 1] - bounds[i]);
+}
+
+//! get the string from the head of first token to the end of the last token
+//
+//! @param head index of the first token
+//! @param last index of the token next to the last token
+//! @return the string, which is empty if head == last
+string_view token_list::span(size_t head, size_t last)const{
+    assert(first <= head && head <= last && last <= first + bounds.size() / 2);
+    if(head == last) return string_view();
+    return string_view(base + bounds[(head - first) * 2], bounds[(last - first) * 2 - 1] - bounds[(head - first) * 2]);
+}
+
+//! get the value of a parameter including leading and trailing white spaces
+//
+//! The separator just after the key and the one just before "$end" are not included.
+//! @param key index of the key token like "$date"
+//! @param end index of "$end" token
+//! @return the value, which is empty if there is no token between the key and "$end"
+string_view token_list::raw_value(size_t key, size_t end)const{
+    assert(first <= key && key < end && end < first + bounds.size() / 2);
+    if(key + 1 == end) return string_view();
+    const uint32_t head = bounds[(key - first) * 2 + 1] + 1;
+    return string_view(base + head, bounds[(end - first) * 2] - head - 1);
+}
+
+//! find the next parameter like "$var wire 1 ! clk $end" in VCD header
+//
+//! The key token is not checked, so a stray token is reported as an unsupported parameter.
+//! @param key index of the key token like "$var" is stored
+//! @param end index of "$end" token is stored
+//! @return false if there is no more parameter
+bool token_list::get_param(size_t &key, size_t &end){
+    if(!has(cur)) return false;
+    key = cur;
+    for(end = key + 1; has(end); ++end){
+        if((*this)[end] == "$end"){
+            cur = end + 1;
+            return true;
+        }
     }
-    return a.size() < b.size();
+    cur = end;
+    return false;
 }
 
 // ********** vcd_signal **********
 
-//! constructor using string
+//! constructor using tokens
 //
-//! @param info string that contains wire or real
+//! @param toks tokens of VCD header
+//! @param first index of the token that contains wire or real
+//! @param last index of "$end" token
 //! @param parent parent module
-vcd_signal::vcd_signal(const string_view &info, const vcd_module *parent) : parent(parent){
-
-    int depth = 0;
-    const char *name_start = NULL;
-    for(string_view tok = get_tok(info, 0, separator); tok.size(); tok = get_tok(info, &tok[0] - &info[0] + tok.size(), separator)){
-        switch(depth++){
-            case 0:
-                is_wire = (tok == "wire");
-                assert(is_wire || tok == "real");
-                break;
-            case 1:
-                width = tok;
-                break;
-            case 2:
-                symbol = tok;
-                break;
-            case 3:
-                name_start = &tok[0];
-                break;
-        }
-    }
-    assert(symbol.size());
-    assert(name_start);
-    name = string_view(name_start, info.size() - (name_start - &info[0])).chomp();
-//    std::cerr << "Signal '" << name << "' is created" << std::endl;
+vcd_signal::vcd_signal(const token_list &toks, size_t first, size_t last, const vcd_module *parent) : parent(parent), width(0){
+    init(toks, first, last, parent->get_arena());
+}
+
+//! constructor using tokens without parent
+//
+//! The parent must be set by set_parent() before the name is read.
+//! @param toks tokens of VCD header
+//! @param first index of the token that contains wire or real
+//! @param last index of "$end" token
+//! @param arena arena whose source contains the tokens
+vcd_signal::vcd_signal(const token_list &toks, size_t first, size_t last, const vcd_arena &arena) : parent(NULL), width(0){
+    init(toks, first, last, arena);
+}
+
+//! constructor using a serialized signal
+//
+//! The parent must be set by set_parent() before the name is read.
+//! @param p serialized signal whose offsets refer to the source of the arena of the parent
+vcd_signal::vcd_signal(const packed_signal &p) : parent(NULL), name_off(p.name_off), symbol_off(p.symbol_off), width(p.width), name_len(p.name_len), symbol_len(p.symbol_len), is_wire(p.is_wire != 0){
+}
+
+//! parse the tokens of $var
+//
+//! @param toks tokens of VCD header
+//! @param first index of the token that contains wire or real
+//! @param last index of "$end" token
+//! @param arena arena whose source contains the tokens
+void vcd_signal::init(const token_list &toks, size_t first, size_t last, const vcd_arena &arena){
+    assert(first + 4 <= last);
+    const string_view type = toks[first];
+    is_wire = (type == "wire");
+    assert(is_wire || type == "real");
+    const string_view w = toks[first + 1];
+    for(size_t i = 0; i < w.size(); ++i){
+        assert('0' <= w[i] && w[i] <= '9');
+        width = width * 10 + (w[i] - '0');
+    }
+    const string_view symbol = toks[first + 2];
+    assert(symbol.size() <= UINT8_MAX);
+    symbol_off = arena.offset_of(symbol);
+    symbol_len = symbol.size();
+    const string_view name = toks.span(first + 3, last);
+    assert(name.size() <= UINT16_MAX);
+    name_off = arena.offset_of(name);
+    name_len = name.size();
+//    std::cerr << "Signal '" << get_name() << "' is created" << std::endl;
 }
 
 //! get name of signal
-const string_view & vcd_signal::get_name()const{
-    return name;
+string_view vcd_signal::get_name()const{
+    return parent->get_arena().str(name_off, name_len);
 }
 
 //! get symbol in VCD
-const string_view & vcd_signal::get_symbol()const{
-    return symbol;
+string_view vcd_signal::get_symbol()const{
+    return parent->get_arena().str(symbol_off, symbol_len);
 }
 
 //! get bit width of signal
-const string_view & vcd_signal::get_width()const{
+uint32_t vcd_signal::get_width()const{
     return width;
 }
 
 //! set the name of this signal
+//
+//! @param s new name, which must be in the source of the arena
 void vcd_signal::set_name(const string_view &s){
-    name = s;
+    assert(s.size() <= UINT16_MAX);
+    name_off = parent->get_arena().offset_of(s);
+    name_len = s.size();
+}
+
+//! set the symbol of this signal
+//
+//! @param s new symbol, which is copied to the arena if it is not in the source
+void vcd_signal::set_symbol(const string_view &s){
+    assert(s.size() <= UINT8_MAX);
+    symbol_off = parent->get_arena().store(s);
+    symbol_len = s.size();
 }
 
 //! set the parent of this signal
@@ -339,6 +823,14 @@ void vcd_signal::set_parent(const vcd_module *m){
     parent = m;
 }
 
+//! append the full path of this signal
+//
+//! The path starts from the child of the top module, like "u_top.u_sub.sig".
+//! @param dst writer of the path
+void vcd_signal::write_full_path(header_writer &dst)const{
+    output_full_path(dst, *this);
+}
+
 //! dump the information of this signal for debugging
 //
 //! @param os output stream
@@ -346,10 +838,10 @@ void vcd_signal::set_parent(const vcd_module *m){
 void vcd_signal::dump(std::ostream &os, int level)const{
     os
         << std::setw(level * 2) << std::setfill(' ') << ""
-        << "name:\'" << name << "' "
+        << "name:\'" << get_name() << "' "
         << get_type_str()
         << "width:\'" << width << "' "
-        << "symbol:\'" << symbol << "' "
+        << "symbol:\'" << get_symbol() << "' "
         << '\n';
 }
 
@@ -370,74 +862,89 @@ const char *vcd_signal::get_type_str()const{
 //
 //! @param name name of this module
 //! @param parent parent module of this module
-vcd_module::vcd_module(const string_view &name, const vcd_module *parent) : parent(parent), name(name){}
+//! @param arena arena that owns this module
+vcd_module::vcd_module(const string_view &name, const vcd_module *parent, vcd_arena *arena) :
+    arena(arena), parent(parent), name(name), signals(NULL), sub_modules(NULL), num_signals(0), num_sub_modules(0), flat_order(NULL), num_flat_signals(0){}
 
 //! constructor
-vcd_module::vcd_module(string_view &header_str, const string_view &name_arg, vcd_module *parent) : parent(parent){
-    const string_view mod = get_tok(name_arg, 0, separator);
-    assert(mod == "module");
-    name = get_tok(name_arg, mod.size(), separator).chomp();
+//
+//! @param toks tokens of VCD header. tokens until "$upscope" are consumed.
+//! @param first index of the token next to "$scope"
+//! @param last index of "$end" token of "$scope"
+//! @param parent parent module
+//! @param arena arena that owns this module
+//! @param scratch temporary storage to collect children
+vcd_module::vcd_module(token_list &toks, size_t first, size_t last, vcd_module *parent, vcd_arena *arena, vcd_scratch &scratch) :
+    arena(arena), parent(parent), signals(NULL), sub_modules(NULL), num_signals(0), num_sub_modules(0), flat_order(NULL), num_flat_signals(0){
+    assert(first + 2 <= last);
+    assert(toks[first] == "module");
+    name = toks[first + 1];
 //    std::cerr << "Module '" << name << "' is created" << std::endl;
-    for(string_view::param_pair_t param_pair = header_str.get_param(); header_str.size(); param_pair = header_str.get_param()){
-        if(param_pair.first == "$scope"){
-            vcd_module *const mod = new vcd_module(header_str, param_pair.second, this);
-            assert(sub_modules.find(mod->get_name()) == sub_modules.end());
-            sub_modules[mod->get_name()] = mod;
-        }
-        else if(param_pair.first == "$var"){
-            vcd_signal *const sig = new vcd_signal(param_pair.second, this);
-            assert(signals.find(sig->get_symbol()) == signals.end());
-            signals[sig->get_symbol()] = sig;
-        }
-        else if(param_pair.first == "$upscope"){
-            return;
+    const size_t sig_head = scratch.signals.size(), mod_head = scratch.modules.size();
+    for(size_t key, end; toks.get_param(key, end); ){
+        const string_view param = toks[key];
+        if(param == "$scope"){
+            scratch.modules.push_back(new (*arena) vcd_module(toks, key + 1, end, this, arena, scratch));
+        }
+        else if(param == "$var"){
+            scratch.signals.push_back(vcd_signal(toks, key + 1, end, this));
+        }
+        else if(param == "$upscope"){
+            break;
         }
         else{
-            std::cerr << "Warning Not supported parameter " << param_pair << std::endl;
+            *scratch.log << "Warning Not supported parameter " << std::make_pair(param, toks.raw_value(key, end)) << std::endl;
         }
     }
+    set_signals(scratch.signals.empty() ? NULL : &scratch.signals[sig_head], scratch.signals.size() - sig_head);
+    set_sub_modules(scratch.modules.empty() ? NULL : &scratch.modules[mod_head], scratch.modules.size() - mod_head);
+    scratch.signals.erase(scratch.signals.begin() + sig_head, scratch.signals.end());
+    scratch.modules.erase(scratch.modules.begin() + mod_head, scratch.modules.end());
 }
 
-vcd_module::~vcd_module(){
-    for(mod_const_it i = sub_modules.begin(), end = sub_modules.end(); i != end; ++i){
-        delete i->second;
+//! replace the signals of this module
+//
+//! The signals are copied to the arena and sorted by symbol.
+//! @param sigs head of signals
+//! @param n number of signals
+void vcd_module::set_signals(const vcd_signal *sigs, size_t n){
+    assert(n <= UINT32_MAX);
+    vcd_signal *const dst = static_cast<vcd_signal *>(arena->allocate(n * sizeof(vcd_signal)));
+    std::uninitialized_copy(sigs, sigs + n, dst);
+    for(size_t i = 0; i < n; ++i){
+        dst[i].set_parent(this);
+    }
+    for(size_t i = 1; i < n; ++i){
+        if(!sort_by_symbol()(dst[i - 1], dst[i])){
+            //VCD writers usually emit signals in order, so sort only if necessary
+            std::sort(dst, dst + n, sort_by_symbol());
+            break;
+        }
     }
-    for(sig_const_it i = signals.begin(), end = signals.end(); i != end; ++i){
-        delete i->second;
+    //signals that share a symbol in a module are legal aliases
+    for(size_t i = 1; i < n; ++i){
+        assert(!sort_by_symbol()(dst[i], dst[i - 1]));
     }
+    signals = dst;
+    num_signals = n;
 }
 
-//! add signal to this module
-vcd_signal & vcd_module::add_signal(const vcd_signal &sig){
-    assert(signals.find(sig.get_symbol()) == signals.end());
-    vcd_signal *const s = new vcd_signal(sig);
-    s->set_parent(this);
-    signals[s->get_symbol()] = s;
-    return *s;
-}
-
-//! updates the module hierarchy information
-void vcd_module::make_hierarchy_internal(){
-    for(sig_it i = signals.begin(), end = signals.end(); i != end; ){
-        const string_view new_sub_mod_name = get_tok(i->second->get_name(), 0, ".");
-        if(new_sub_mod_name.size() == i->second->get_name().size()){
-            ++i;
-        }
-        else{
-            const string_view new_signal_name = string_view(&(i->second->get_name()[new_sub_mod_name.size() + 1]), i->second->get_name().size() - (new_sub_mod_name.size() + 1));
-            if(sub_modules.find(new_sub_mod_name) == sub_modules.end())
-                sub_modules[new_sub_mod_name] = new vcd_module(new_sub_mod_name, this);
-            vcd_module &sub_mod = *sub_modules[new_sub_mod_name];
-            assert(sub_mod.signals.find(i->second->get_symbol()) == sub_mod.signals.end());
-            i->second->set_name(new_signal_name);
-            i->second->set_parent(&sub_mod);
-            sub_mod.signals[i->second->get_symbol()] = i->second;
-            signals.erase(i++);
-        }
-    }
-    for(std::map<string_view, vcd_module *>::iterator i = sub_modules.begin(), end = sub_modules.end(); i != end; ++i){
-        i->second->make_hierarchy_internal();
+//! replace the sub modules of this module
+//
+//! The pointers are copied to the arena and sorted by name.
+//! @param mods head of sub modules
+//! @param n number of sub modules
+void vcd_module::set_sub_modules(vcd_module *const *mods, size_t n){
+    assert(n <= UINT32_MAX);
+    vcd_module **const dst = static_cast<vcd_module **>(arena->allocate(n * sizeof(vcd_module *)));
+    std::copy(mods, mods + n, dst);
+    for(size_t i = 0; i < n; ++i){
+        dst[i]->parent = this;
     }
+    //a scope opened again is not merged unless the hierarchy is established, so names may repeat
+    std::sort(dst, dst + n, sort_by_name());
+    sub_modules = dst;
+    num_sub_modules = n;
 }
 
 //! get the name of this module
@@ -445,20 +952,9 @@ const string_view & vcd_module::get_name()const{
     return name;
 }
 
-//! establish the module hierarchy information
-vcd_module * vcd_module::make_hierarchy()const{
-    vcd_module *const new_mod = new vcd_module(*this);
-    new_mod->signals.clear();
-    new_mod->sub_modules.clear();
-    for(mod_const_it i = sub_modules.begin(), end = sub_modules.end(); i != end; ++i){
-        new_mod->sub_modules[i->second->get_name()] =  i->second->make_hierarchy();
-        new_mod->sub_modules[i->second->get_name()]->parent = new_mod;
-    }
-    for(sig_const_it i = signals.begin(), end = signals.end(); i != end; ++i){
-        new_mod->add_signal(*(i->second));
-    }
-    new_mod->make_hierarchy_internal();
-    return new_mod;
+//! get the arena that owns this module
+vcd_arena & vcd_module::get_arena()const{
+    return *arena;
 }
 
 //! dump this module and children for debugging
@@ -468,31 +964,31 @@ void vcd_module::dump(std::ostream &os, int level)const{
         << "name:\'" << name << "'\n"
         << std::setw(level * 2) << std::setfill(' ') << ""
         << "signals\n";
-    for(std::map<string_view, vcd_signal *>::const_iterator i = signals.begin(), end = signals.end(); i != end; ++i){
-        i->second->dump(os, level + 1);
+    for(const vcd_signal *i = signals, *end = signals + num_signals; i != end; ++i){
+        i->dump(os, level + 1);
     }
     os
         << std::setw(level * 2) << std::setfill(' ') << ""
         << "submodules\n";
-    for(std::map<string_view, vcd_module *>::const_iterator i = sub_modules.begin(), end = sub_modules.end(); i != end; ++i){
-        i->second->dump(os, level + 1);
+    for(uint32_t i = 0; i < num_sub_modules; ++i){
+        sub_modules[i]->dump(os, level + 1);
     }
 
 }
 
 //! convert to the string information for output VCD
-void vcd_module::to_str(std::vector<char> &dst, int size_level, int level)const{
+void vcd_module::to_str(header_writer &dst, int size_level, int level)const{
     dst << indent(size_level <= 0 ? level : 0) << "$scope module " << name << " $end\n";
-    for(sig_const_it i = signals.begin(), end = signals.end(); i != end; ++i){
-        const vcd_signal &sig = *i->second;
+    for(const vcd_signal *i = signals, *end = signals + num_signals; i != end; ++i){
+        const vcd_signal &sig = *i;
         dst << indent(size_level <= 0 ? level + 1 : 0)
             << "$var " << sig.get_type_str() << " " << sig.get_width()
             << " " << sig.get_symbol()
             << " " << sig.get_name()
             << " $end\n";
     }
-    for(mod_const_it i = sub_modules.begin(), end = sub_modules.end(); i != end; ++i){
-        i->second->to_str(dst, size_level, level + 1);
+    for(uint32_t i = 0; i < num_sub_modules; ++i){
+        sub_modules[i]->to_str(dst, size_level, level + 1);
     }
     dst << indent(size_level <= 0 ? level : 0)
         << "$upscope $end\n";
@@ -500,23 +996,50 @@ void vcd_module::to_str(std::vector<char> &dst, int size_level, int level)const{
 
 //! collect the signals that belong to this module and descendant modules
 void vcd_module::collect_signals(std::vector<const vcd_signal *> &sigs)const{
-    for(sig_const_it i = signals.begin(), end = signals.end(); i != end; ++i){
-        sigs.push_back(i->second);
+    for(const vcd_signal *i = signals, *end = signals + num_signals; i != end; ++i){
+        sigs.push_back(i);
+    }
+    for(uint32_t i = 0; i < num_sub_modules; ++i){
+        sub_modules[i]->collect_signals(sigs);
     }
-    for(mod_const_it i = sub_modules.begin(), end = sub_modules.end(); i != end; ++i){
-        i->second->collect_signals(sigs);
+}
+
+//! get the signals of this module and descendant modules in the order of flatten()
+//
+//! The order is computed once and kept in the arena,
+//! so the size calculation and the output of flatten() share it.
+//! @return array of get_num_flat_signals() signals
+const vcd_signal *const *vcd_module::get_flat_order()const{
+    if(!flat_order){
+        vcd_scratch scratch;
+        make_flat_order(scratch);
     }
+    return flat_order;
+}
+
+//! compute the order of flatten() ahead with reusable buffers
+//
+//! @param scratch buffers to collect and sort the signals
+void vcd_module::make_flat_order(vcd_scratch &scratch)const{
+    std::vector<const vcd_signal *> &sigs = scratch.flat;
+    sigs.clear();
+    collect_signals(sigs);
+    sort_by_code(sigs, scratch.keyed, scratch.keyed_tmp);
+    const vcd_signal **const order = static_cast<const vcd_signal **>(arena->allocate(sigs.size() * sizeof(vcd_signal *)));
+    std::copy(sigs.begin(), sigs.end(), order);
+    flat_order = order;
+    num_flat_signals = sigs.size();
 }
 
 //! flatten the module hierarchy
-void vcd_module::flatten(std::vector<char> &dst, int size_level)const{
+//
+//! Signals are sorted by the identifier codes decoded as base-94 integers.
+void vcd_module::flatten(header_writer &dst, int size_level)const{
     assert(!parent);
-    std::vector<const vcd_signal *> sigs;
-    collect_signals(sigs);
-    std::sort(sigs.begin(), sigs.end(), sort_by_symbol());
+    const vcd_signal *const *const sigs = get_flat_order();
 
     dst << "$scope module " << name << " $end\n";
-    for(std::vector<const vcd_signal *>::const_iterator i = sigs.begin(), end = sigs.end(); i != end; ++i){
+    for(const vcd_signal *const *i = sigs, *const *end = sigs + num_flat_signals; i != end; ++i){
         const vcd_signal &sig = **i;
         dst 
             << "$var " << sig.get_type_str() << " " << sig.get_width()
@@ -529,71 +1052,848 @@ void vcd_module::flatten(std::vector<char> &dst, int size_level)const{
         << "$upscope $end\n";
 }
 
+//! count the indent characters written by to_str() with size level 0
+//
+//! @param level depth of this module
+//! @return number of indent characters of this module and descendant modules
+size_t vcd_module::get_indent_size(int level)const{
+    //$scope and $upscope lines are indented by level, $var lines by level + 1
+    size_t size = 2 * level + static_cast<size_t>(level + 1) * num_signals;
+    for(uint32_t i = 0; i < num_sub_modules; ++i){
+        size += sub_modules[i]->get_indent_size(level + 1);
+    }
+    return size;
+}
+
 //! get the parent module
 const vcd_module * vcd_module::get_parent()const{
     return parent;
 }
 
-// ********** vcd_header **********
+//! get the number of signals of this module
+size_t vcd_module::get_num_signals()const{
+    return num_signals;
+}
 
-//! construct from header string
-vcd_header::vcd_header(string_view &header_str){
-    struct{
-        const char *const str;
-        string_view &val;
-    } const table[] = {
-        {"$date", date},
-        {"$version", version},
-        {"$timescale", timescale},
-        {"$comment", comment}
-    };
-    for(string_view::param_pair_t param_pair = header_str.get_param(); header_str.size(); param_pair = header_str.get_param()){
-        //std::cout << param_pair << std::endl;
-        if(param_pair.first.size() == 0) continue;
-        bool found = false;
-        for(size_t i = 0; i < sizeof(table)/sizeof(table[0]); ++i){
-            if(table[i].str == param_pair.first){
-                assert(table[i].val.size() == 0);
-                table[i].val = param_pair.second;
-//                std::cerr << "Set " << param_pair << std::endl;
-                found = true;
-                break;
-            }
-        }
-        if(!found){
-            if(param_pair.first == "$scope"){
-                vcd_module *const mod = new vcd_module(header_str, param_pair.second, NULL);
-                assert(top_modules.find(mod->get_name()) == top_modules.end());
-                top_modules[mod->get_name()] = mod;
+//! get a signal of this module
+//
+//! @param idx index of the signal, signals are sorted by symbol
+const vcd_signal & vcd_module::get_signal(size_t idx)const{
+    assert(idx < num_signals);
+    return signals[idx];
+}
+
+//! get the number of sub modules of this module
+size_t vcd_module::get_num_sub_modules()const{
+    return num_sub_modules;
+}
+
+//! get a sub module of this module
+//
+//! @param idx index of the sub module, sub modules are sorted by name
+const vcd_module & vcd_module::get_sub_module(size_t idx)const{
+    assert(idx < num_sub_modules);
+    return *sub_modules[idx];
+}
+
+//! keep only the signals chosen by a predicate
+//
+//! Sub modules left without any signal are removed.
+//! @param pred function that returns true for signals to be kept
+//! @param arg context passed to pred
+//! @return number of signals kept in this module and descendant modules
+size_t vcd_module::filter_signals(signal_pred pred, void *arg){
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < num_signals; ++i){
+        if(pred(signals[i], arg)) signals[n++] = signals[i];
+    }
+    num_signals = n;
+    size_t kept = n;
+    uint32_t m = 0;
+    for(uint32_t i = 0; i < num_sub_modules; ++i){
+        const size_t k = sub_modules[i]->filter_signals(pred, arg);
+        if(k) sub_modules[m++] = sub_modules[i];
+        kept += k;
+    }
+    num_sub_modules = m;
+    flat_order = NULL;
+    num_flat_signals = 0;
+    return kept;
+}
+
+//! give new symbols to the signals of this module and descendant modules
+//
+//! The signals are sorted again by the new symbols and the order of flatten() is recomputed.
+//! @param func function that returns the new symbol
+//! @param arg context passed to func
+void vcd_module::replace_symbols(symbol_func func, void *arg){
+    for(vcd_signal *i = signals, *end = signals + num_signals; i != end; ++i){
+        i->set_symbol(func(i->get_symbol(), arg));
+    }
+    std::sort(signals, signals + num_signals, sort_by_symbol());
+    flat_order = NULL;
+    num_flat_signals = 0;
+    for(uint32_t i = 0; i < num_sub_modules; ++i){
+        sub_modules[i]->replace_symbols(func, arg);
+    }
+}
+
+// ********** hierarchy_builder **********
+
+//! builds the module hierarchy from signal names separated by '.'
+//
+//! Modules form a trie whose edges are looked up in one child_index keyed by (parent, segment).
+//! Each signal name is split only once, so building is linear in the total length of names.
+class hierarchy_builder{
+    //! index of no module, used as the parent of top modules
+    static const uint32_t no_module = UINT32_MAX;
+    //! arena that owns the modules to be built
+    vcd_arena *arena;
+    //! all modules created so far
+    std::vector<vcd_module *> modules;
+    //! index of the parent of each module
+    std::vector<uint32_t> parents;
+    //! signals and the index of the module they belong to
+    std::vector<std::pair<uint32_t, vcd_signal> > signals;
+    //! table to find children
+    child_index index;
+    //! modules whose parent belongs to another builder, and the index of the parent in that builder
+    std::vector<std::pair<uint32_t, uint32_t> > roots;
+    //! sub modules built by other builders, and the index of the parent in this builder
+    std::vector<std::pair<uint32_t, vcd_module *> > attached;
+    //! true to keep the working memory for reset()
+    bool keep;
+    //! head of the signals and the sub modules of each module in finish()
+    std::vector<size_t> head, child_head;
+    //! fill positions of the buckets in finish()
+    std::vector<size_t> pos;
+    //! signals bucketed by module in finish()
+    std::vector<vcd_signal> sorted;
+    //! sub modules bucketed by module in finish()
+    std::vector<vcd_module *> children;
+    public:
+    explicit hierarchy_builder(vcd_arena *, bool = false);
+    void reset(vcd_arena *);
+    uint32_t add_module(uint32_t, const string_view &, bool = true);
+    void add_signal(uint32_t, const vcd_signal &);
+    void add_leaf(uint32_t, const vcd_signal &);
+    void add_tree(uint32_t, const vcd_module &);
+    void parse_scope(token_list &, uint32_t, std::ostream &);
+    size_t get_num_modules()const;
+    const vcd_module *get_module(uint32_t)const;
+    uint32_t resolve(uint32_t, uint32_t, string_view &);
+    void add_outer_signal(uint32_t, const vcd_module *, const vcd_signal &);
+    void rebind(vcd_arena *);
+    void adopt(hierarchy_builder &);
+    void finish(std::vector<vcd_module *> &);
+};
+
+const uint32_t hierarchy_builder::no_module;
+
+//! constructor
+//
+//! @param arena arena that owns the modules to be built
+//! @param keep true to keep the working memory after finish() for reset()
+hierarchy_builder::hierarchy_builder(vcd_arena *arena, bool keep) : arena(arena), keep(keep){
+}
+
+//! start over to build another hierarchy, the memory of the tables is reused
+//
+//! @param a arena that owns the modules to be built
+void hierarchy_builder::reset(vcd_arena *a){
+    arena = a;
+    modules.clear();
+    parents.clear();
+    signals.clear();
+    index.clear();
+    roots.clear();
+    attached.clear();
+}
+
+//! get the module that has the name under the parent, the module is created if not exists
+//
+//! @param parent index of the parent module, no_module for a top module
+//! @param name name of the module
+//! @param merge false to create a new module even if the name exists, like a scope opened again without the hierarchy
+//! @return index of the module
+uint32_t hierarchy_builder::add_module(uint32_t parent, const string_view &name, bool merge){
+    const void *const key = parent == no_module ? NULL : modules[parent];
+    uint32_t idx;
+    if(!merge || !index.find(key, name, idx)){
+        idx = modules.size();
+        modules.push_back(new (*arena) vcd_module(name, parent == no_module ? NULL : modules[parent], arena));
+        parents.push_back(parent);
+        if(merge) index.insert(key, name, idx);
+    }
+    return idx;
+}
+
+//! add a signal whose name may contain hierarchy separated by '.'
+//
+//! A name whose last segment is empty like "x." is kept as it is, because the signal would have no reference.
+//! @param parent index of the module that contains the signal
+//! @param sig signal to be added
+void hierarchy_builder::add_signal(uint32_t parent, const vcd_signal &sig){
+    const string_view name = sig.get_name();
+    if(!has_leaf_name(name)){
+        add_leaf(parent, sig);
+        return;
+    }
+    const char *head = &name[0];
+    const char *const end = head + name.size();
+    for(const char *dot; (dot = static_cast<const char *>(std::memchr(head, '.', end - head))); head = dot + 1){
+        if(dot != head) parent = add_module(parent, string_view(head, dot - head));
+    }
+    vcd_signal leaf(sig);
+    leaf.set_name(string_view(head, end - head));
+    add_leaf(parent, leaf);
+}
+
+//! add a signal as it is, the name is not split
+//
+//! @param parent index of the module that contains the signal
+//! @param sig signal to be added
+void hierarchy_builder::add_leaf(uint32_t parent, const vcd_signal &sig){
+    signals.push_back(std::make_pair(parent, sig));
+    signals.back().second.set_parent(modules[parent]);
+}
+
+//! add a module and its descendants, whose signal names may contain hierarchy
+//
+//! @param parent index of the parent module in the new hierarchy, no_module for a top module
+//! @param mod module to be added
+void hierarchy_builder::add_tree(uint32_t parent, const vcd_module &mod){
+    const uint32_t dst = add_module(parent, mod.get_name());
+    for(const vcd_signal *i = mod.signals, *end = mod.signals + mod.num_signals; i != end; ++i){
+        add_signal(dst, *i);
+    }
+    for(uint32_t i = 0; i < mod.num_sub_modules; ++i){
+        add_tree(dst, *mod.sub_modules[i]);
+    }
+}
+
+//! parse the parameters in a scope and add the signals in it
+//
+//! @param toks tokens of VCD header. tokens until "$upscope" are consumed.
+//! @param parent index of the module of the scope
+//! @param log stream for warnings
+void hierarchy_builder::parse_scope(token_list &toks, uint32_t parent, std::ostream &log){
+    for(size_t key, end; toks.get_param(key, end); ){
+        const string_view param = toks[key];
+        if(param == "$scope"){
+            assert(key + 3 <= end && toks[key + 1] == "module");
+            parse_scope(toks, add_module(parent, toks[key + 2]), log);
+        }
+        else if(param == "$var"){
+            add_signal(parent, vcd_signal(toks, key + 1, end, modules[parent]));
+        }
+        else if(param == "$upscope"){
+            return;
+        }
+        else{
+            log << "Warning Not supported parameter " << std::make_pair(param, toks.raw_value(key, end)) << std::endl;
+        }
+    }
+}
+
+//! get the number of modules created so far
+size_t hierarchy_builder::get_num_modules()const{
+    return modules.size();
+}
+
+//! get a module
+//
+//! @param idx index of the module
+const vcd_module *hierarchy_builder::get_module(uint32_t idx)const{
+    return modules[idx];
+}
+
+//! find the module where the rest of a signal name is built independently
+//
+//! The name is followed through the modules whose index is less than num_fixed.
+//! The first other segment is added to this builder and the search stops there,
+//! so the modules below it can be built by another builder without conflicts.
+//! @param parent index of the module that contains the signal
+//! @param num_fixed number of modules that may have children in this builder
+//! @param name name of the signal, the rest of the name is stored
+//! @return index of the module that contains the rest of the name
+uint32_t hierarchy_builder::resolve(uint32_t parent, uint32_t num_fixed, string_view &name){
+    const char *head = &name[0];
+    const char *const end = head + name.size();
+    for(const char *dot; (dot = static_cast<const char *>(std::memchr(head, '.', end - head))); ){
+        const string_view seg(head, dot - head);
+        head = dot + 1;
+        if(seg.size() == 0) continue;
+        uint32_t idx;
+        if(!index.find(modules[parent], seg, idx)){
+            parent = add_module(parent, seg);
+            break;
+        }
+        parent = idx;
+        if(idx >= num_fixed) break;
+    }
+    //empty segments are skipped as add_signal() does
+    while(head < end && *head == '.') ++head;
+    name = string_view(head, end - head);
+    return parent;
+}
+
+//! add a signal under a module of another builder
+//
+//! The first segment of the name becomes a root of this builder.
+//! @param outer_idx index of outer in the other builder
+//! @param outer module that contains the signal in the other builder
+//! @param sig signal whose name has a non-empty segment followed by '.'
+void hierarchy_builder::add_outer_signal(uint32_t outer_idx, const vcd_module *outer, const vcd_signal &sig){
+    const string_view name = sig.get_name();
+    const char *const head = &name[0];
+    const char *const dot = static_cast<const char *>(std::memchr(head, '.', name.size()));
+    assert(dot && dot != head);
+    const string_view seg(head, dot - head);
+    uint32_t idx;
+    if(!index.find(outer, seg, idx)){
+        idx = modules.size();
+        modules.push_back(new (*arena) vcd_module(seg, outer, arena));
+        parents.push_back(no_module);
+        index.insert(outer, seg, idx);
+        roots.push_back(std::make_pair(outer_idx, idx));
+    }
+    vcd_signal rest(sig);
+    rest.set_name(string_view(dot + 1, head + name.size() - dot - 1));
+    add_signal(idx, rest);
+}
+
+//! change the arena of all modules
+//
+//! Call this after finish() when the arena is adopted by another arena.
+//! @param a new arena, which must have the same source
+void hierarchy_builder::rebind(vcd_arena *a){
+    for(size_t i = 0; i < modules.size(); ++i){
+        modules[i]->arena = a;
+    }
+    arena = a;
+}
+
+//! take over the modules built by another builder with add_outer_signal()
+//
+//! @param other builder that is already finished and rebound to the arena of this builder
+void hierarchy_builder::adopt(hierarchy_builder &other){
+    for(size_t i = 0; i < other.roots.size(); ++i){
+        attached.push_back(std::make_pair(other.roots[i].first, other.modules[other.roots[i].second]));
+    }
+}
+
+//! set the children of all modules
+//
+//! Signals and sub modules are bucketed by their parent with counting sort,
+//! so this function is linear in the number of signals and modules.
+//! @param tops top modules are appended
+void hierarchy_builder::finish(std::vector<vcd_module *> &tops){
+    head.assign(modules.size() + 1, 0);
+    for(size_t i = 0; i < signals.size(); ++i){
+        ++head[signals[i].first + 1];
+    }
+    for(size_t i = 1; i < head.size(); ++i){
+        head[i] += head[i - 1];
+    }
+    //signals are copied in the order of the buckets, so the order in a module is kept
+    sorted.resize(signals.size(), vcd_signal(packed_signal()));
+    pos.assign(head.begin(), head.end() - 1);
+    for(size_t i = 0; i < signals.size(); ++i){
+        sorted[pos[signals[i].first]++] = signals[i].second;
+    }
+    if(keep) signals.clear();
+    else std::vector<std::pair<uint32_t, vcd_signal> >().swap(signals);
+
+    //sub modules are bucketed in the same way
+    child_head.assign(modules.size() + 1, 0);
+    for(size_t i = 0; i < modules.size(); ++i){
+        if(parents[i] != no_module) ++child_head[parents[i] + 1];
+    }
+    for(size_t i = 0; i < attached.size(); ++i){
+        ++child_head[attached[i].first + 1];
+    }
+    for(size_t i = 1; i < child_head.size(); ++i){
+        child_head[i] += child_head[i - 1];
+    }
+    children.resize(child_head.back());
+    pos.assign(child_head.begin(), child_head.end() - 1);
+    for(size_t i = 0; i < modules.size(); ++i){
+        if(parents[i] == no_module) tops.push_back(modules[i]);
+        else children[pos[parents[i]]++] = modules[i];
+    }
+    for(size_t i = 0; i < attached.size(); ++i){
+        children[pos[attached[i].first]++] = attached[i].second;
+    }
+    for(size_t i = 0; i < modules.size(); ++i){
+        modules[i]->set_signals(head[i] == head[i + 1] ? NULL : &sorted[head[i]], head[i + 1] - head[i]);
+        modules[i]->set_sub_modules(child_head[i] == child_head[i + 1] ? NULL : &children[child_head[i]], child_head[i + 1] - child_head[i]);
+    }
+    if(!keep){
+        std::vector<vcd_signal>().swap(sorted);
+        std::vector<size_t>().swap(pos);
+    }
+}
+
+// ********** vcd_scratch **********
+
+//! constructor
+vcd_scratch::vcd_scratch() : builder(NULL), log(&std::cerr){
+}
+
+//! destructor
+vcd_scratch::~vcd_scratch(){
+    delete builder;
+}
+
+// ********** parallel parsing **********
+
+namespace{
+
+//! parameter found in a chunk of the header
+struct parsed_record{
+    //! kind of the record
+    enum kind_type{
+        //! parameter other than the followings, key and value are set
+        param,
+        //! $scope, key is the module name
+        scope,
+        //! $upscope, key and value are set
+        upscope,
+        //! consecutive $var, num_signals is set and value spans them to report them when they are out of scopes
+        vars
+    } kind;
+    //! key token or module name
+    string_view key;
+    //! raw value of the parameter
+    string_view value;
+    //! number of signals in the chunk that belong to this record
+    size_t num_signals;
+    //! index of the module that contains the signals, set after the scopes are resolved
+    uint32_t module;
+};
+
+//! records and signals parsed from a chunk of the header
+struct parsed_chunk{
+    //! part of the header, which starts at a parameter
+    string_view source;
+    //! records in the order of the header
+    std::vector<parsed_record> records;
+    //! signals of vars records, whose parent is not set yet
+    std::vector<vcd_signal> signals;
+};
+
+//! state shared by the threads parsing a header
+struct parse_context{
+    //! arena of the header
+    const vcd_arena *arena;
+    //! chunks of the header
+    std::vector<parsed_chunk> chunks;
+};
+
+//! find the head of the next parameter
+//
+//! Each parameter ends at the first "$end" token, so any "$end" token is a boundary of parameters.
+//! @param str header string
+//! @param pos offset to start searching
+//! @param len length of str
+//! @return offset of the character next to the separator after "$end", or len if not found
+size_t next_param(const char *str, size_t pos, size_t len){
+    static const char keyword[] = "$end";
+    const size_t keyword_len = sizeof(keyword) - 1;
+    while(pos < len){
+        const char *const p = static_cast<const char *>(memmem(str + pos, len - pos, keyword, keyword_len));
+        if(!p) break;
+        const size_t e = p - str + keyword_len;
+        if((p == str || is_separator(p[-1])) && (e == len || is_separator(str[e]))) return std::min(e + 1, len);
+        pos = p - str + 1;
+    }
+    return len;
+}
+
+//! parse a chunk of the header, called by the workers
+//
+//! @param idx index of the chunk
+//! @param arg parse_context
+void parse_chunk(size_t idx, void *arg){
+    parse_context &ctx = *static_cast<parse_context *>(arg);
+    parsed_chunk &chunk = ctx.chunks[idx];
+    token_list toks(chunk.source);
+    for(size_t key, end; toks.get_param(key, end); ){
+        const string_view param = toks[key];
+        if(param == "$var"){
+            if(chunk.records.empty() || chunk.records.back().kind != parsed_record::vars){
+                const parsed_record r = {parsed_record::vars, string_view(), string_view(), 0, UINT32_MAX};
+                chunk.records.push_back(r);
+            }
+            parsed_record &r = chunk.records.back();
+            const string_view last = toks[end];
+            const char *const head = r.num_signals ? &r.value[0] : &param[0];
+            r.value = string_view(head, &last[0] + last.size() - head);
+            chunk.signals.push_back(vcd_signal(toks, key + 1, end, *ctx.arena));
+            ++r.num_signals;
+        }
+        else if(param == "$scope"){
+            assert(key + 3 <= end && toks[key + 1] == "module");
+            const parsed_record r = {parsed_record::scope, toks[key + 2], string_view(), 0, UINT32_MAX};
+            chunk.records.push_back(r);
+        }
+        else{
+            const parsed_record r = {param == "$upscope" ? parsed_record::upscope : parsed_record::param, param, toks.raw_value(key, end), 0, UINT32_MAX};
+            chunk.records.push_back(r);
+        }
+    }
+}
+
+//! signal whose remaining name is built below a module of the main builder
+struct pending_signal{
+    //! index of the module in the main builder
+    uint32_t outer;
+    //! signal whose name is the remaining part
+    vcd_signal sig;
+    pending_signal(uint32_t outer, const vcd_signal &sig) : outer(outer), sig(sig){}
+};
+
+//! subtrees built by a thread
+struct partition{
+    //! arena of the modules in this partition, adopted by the arena of the header later
+    vcd_arena arena;
+    //! builder of this partition
+    hierarchy_builder builder;
+    //! signals to be added
+    std::vector<pending_signal> signals;
+    explicit partition(const string_view &source) : arena(source), builder(&arena){}
+};
+
+//! state shared by the threads building subtrees
+struct build_context{
+    //! main builder, which is read only while building
+    const hierarchy_builder *main;
+    //! arena of the header
+    vcd_arena *arena;
+    //! partitions
+    std::vector<partition *> parts;
+};
+
+//! build subtrees of a partition, called by the workers
+//
+//! @param idx index of the partition
+//! @param arg build_context
+void build_partition(size_t idx, void *arg){
+    build_context &ctx = *static_cast<build_context *>(arg);
+    partition &part = *ctx.parts[idx];
+    for(size_t i = 0; i < part.signals.size(); ++i){
+        const pending_signal &p = part.signals[i];
+        part.builder.add_outer_signal(p.outer, ctx.main->get_module(p.outer), p.sig);
+    }
+    std::vector<pending_signal>().swap(part.signals);
+    std::vector<vcd_module *> roots;
+    part.builder.finish(roots);
+    part.builder.rebind(ctx.arena);
+}
+
+//! choose the partition of a subtree
+//
+//! @param outer index of the module in the main builder
+//! @param name name whose first segment is the root of the subtree
+//! @param num_parts number of partitions
+size_t partition_of(uint32_t outer, const string_view &name, size_t num_parts){
+    uint64_t h = 14695981039346656037ULL ^ outer;
+    for(size_t i = 0; i < name.size() && name[i] != '.'; ++i){
+        h = (h ^ static_cast<unsigned char>(name[i])) * 1099511628211ULL;
+    }
+    return (h ^ (h >> 32)) % num_parts;
+}
+
+} //end of unnamed namespace
+
+// ********** vcd_header **********
+
+//! construct from tokens of header string
+//
+//! @param toks tokens of header string
+//! @param source header string that toks refers to
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+vcd_header::vcd_header(token_list &toks, const string_view &source, bool hierarchy) : arena(new vcd_arena(source)){
+    vcd_scratch scratch;
+    parse(toks, hierarchy, scratch);
+}
+
+//! construct from tokens of header string with working memory kept by the caller
+//
+//! @param toks tokens of header string
+//! @param source header string that toks refers to
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+//! @param scratch working memory, which can be passed to reparse() later
+vcd_header::vcd_header(token_list &toks, const string_view &source, bool hierarchy, vcd_scratch &scratch) : arena(new vcd_arena(source)){
+    parse(toks, hierarchy, scratch);
+}
+
+//! replace the whole header with another header string
+//
+//! The memory of the arena, the top modules and scratch is reused,
+//! so parsing headers of the same size repeatedly does not allocate heap memory.
+//! Modules and signals of the current header become invalid.
+//! @param toks tokens of header string
+//! @param source header string that toks refers to
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+//! @param scratch working memory
+void vcd_header::reparse(token_list &toks, const string_view &source, bool hierarchy, vcd_scratch &scratch){
+    date = version = timescale = comment = string_view();
+    top_modules.clear();
+    arena->reset(source);
+    parse(toks, hierarchy, scratch);
+}
+
+//! parse the parameters of the header
+//
+//! @param toks tokens of header string
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+//! @param scratch working memory
+void vcd_header::parse(token_list &toks, bool hierarchy, vcd_scratch &scratch){
+    if(hierarchy){
+        if(scratch.builder) scratch.builder->reset(arena);
+        else scratch.builder = new hierarchy_builder(arena, true);
+    }
+    hierarchy_builder *const builder = scratch.builder;
+    for(size_t key, end; toks.get_param(key, end); ){
+        const string_view::param_pair_t param_pair(toks[key], toks.raw_value(key, end));
+        //std::cout << param_pair << std::endl;
+        if(!set_section(param_pair.first, param_pair.second)){
+            if(param_pair.first == "$scope"){
+                if(hierarchy){
+                    assert(key + 3 <= end && toks[key + 1] == "module");
+                    builder->parse_scope(toks, builder->add_module(UINT32_MAX, toks[key + 2]), *scratch.log);
+                }
+                else{
+                    add_top_module(new (*arena) vcd_module(toks, key + 1, end, NULL, arena, scratch));
+                }
             }
             else if(param_pair.first == "$enddefinitions"){
 //                return;
             }
             else{
-                std::cerr << "Warning Not supported parameter " << param_pair << std::endl;
+                *scratch.log << "Warning Not supported parameter " << param_pair << std::endl;
             }
         }
     }
-//    assert(!"Never comes here");
+    if(hierarchy){
+        //the top modules are collected in the scratch, which is empty after parsing the scopes
+        std::vector<vcd_module *> &tops = scratch.modules;
+        builder->finish(tops);
+        for(size_t i = 0; i < tops.size(); ++i){
+            add_top_module(tops[i]);
+        }
+        tops.clear();
+    }
 }
 
-//! destructor
-vcd_header::~vcd_header(){
+//! compute the order of flatten() of all top modules ahead with reusable buffers
+//
+//! flatten() and get_sizes() compute the order on demand with temporary buffers otherwise.
+//! @param scratch buffers to collect and sort the signals
+void vcd_header::make_flat_order(vcd_scratch &scratch)const{
     for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
-        delete i->second;
+        (*i)->make_flat_order(scratch);
+    }
+}
+
+//! construct from header string with multiple threads
+//
+//! The header is split at the boundaries of parameters into chunks, which are parsed concurrently.
+//! With hierarchy, each signal is routed by the first segment of its name that is not an explicit scope,
+//! and the subtrees below those segments are built concurrently by partitions.
+//! Children of every module are sorted, so the result is the same as the single-threaded constructor.
+//! Without hierarchy, a scope opened again is a module of its own like vcd_header::parse().
+//! @param source header string
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+//! @param num_threads number of threads, 0 for the number of CPUs
+//! @param log stream for warnings
+vcd_header::vcd_header(const string_view &source, bool hierarchy, unsigned int num_threads, std::ostream &log) : arena(new vcd_arena(source)){
+    if(num_threads == 0) num_threads = get_num_cpus();
+    parse_context pctx;
+    pctx.arena = arena;
+    const size_t len = source.size();
+    const char *const str = len ? &source[0] : NULL;
+    const size_t num_chunks = std::max<size_t>(1, std::min<size_t>(num_threads * 4, len / parse_chunk_size));
+    for(size_t head = 0, i = 1; head < len; ++i){
+        const size_t end = i < num_chunks ? next_param(str, std::max(head, len / num_chunks * i), len) : len;
+        pctx.chunks.push_back(parsed_chunk());
+        pctx.chunks.back().source = string_view(str + head, end - head);
+        head = end;
+    }
+    run_tasks(num_threads, pctx.chunks.size(), parse_chunk, &pctx);
+
+    //scopes are resolved in the order of the header
+    hierarchy_builder builder(arena);
+    std::vector<uint32_t> scopes;
+    for(size_t c = 0; c < pctx.chunks.size(); ++c){
+        std::vector<parsed_record> &records = pctx.chunks[c].records;
+        for(size_t i = 0; i < records.size(); ++i){
+            parsed_record &r = records[i];
+            switch(r.kind){
+                case parsed_record::scope:
+                    scopes.push_back(builder.add_module(scopes.empty() ? UINT32_MAX : scopes.back(), r.key, hierarchy));
+                    break;
+                case parsed_record::upscope:
+                    if(scopes.empty()) log << "Warning Not supported parameter " << std::make_pair(r.key, r.value) << std::endl;
+                    else scopes.pop_back();
+                    break;
+                case parsed_record::vars:
+                    if(scopes.empty()){
+                        //reported one by one in the same format as vcd_header::parse()
+                        token_list vars(r.value);
+                        for(size_t key, end; vars.get_param(key, end); ){
+                            log << "Warning Not supported parameter " << std::make_pair(vars[key], vars.raw_value(key, end)) << std::endl;
+                        }
+                    }
+                    else r.module = scopes.back();
+                    break;
+                case parsed_record::param:
+                    if(!scopes.empty() || (!set_section(r.key, r.value) && r.key != "$enddefinitions")){
+                        log << "Warning Not supported parameter " << std::make_pair(r.key, r.value) << std::endl;
+                    }
+                    break;
+            }
+        }
+    }
+
+    //signals are routed to the main builder or to partitions
+    const uint32_t num_fixed = builder.get_num_modules();
+    const size_t num_parts = hierarchy ? num_threads * 4 : 0;
+    build_context bctx;
+    bctx.main = &builder;
+    bctx.arena = arena;
+    for(size_t i = 0; i < num_parts; ++i){
+        bctx.parts.push_back(new partition(source));
+    }
+    for(size_t c = 0; c < pctx.chunks.size(); ++c){
+        const parsed_chunk &chunk = pctx.chunks[c];
+        for(size_t i = 0, sig_idx = 0; i < chunk.records.size(); ++i){
+            const parsed_record &r = chunk.records[i];
+            if(r.kind != parsed_record::vars) continue;
+            for(size_t j = sig_idx, end = sig_idx + r.num_signals; r.module != UINT32_MAX && j < end; ++j){
+                vcd_signal sig(chunk.signals[j]);
+                sig.set_parent(builder.get_module(r.module));
+                if(!hierarchy){
+                    builder.add_leaf(r.module, sig);
+                    continue;
+                }
+                string_view name = sig.get_name();
+                if(!has_leaf_name(name)){
+                    builder.add_leaf(r.module, sig);
+                    continue;
+                }
+                const uint32_t target = builder.resolve(r.module, num_fixed, name);
+                sig.set_name(name);
+                if(name.size() && std::memchr(&name[0], '.', name.size())){
+                    bctx.parts[partition_of(target, name, num_parts)]->signals.push_back(pending_signal(target, sig));
+                }
+                else{
+                    builder.add_leaf(target, sig);
+                }
+            }
+            sig_idx += r.num_signals;
+        }
     }
+    std::vector<parsed_chunk>().swap(pctx.chunks);
+    run_tasks(num_threads, bctx.parts.size(), build_partition, &bctx);
+    for(size_t i = 0; i < bctx.parts.size(); ++i){
+        arena->adopt(bctx.parts[i]->arena);
+        builder.adopt(bctx.parts[i]->builder);
+        delete bctx.parts[i];
+    }
+
+    std::vector<vcd_module *> tops;
+    builder.finish(tops);
+    for(size_t i = 0; i < tops.size(); ++i){
+        add_top_module(tops[i]);
+    }
+}
+
+//! construct from a serialized header without parsing
+//
+//! The arena refers to the interned strings, which must outlive this header.
+//! The records must be valid, see vcd_index.
+//! @param p serialized header made by pack()
+vcd_header::vcd_header(const packed_header &p) : arena(new vcd_arena(string_view(p.strings, p.strings_size))){
+    string_view *const sections[] = {&date, &version, &timescale, &comment};
+    for(size_t i = 0; i < 4; ++i){
+        if(p.sections[i * 2 + 1]) *sections[i] = string_view(p.strings + p.sections[i * 2], p.sections[i * 2 + 1]);
+    }
+    std::vector<vcd_module *> modules(p.num_modules);
+    for(size_t i = 0; i < p.num_modules; ++i){
+        const packed_module &m = p.modules[i];
+        modules[i] = new (*arena) vcd_module(string_view(p.strings + m.name_off, m.name_len), NULL, arena);
+    }
+    std::vector<vcd_signal> sigs;
+    //children are set from the bottom because set_sub_modules() sets their parents
+    for(size_t i = p.num_modules; i-- > 0; ){
+        const packed_module &m = p.modules[i];
+        sigs.clear();
+        for(uint32_t j = 0; j < m.num_signals; ++j){
+            sigs.push_back(vcd_signal(p.signals[m.first_signal + j]));
+        }
+        modules[i]->set_signals(sigs.empty() ? NULL : &sigs.front(), sigs.size());
+        modules[i]->set_sub_modules(m.num_children ? &modules[m.first_child] : NULL, m.num_children);
+    }
+    top_modules.assign(modules.begin(), modules.begin() + p.num_tops);
+}
+
+//! destructor, releases all modules and signals at once
+vcd_header::~vcd_header(){
+    delete arena;
+}
+
+//! set the value of $date, $version, $timescale or $comment
+//
+//! @param key key token like "$date"
+//! @param value raw value of the parameter
+//! @return false if key is not one of them
+bool vcd_header::set_section(const string_view &key, const string_view &value){
+    struct{
+        const char *const str;
+        string_view &val;
+    } const table[] = {
+        {"$date", date},
+        {"$version", version},
+        {"$timescale", timescale},
+        {"$comment", comment}
+    };
+    for(size_t i = 0; i < sizeof(table)/sizeof(table[0]); ++i){
+        if(table[i].str == key){
+            assert(table[i].val.size() == 0);
+            table[i].val = value;
+//            std::cerr << "Set " << std::make_pair(key, value) << std::endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+//! add a top module keeping top_modules sorted by name
+//
+//! A module of the same name as an existing one is added after it.
+//! @param mod module to be added
+void vcd_header::add_top_module(vcd_module *mod){
+    top_modules.insert(std::upper_bound(top_modules.begin(), top_modules.end(), mod, sort_by_name()), mod);
 }
 
 //! establish the hierarchy among modules
-vcd_header * vcd_header::make_hierarchy()const{
-    vcd_header *const new_header = new vcd_header(*this);
-    new_header->top_modules.clear();
+//
+//! The current modules are consumed and replaced with the new hierarchy in the same arena.
+//! Signals are moved, not copied to another tree.
+void vcd_header::make_hierarchy(){
+    hierarchy_builder builder(arena);
     for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
-        vcd_module *const top = i->second->make_hierarchy();
-        assert(new_header->top_modules.find(top->get_name()) == new_header->top_modules.end());
-        new_header->top_modules[top->get_name()] = top;
+        builder.add_tree(UINT32_MAX, **i);
+    }
+    top_modules.clear();
+    std::vector<vcd_module *> tops;
+    builder.finish(tops);
+    for(size_t i = 0; i < tops.size(); ++i){
+        add_top_module(tops[i]);
     }
-    return new_header;
 }
 
 //! dump the whole header information for debugging
@@ -606,56 +1906,325 @@ void vcd_header::dump(std::ostream &os)const{
         << "submodules\n"
         ;
     for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
-        i->second->dump(os, 1);
+        (*i)->dump(os, 1);
     }
 }
 
 //! convert the information to string with hierarchy structure
-void vcd_header::to_str(std::vector<char> &dst, int level)const{
-    if(level < 1){
-        dst << "$date\n" << date << "\n$end\n";
-        if(level <= 0) dst << "\n";
-        dst << "$version\n" << version << "\n$end\n";
-        if(level <= 0) dst << "\n";
-        dst << "$timescale\n" << timescale << "\n$end\n";
-        if(level <= 0) dst << "\n";
-    }
+//
+//! @param v string to be appended to
+//! @param level size level
+void vcd_header::to_str(std::vector<char> &v, int level)const{
+    header_writer dst(v);
+    to_str(dst, level);
+}
+
+//! output $date, $version and $timescale sections
+//
+//! @param dst writer of the header string
+//! @param level size level, see to_str()
+void vcd_header::output_sections(header_writer &dst, int level)const{
+    output_section(dst, "$date", date, level >= 4);
+    if(level <= 0) dst << "\n";
+    output_section(dst, "$version", version, level >= 4);
+    if(level <= 0) dst << "\n";
+    output_section(dst, "$timescale", timescale, level >= 2);
+    if(level <= 0) dst << "\n";
+}
+
+//! output $comment section
+//
+//! @param dst writer of the header string
+//! @param level size level, see to_str()
+void vcd_header::output_comment(header_writer &dst, int level)const{
+    if(level >= 3 || comment.size() == 0) return;
+    if(level <= 0) dst << "\n";
+    output_section(dst, "$comment", comment, level >= 2);
+}
+
+//! convert the information to string with hierarchy structure
+//
+//! Use header_writer without destination to get the exact size before writing.
+//! Each size level keeps all compactions of the lower levels.
+//! @arg 0 original layout with indentation and blank lines
+//! @arg 1 no indentation and no blank lines
+//! @arg 2 $timescale and $comment are written in one line with whitespace collapsed
+//! @arg 3 $comment is dropped
+//! @arg 4 $date and $version are written in one line with whitespace collapsed
+//! @param dst writer of the header string
+//! @param level size level
+void vcd_header::to_str(header_writer &dst, int level)const{
+    output_sections(dst, level);
     for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
-        i->second->to_str(dst, level, 1);
+        (*i)->to_str(dst, level, 1);
     }
-    if(level < 1 && comment.size() > 0){
-        if(level <= 0) dst << "\n";
-        dst << "$comment\n" << comment << "\n$end\n";
+    output_comment(dst, level);
+}
+
+//! convert the hierarchy to string under a new top module
+//
+//! Used to put the hierarchies of several headers side by side.
+//! @param dst writer of the header string
+//! @param level size level, see to_str()
+//! @param top name of the new top module that contains the top modules
+//! @param sections true to write $date, $version, $timescale and $comment too
+void vcd_header::nest_to_str(header_writer &dst, int level, const string_view &top, bool sections)const{
+    if(sections) output_sections(dst, level);
+    dst << indent(level <= 0 ? 1 : 0) << "$scope module " << top << " $end\n";
+    for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
+        (*i)->to_str(dst, level, 2);
     }
+    dst << indent(level <= 0 ? 1 : 0) << "$upscope $end\n";
+    if(sections) output_comment(dst, level);
 }
 
 //! convert the information to string without hierarchy structure
-void vcd_header::flatten(std::vector<char> &dst, int level)const{
-    if(level < 1){
-        dst << "$date\n" << date << "\n$end\n";
-        if(level <= 0) dst << "\n";
-        dst << "$version\n" << version << "\n$end\n";
-        if(level <= 0) dst << "\n";
-        dst << "$timescale\n" << timescale << "\n$end\n";
-        if(level <= 0) dst << "\n";
+//
+//! @param v string to be appended to
+//! @param level size level
+void vcd_header::flatten(std::vector<char> &v, int level)const{
+    header_writer dst(v);
+    flatten(dst, level);
+}
+
+//! convert the information to string without hierarchy structure
+//
+//! Use header_writer without destination to get the exact size before writing.
+//! @param dst writer of the header string
+//! @param level size level, see to_str()
+void vcd_header::flatten(header_writer &dst, int level)const{
+    output_sections(dst, level);
+    for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
+        (*i)->flatten(dst, level);
     }
+    output_comment(dst, level);
+}
+
+//! get the exact output size of every size level
+//
+//! Modules are counted only once because the levels differ only in the indentation of modules,
+//! so choosing a level does not need the header to be written for each level.
+//! @param flatten true for the size of flatten(), false for to_str()
+//! @param sizes sizes of level 0 to max_size_level are stored
+void vcd_header::get_sizes(bool flatten, size_t *sizes)const{
+    header_writer modules;
+    size_t indent_size = 0;
     for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
-        i->second->flatten(dst, level);
+        if(flatten){
+            (*i)->flatten(modules, 1);
+        }
+        else{
+            (*i)->to_str(modules, 1, 1);
+            indent_size += (*i)->get_indent_size(1);
+        }
+    }
+    for(int level = 0; level <= max_size_level; ++level){
+        header_writer others;
+        output_sections(others, level);
+        output_comment(others, level);
+        sizes[level] = others.size() + modules.size() + (level <= 0 ? indent_size : 0);
     }
-    if(level < 1 && comment.size() > 0){
-        if(level <= 0) dst << "\n";
-        dst << "$comment\n" << comment << "\n$end\n";
+}
+
+//! collect all signals in the header
+//
+//! @param sigs signals are appended
+void vcd_header::get_signals(std::vector<const vcd_signal *> &sigs)const{
+    for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
+        (*i)->collect_signals(sigs);
     }
 }
 
+//! get the text of $timescale, empty if not given
+const string_view &vcd_header::get_timescale()const{
+    return timescale;
+}
+
+//! get the number of top modules
+size_t vcd_header::get_num_top_modules()const{
+    return top_modules.size();
+}
+
+//! get a top module
+//
+//! @param idx index of the top module, top modules are sorted by name
+const vcd_module & vcd_header::get_top_module(size_t idx)const{
+    return *top_modules[idx];
+}
+
+//! give new symbols to all signals
+//
+//! Signals that share a symbol must be given the same new symbol to keep them aliased.
+//! @param func function that returns the new symbol of a symbol
+//! @param arg context passed to func
+void vcd_header::replace_symbols(symbol_func func, void *arg){
+    for(mod_const_it i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
+        (*i)->replace_symbols(func, arg);
+    }
+}
+
+//! keep only the signals chosen by a predicate
+//
+//! Modules left without any signal are removed.
+//! @param pred function that returns true for signals to be kept
+//! @param arg context passed to pred
+//! @return number of signals kept
+size_t vcd_header::filter_signals(signal_pred pred, void *arg){
+    size_t kept = 0;
+    mod_vec_type::iterator out = top_modules.begin();
+    for(mod_vec_type::iterator i = top_modules.begin(), end = top_modules.end(); i != end; ++i){
+        const size_t k = (*i)->filter_signals(pred, arg);
+        if(k) *out++ = *i;
+        kept += k;
+    }
+    top_modules.erase(out, top_modules.end());
+    return kept;
+}
+
+//! get the arena that owns all modules and signals
+vcd_arena & vcd_header::get_arena()const{
+    return *arena;
+}
+
+//! serialize the header into arrays
+//
+//! Strings are interned, so a name shared by many modules is stored once.
+//! @param strings interned strings are stored
+//! @param modules modules are stored in breadth-first order
+//! @param signals signals are stored grouped by module
+//! @param p view of the arrays is stored, which is valid until the arrays are changed
+void vcd_header::pack(std::vector<char> &strings, std::vector<packed_module> &modules, std::vector<packed_signal> &signals, packed_header &p)const{
+    strings.clear();
+    modules.clear();
+    signals.clear();
+    //strings are looked up by the original strings, which do not move while packing
+    child_index interned;
+    struct pool{
+        std::vector<char> &strings;
+        child_index &interned;
+        uint32_t operator () (const string_view &s){
+            if(s.size() == 0) return 0;
+            uint32_t off;
+            if(!interned.find(NULL, s, off)){
+                assert(strings.size() + s.size() < UINT32_MAX);
+                off = strings.size();
+                strings.insert(strings.end(), &s[0], &s[0] + s.size());
+                interned.insert(NULL, s, off);
+            }
+            return off;
+        }
+    } intern = {strings, interned};
+    const string_view sections[] = {date, version, timescale, comment};
+    for(size_t i = 0; i < 4; ++i){
+        p.sections[i * 2] = intern(sections[i]);
+        p.sections[i * 2 + 1] = sections[i].size();
+    }
+    std::vector<const vcd_module *> order(top_modules.begin(), top_modules.end());
+    for(size_t i = 0; i < order.size(); ++i){
+        const vcd_module &mod = *order[i];
+        assert(order.size() + mod.num_sub_modules < UINT32_MAX && signals.size() + mod.num_signals < UINT32_MAX);
+        packed_module m;
+        m.name_off = intern(mod.name);
+        m.name_len = mod.name.size();
+        m.parent = UINT32_MAX;
+        m.first_child = order.size();
+        m.num_children = mod.num_sub_modules;
+        m.first_signal = signals.size();
+        m.num_signals = mod.num_signals;
+        modules.push_back(m);
+        for(uint32_t j = 0; j < mod.num_sub_modules; ++j){
+            order.push_back(mod.sub_modules[j]);
+        }
+        for(const vcd_signal *s = mod.signals, *end = mod.signals + mod.num_signals; s != end; ++s){
+            const string_view name = s->get_name(), symbol = s->get_symbol();
+            packed_signal ps;
+            ps.name_off = intern(name);
+            ps.symbol_off = intern(symbol);
+            ps.width = s->get_width();
+            ps.name_len = name.size();
+            ps.symbol_len = symbol.size();
+            ps.is_wire = s->is_wire ? 1 : 0;
+            signals.push_back(ps);
+        }
+    }
+    //parents are known after the indices of all modules are fixed
+    for(size_t i = 0; i < modules.size(); ++i){
+        for(uint32_t j = 0; j < modules[i].num_children; ++j){
+            modules[modules[i].first_child + j].parent = i;
+        }
+    }
+    p.strings = strings.empty() ? NULL : &strings.front();
+    p.strings_size = strings.size();
+    p.modules = modules.empty() ? NULL : &modules.front();
+    p.num_modules = modules.size();
+    p.num_tops = top_modules.size();
+    p.signals = signals.empty() ? NULL : &signals.front();
+    p.num_signals = signals.size();
+}
+
+//! check that the header fits in the offsets and lengths kept by the parser
+//
+//! The parser keeps offsets in 32 bits, identifier codes in 8 bits and references in 16 bits, and only asserts them.
+//! Only "$var" and "$end" are searched, and a $var is tokenized only if it is longer than an identifier code can be,
+//! so the check is much faster than parsing.
+//! @param name name of the VCD for the message
+//! @param all header string
+//! @param log stream for the message
+//! @return true if the header can be parsed
+bool check_header_limits(const char *name, const string_view &all, std::ostream &log){
+    if(all.size() > UINT32_MAX){
+        log << name << ": header is larger than 4 GB" << std::endl;
+        return false;
+    }
+    if(!all.size()) return true;
+    const char *const head = &all[0], *const tail = head + all.size();
+    const char *var = NULL;
+    for(const char *p = head; (p = static_cast<const char *>(std::memchr(p, '$', tail - p))); ++p){
+        if(p != head && !is_separator(p[-1])) continue;
+        const size_t left = tail - p;
+        if(left > 4 && !std::memcmp(p, "$var", 4) && is_separator(p[4])){
+            var = p;
+            continue;
+        }
+        if(!var || left < 4 || std::memcmp(p, "$end", 4) || (left > 4 && !is_separator(p[4]))) continue;
+        if(p - var > UINT8_MAX){
+            token_list toks(string_view(var, p + 4 - var));
+            size_t key, end;
+            if(toks.get_param(key, end) && key + 5 <= end && (toks[key + 3].size() > UINT8_MAX || toks.span(key + 4, end).size() > UINT16_MAX)){
+                log << name << ": identifier code longer than 255 Byte or reference longer than 64 KB at offset " << var - head << std::endl;
+                return false;
+            }
+        }
+        var = NULL;
+    }
+    return true;
+}
 
 //! parse VCD header
 //
+//! Warnings are written to std::cerr.
 //! @param all header string to be parsed
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+//! @param num_threads number of threads, 0 for the number of CPUs. Small headers are parsed by one thread.
 //! @return header information
-vcd_header * parse_vcd_header(const string_view &all){
-    string_view header_str = all;
-    vcd_header *const header = new vcd_header(header_str);
-    return header;
+vcd_header * parse_vcd_header(const string_view &all, bool hierarchy, unsigned int num_threads){
+    return parse_vcd_header(all, hierarchy, num_threads, std::cerr);
 }
 
+//! parse VCD header with a stream for warnings
+//
+//! @param all header string to be parsed
+//! @param hierarchy establish the hierarchy from the signal names while parsing
+//! @param num_threads number of threads, 0 for the number of CPUs. Small headers are parsed by one thread.
+//! @param log stream for warnings, such as the log of each file in batch mode
+//! @return header information
+vcd_header * parse_vcd_header(const string_view &all, bool hierarchy, unsigned int num_threads, std::ostream &log){
+    if(num_threads != 1 && all.size() >= 2 * parse_chunk_size){
+        return new vcd_header(all, hierarchy, num_threads, log);
+    }
+    token_list toks(all);
+    vcd_scratch scratch;
+    scratch.log = &log;
+    vcd_header *const header = new vcd_header(toks, all, hierarchy, scratch);
+    return header;
+}
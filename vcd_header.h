@@ -1,9 +1,12 @@
 #ifndef VCD_HEADER_H
 #define VCD_HEADER_H
-#include <map>
 #include <utility>
 #include <vector>
 #include <iosfwd>
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+#include <cassert>
 
 
 //! simple string-like class, 
@@ -22,10 +25,64 @@ class string_view{
     const char & operator[] (size_t)const;
     size_t size()const;
     typedef std::pair<string_view, string_view> param_pair_t;
-    param_pair_t get_param();
     string_view chomp()const;
 };
 
+//! constructor
+//
+//! The accessors are defined here to be inlined into the loops over the VCD body.
+//! @param s start pointer of memory fragment
+//! @param l length of the fragment
+inline string_view::string_view(const char *s, size_t l) : ptr(s), len(l){}
+
+//! default constructor (constructs empty string)
+inline string_view::string_view() : ptr(NULL), len(0){}
+
+//! access n'th element
+//
+//! @param idx offset from the start of the string
+//! @return reference of the element
+inline const char & string_view::operator[] (size_t idx)const{
+    assert(idx < len);
+    return ptr[idx];
+}
+
+//! get the length of the string
+//
+//! @return length in byte
+inline size_t string_view::size()const{
+    return len;
+}
+
+//! tokens in VCD header
+//
+//! The boundaries of tokens are found chunk by chunk ahead of parsing,
+//! so the parser does not scan the characters again.
+//! Only the tokens of the current chunk are kept to bound the memory.
+class token_list{
+    //! head of the tokenized string
+    const char *base;
+    //! length of the tokenized string
+    size_t len;
+    //! length of the string already tokenized
+    size_t scanned;
+    //! offsets of tokens from base. Even entries are the heads and odd entries are the ends.
+    std::vector<uint32_t> bounds;
+    //! index of the token at the head of bounds
+    size_t first;
+    //! index of the token to be read by the next get_param()
+    size_t cur;
+    bool fill();
+    public:
+    explicit token_list(const string_view &);
+    void reset(const string_view &);
+    bool has(size_t);
+    string_view operator[](size_t)const;
+    string_view span(size_t, size_t)const;
+    string_view raw_value(size_t, size_t)const;
+    bool get_param(size_t &, size_t &);
+};
+
 string_view get_line(const string_view &, size_t = 0);
 std::ostream & operator << (std::ostream &, const string_view &);
 
@@ -34,83 +91,268 @@ bool operator == (const string_view &, const char *);
 bool operator != (const char *, const string_view &);
 bool operator != (const string_view &, const char *);
 bool operator < (const string_view &, const string_view &);
+bool operator == (const string_view &, const string_view &);
+bool decode_id_code(const string_view &, uint64_t &);
+
+
+//! memory pool that owns all nodes of a vcd_header
+//
+//! Nodes are carved out of large blocks and released at once by the destructor,
+//! so destructors of the nodes are never called.
+//! Strings in the nodes are stored as 32-bit offsets from the source, which is usually the mapped header.
+class vcd_arena{
+    //! head of the source string
+    const char *source;
+    //! length of the source string
+    size_t source_len;
+    //! allocated blocks
+    std::vector<char *> blocks;
+    //! head of the free area in the current block
+    char *cur;
+    //! remaining size of the current block
+    size_t left;
+    //! total size of allocated blocks
+    size_t allocated;
+    //! number of allocate() calls
+    size_t num_allocs;
+    //! strings copied to the arena, which are referred by the offsets from source_len
+    std::vector<const char *> pooled;
+    vcd_arena(const vcd_arena &);
+    vcd_arena & operator = (const vcd_arena &);
+    public:
+    explicit vcd_arena(const string_view &);
+    ~vcd_arena();
+    void reset(const string_view &);
+    void *allocate(size_t);
+    void adopt(vcd_arena &);
+    uint32_t offset_of(const string_view &)const;
+    uint32_t store(const string_view &);
+    string_view str(uint32_t, size_t)const;
+    const string_view get_source()const;
+    size_t get_num_blocks()const;
+    size_t get_allocated_size()const;
+    size_t get_num_allocs()const;
+};
 
+void *operator new(size_t, vcd_arena &);
+void operator delete(void *, vcd_arena &);
+
+//! destination of the header string
+//
+//! The string can be appended to a vector, written to a raw buffer or just counted.
+//! Counting first gives the exact size, so the string can be written directly to its final place.
+class header_writer{
+    //! vector to be appended to, or NULL
+    std::vector<char> *vec;
+    //! buffer to be written to, or NULL
+    char *buf;
+    //! number of characters written so far
+    size_t pos;
+    //! head of the source that the output overwrites
+    const char *guard;
+    //! length of the source that the output overwrites
+    size_t guard_len;
+    //! true if a string in the source is read after the output passed it
+    bool overwritten;
+    public:
+    header_writer();
+    explicit header_writer(std::vector<char> &);
+    explicit header_writer(char *);
+    void set_guard(const string_view &);
+    void write(const char *, size_t);
+    void write(const string_view &);
+    void fill(char, size_t);
+    size_t size()const;
+    bool is_overwritten()const;
+};
 
 class vcd_header;
 class vcd_module;
+class hierarchy_builder;
+
+//! module of a serialized header, see vcd_header::pack()
+struct packed_module{
+    //! offset of the name in the strings
+    uint32_t name_off;
+    //! length of the name
+    uint32_t name_len;
+    //! index of the parent module, UINT32_MAX for a top module
+    uint32_t parent;
+    //! index of the first sub module
+    uint32_t first_child;
+    //! number of sub modules
+    uint32_t num_children;
+    //! index of the first signal
+    uint32_t first_signal;
+    //! number of signals
+    uint32_t num_signals;
+};
+
+//! signal of a serialized header, see vcd_header::pack()
+struct packed_signal{
+    //! offset of the name in the strings
+    uint32_t name_off;
+    //! offset of the symbol in the strings
+    uint32_t symbol_off;
+    //! bit width
+    uint32_t width;
+    //! length of the name
+    uint16_t name_len;
+    //! length of the symbol
+    uint8_t symbol_len;
+    //! 1 if wire, 0 if real
+    uint8_t is_wire;
+};
+
+//! serialized header
+//
+//! Modules are in breadth-first order, so top modules come first and the sub modules of a module are contiguous.
+//! Signals are grouped by module in the same order. Children keep the sorted order of the header.
+//! Names, symbols and sections are offsets into one buffer of interned strings.
+struct packed_header{
+    //! interned strings
+    const char *strings;
+    //! length of strings
+    size_t strings_size;
+    //! modules
+    const packed_module *modules;
+    //! number of modules
+    size_t num_modules;
+    //! number of top modules
+    size_t num_tops;
+    //! signals
+    const packed_signal *signals;
+    //! number of signals
+    size_t num_signals;
+    //! offsets and lengths of $date, $version, $timescale and $comment in strings
+    uint32_t sections[8];
+};
 
 //! signal in VCD file
+//
+//! Strings are stored as offsets from the source of vcd_arena of the parent module
+//! to keep this class 24 Byte.
 class vcd_signal{
     //! pointer to the module that contain this signal
     const vcd_module *parent;
+    //! offset of signal name
+    uint32_t name_off;
+    //! offset of symbol in VCD file
+    uint32_t symbol_off;
+    //! bit width of this signal
+    uint32_t width;
+    //! length of signal name
+    uint16_t name_len;
+    //! length of symbol
+    uint8_t symbol_len;
     //! true if this is wire
     bool is_wire;
-    //! bit width of this signal
-    string_view width;
-    //! symbol in VCD file
-    string_view symbol;
-    //! signal name
-    string_view name;
+    void init(const token_list &, size_t, size_t, const vcd_arena &);
+    friend class vcd_header;
     public:
-    vcd_signal(const string_view &, const vcd_module *);
-    const string_view &get_name()const;
-    const string_view &get_width()const;
-    const string_view &get_symbol()const;
+    vcd_signal(const token_list &, size_t, size_t, const vcd_module *);
+    vcd_signal(const token_list &, size_t, size_t, const vcd_arena &);
+    explicit vcd_signal(const packed_signal &);
+    string_view get_name()const;
+    uint32_t get_width()const;
+    string_view get_symbol()const;
     void set_name(const string_view &);
+    void set_symbol(const string_view &);
     void set_parent(const vcd_module *);
+    void write_full_path(header_writer &)const;
     void dump(std::ostream &, int)const;
     const vcd_module *get_parent()const;
     const char *get_type_str()const;
 };
 
+//! function to give a new symbol to a signal
+//
+//! The first argument is the current symbol and the second is the context.
+//! The returned string is copied to the arena.
+typedef string_view (*symbol_func)(const string_view &, void *);
+
+//! function to choose signals
+//
+//! The first argument is a signal and the second is the context.
+//! The signal is kept if true is returned.
+typedef bool (*signal_pred)(const vcd_signal &, void *);
+
+//! temporary storage shared by the modules under construction
+//
+//! Children of a module are collected here and copied to the arena
+//! as a sorted array when the module is completed.
+//! Keeping a scratch across vcd_header::reparse() calls reuses all of its memory.
+struct vcd_scratch{
+    //! signals of the modules under construction
+    std::vector<vcd_signal> signals;
+    //! sub modules of the modules under construction
+    std::vector<vcd_module *> modules;
+    //! builder of the hierarchy, created on the first use
+    hierarchy_builder *builder;
+    //! signals of a top module in the order of flatten()
+    std::vector<const vcd_signal *> flat;
+    //! buffers of the radix sort of flat
+    std::vector<std::pair<uint64_t, const vcd_signal *> > keyed, keyed_tmp;
+    //! stream for warnings of the parser, std::cerr by default
+    std::ostream *log;
+    vcd_scratch();
+    ~vcd_scratch();
+    private:
+    vcd_scratch(const vcd_scratch &);
+    vcd_scratch & operator = (const vcd_scratch &);
+};
+
 //! module (hierarchy unit) in VCD file
 class vcd_module{
-    //! type of map to manage sub modules
-    //! key is an instance name of module and value is a pointer to the sub module
-    typedef std::map<string_view, vcd_module *> mod_map_type;
-    //! iterator of mod_map_type
-    typedef mod_map_type::iterator mod_it;
-    //! const_iterator of mod_map_type
-    typedef mod_map_type::const_iterator mod_const_it;
-    //! type of map to manage signals
-    //! key is an instance name of signal and value is a pointer to the signal
-    typedef std::map<string_view, vcd_signal *> sig_map_type;
-    //! iterator of sig_map_type
-    typedef sig_map_type::iterator sig_it;
-    //! const_iterator of sig_map_type
-    typedef sig_map_type::const_iterator sig_const_it;
+    //! arena that owns this module
+    vcd_arena *arena;
     //! parent module of this module
     const vcd_module *parent;
     //! instance name of this module
     string_view name;
-    //! signals that belong to this module
-    sig_map_type signals;
-    //! sub modules that belong to this module
-    mod_map_type sub_modules;
-    vcd_module(const string_view &, const vcd_module *);
-    void make_hierarchy_internal();
-    vcd_signal & add_signal(const vcd_signal &);
-    void collect_signals(std::vector<const vcd_signal *> &)const;
+    //! signals that belong to this module, sorted by symbol
+    vcd_signal *signals;
+    //! sub modules that belong to this module, sorted by name
+    vcd_module **sub_modules;
+    //! number of signals
+    uint32_t num_signals;
+    //! number of sub modules
+    uint32_t num_sub_modules;
+    //! signals of this module and descendants in the order of flatten(), computed on demand
+    mutable const vcd_signal **flat_order;
+    //! number of signals in flat_order
+    mutable size_t num_flat_signals;
+    vcd_module(const string_view &, const vcd_module *, vcd_arena *);
+    void set_signals(const vcd_signal *, size_t);
+    void set_sub_modules(vcd_module *const *, size_t);
+    const vcd_signal *const *get_flat_order()const;
+    void make_flat_order(vcd_scratch &)const;
     public:
-    vcd_module(string_view &, const string_view &, vcd_module *);
-    ~vcd_module();
+    vcd_module(token_list &, size_t, size_t, vcd_module *, vcd_arena *, vcd_scratch &);
     const string_view &get_name()const;
-    vcd_module *make_hierarchy()const;
+    vcd_arena &get_arena()const;
     void dump(std::ostream &, int)const;
-    void to_str(std::vector<char> &, int, int)const;
-    void flatten(std::vector<char> &, int)const;
+    void to_str(header_writer &, int, int)const;
+    void flatten(header_writer &, int)const;
+    size_t get_indent_size(int)const;
     const vcd_module *get_parent()const;
+    size_t get_num_signals()const;
+    const vcd_signal &get_signal(size_t)const;
+    size_t get_num_sub_modules()const;
+    const vcd_module &get_sub_module(size_t)const;
+    void collect_signals(std::vector<const vcd_signal *> &)const;
+    void replace_symbols(symbol_func, void *);
+    size_t filter_signals(signal_pred, void *);
+    friend class hierarchy_builder;
+    friend class vcd_header;
 };
 
 //! header information of VCD
 class vcd_header{
-    //! map to manage top modules in VCD
-    //! key is an instance name of module and value is a pointer to the module
-    typedef std::map<string_view, vcd_module *> mod_map_type;
-    //! iterator of mod_map_type
-    typedef mod_map_type::iterator mod_it;
-    //! const_iterator of mod_map_type
-    typedef mod_map_type::const_iterator mod_const_it;
+    //! type of array to manage top modules in VCD, sorted by the instance name
+    typedef std::vector<vcd_module *> mod_vec_type;
+    //! const_iterator of mod_vec_type
+    typedef mod_vec_type::const_iterator mod_const_it;
     //! $data field of VCD header
     string_view date;
     //! $version field of VCD header
@@ -120,19 +362,48 @@ class vcd_header{
     //! $comment field of VCD header
     string_view comment;
     //! top modules
-    mod_map_type top_modules;
-    vcd_header();
+    mod_vec_type top_modules;
+    //! arena that owns all modules and signals
+    vcd_arena *arena;
+    vcd_header(const vcd_header &);
+    vcd_header & operator = (const vcd_header &);
+    void add_top_module(vcd_module *);
+    void parse(token_list &, bool, vcd_scratch &);
+    bool set_section(const string_view &, const string_view &);
+    void output_sections(header_writer &, int)const;
+    void output_comment(header_writer &, int)const;
     public:
-    explicit vcd_header(string_view &);
+    //! the most compact size level
+    static const int max_size_level = 4;
+    vcd_header(token_list &, const string_view &, bool);
+    vcd_header(token_list &, const string_view &, bool, vcd_scratch &);
+    vcd_header(const string_view &, bool, unsigned int, std::ostream &);
+    explicit vcd_header(const packed_header &);
     ~vcd_header();
-    vcd_header *make_hierarchy()const;
+    void reparse(token_list &, const string_view &, bool, vcd_scratch &);
+    void make_flat_order(vcd_scratch &)const;
+    void make_hierarchy();
     vcd_header *flatten()const;
     void dump(std::ostream &)const;
     void to_str(std::vector<char> &, int)const;
+    void to_str(header_writer &, int)const;
+    void nest_to_str(header_writer &, int, const string_view &, bool)const;
     void flatten(std::vector<char> &, int)const;
+    void flatten(header_writer &, int)const;
+    void get_sizes(bool, size_t *)const;
+    void get_signals(std::vector<const vcd_signal *> &)const;
+    const string_view &get_timescale()const;
+    size_t get_num_top_modules()const;
+    const vcd_module &get_top_module(size_t)const;
+    void replace_symbols(symbol_func, void *);
+    size_t filter_signals(signal_pred, void *);
+    vcd_arena &get_arena()const;
+    void pack(std::vector<char> &, std::vector<packed_module> &, std::vector<packed_signal> &, packed_header &)const;
 };
 
-vcd_header * parse_vcd_header(const string_view &);
+bool check_header_limits(const char *, const string_view &, std::ostream &);
+vcd_header * parse_vcd_header(const string_view &, bool = false, unsigned int = 1);
+vcd_header * parse_vcd_header(const string_view &, bool, unsigned int, std::ostream &);
 
 
 #endif
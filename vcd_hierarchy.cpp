@@ -1,9 +1,13 @@
+#include <fcntl.h>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -12,102 +16,362 @@
 
 #include "mmap_manager.h"
 #include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_compact.h"
+#include "vcd_filter.h"
+#include "task_pool.h"
+#include "vcd_stats.h"
+#include "vcd_index.h"
+#include "vcd_query.h"
+#include "vcd_slice.h"
+#include "vcd_activity.h"
+#include "vcd_columnar.h"
+#include "vcd_merge.h"
+#include "vcd_split.h"
 
 namespace{
 
-//! count the size of VCD header in Byte
-//
-//! @param filename VCD file
-//! @return size of VCD header
-size_t get_vcd_header_size(const char *filename){
-    std::ifstream ifs(filename);
-    if(!ifs){
-        std::cerr << "Failed to open " << filename << std::endl;
-        std::abort();
-    }
-    size_t size = 0;
-    for(std::string line; ifs && std::getline(ifs, line); ){
-        if (line.find("$enddefinitions") != std::string::npos) {
-            return size;
-        }
-        size += line.size() + 1; //+1 is a sizeof('\n')
-    }
-    assert(!"Failed to read header");
-}
-
-//! RAII idiom for File descriptor
-struct fp_raii{
-    std::FILE *const fp;
-    explicit fp_raii(FILE *f) : fp(f){}
-    ~fp_raii(){if(fp) std::fclose(fp);}
-    operator std::FILE *()const{return fp;}
+//! options applied to each VCD file
+struct options{
+    //! true to remove the hierarchy
+    bool flatten;
+    //! true to compact the header until it fits in place
+    bool fit;
+    //! true to compact the body of the output file
+    bool compact;
+    //! true to load the header from the index, or to write the index after parsing
+    bool index;
+    //! number of threads to parse a header, 0 for the number of CPUs
+    unsigned int num_threads;
+    //! output filename, empty to modify the file in-place
+    std::string output_file;
+    //! glob patterns of signals to be kept, all signals are kept if empty
+    std::vector<std::string> keep;
+    //! glob patterns of signals to be dropped
+    std::vector<std::string> drop;
+    //! query of the hierarchy, 0 for none, 1 for --list and 2 for --find
+    int query;
+    //! pattern of --list or --find
+    std::string query_pattern;
+    //! true to print the number of matching signals instead of the signals
+    bool count;
+    //! true to write the value changes between from and to
+    bool slice;
+    //! first time of the slice
+    uint64_t from;
+    //! last time of the slice
+    uint64_t to;
+    //! true to count the value changes of each signal and scope
+    bool activity;
+    //! number of the busiest signals reported by --activity
+    size_t activity_top;
+    //! true to write the value changes as a columnar store
+    bool columnar;
+    //! true to merge the input files into the output
+    bool merge;
+    //! top modules of the merged files, named after the files if empty
+    std::vector<std::string> merge_scopes;
+    //! outputs of --split, each of which has the signals of a scope
+    std::vector<split_spec> split;
+    //! depth of the scopes split into the outputs named after --output, 0 for none
+    size_t split_depth;
+    options() : flatten(false), fit(false), compact(false), index(false), num_threads(0), query(0), count(false), slice(false), from(0), to(UINT64_MAX), activity(false), activity_top(20), columnar(false), merge(false), split_depth(0){}
 };
 
-//! Open File in create mode and write the whole data
+//! write a new VCD from a VCD compressed by gzip
 //
-//! @param orig_vcd Original VCD filename
-//! @param output_file New VCD file
-//! @param v header information
-//! @param header_size size of vcd header
-int make_new_file_and_write(const char *orig_vcd, const char *output_file, const std::vector<char> &v, size_t header_size){
-    fp_raii ofp(std::fopen(output_file, "w"));
-    if(!ofp){
-        perror(output_file);
+//! The header is decompressed only as far as "$enddefinitions" and parsed from the buffer.
+//! The rest of the body is decompressed while it is written, and compressed again if the output name ends with ".gz".
+//! @param vcd_filename VCD file compressed by gzip
+//! @param opt options
+//! @param log stream for messages
+//! @param stats time of each phase and memory usage of the header are recorded
+//! @return 0 if succeeded
+int process_gzip_file(const char *vcd_filename, const options &opt, std::ostream &log, file_stats &stats){
+    if(opt.compact || opt.index || opt.slice || opt.activity || opt.columnar || !opt.split.empty() || opt.split_depth || !opt.keep.empty() || !opt.drop.empty()){
+        log << vcd_filename << ": --compact, --index, --from, --to, --activity, --export-columnar, --split, --split-at, --keep and --drop cannot read compressed VCD" << std::endl;
         return -1;
     }
-    fp_raii ifp(std::fopen(orig_vcd, "r"));
-    if(!ifp){
-        perror(orig_vcd);
+    if(opt.output_file.empty()){
+        log << vcd_filename << ": compressed VCD cannot be modified in-place, please add --output option" << std::endl;
         return -1;
     }
-    for(size_t written = 0; written < v.size(); ){
-        written += std::fwrite(&v.front() + written, 1, v.size() - written, ofp);
+    stats.start("scan");
+    fd_raii fd(open(vcd_filename, O_RDONLY));
+    if(fd < 0){
+        log << vcd_filename << ": " << std::strerror(errno) << std::endl;
+        return -1;
     }
-    std::vector<unsigned char> buf(1024 * 1024);
-    if(std::fseek(ifp, header_size, SEEK_SET)){
-        perror(orig_vcd);
+    gz_reader reader(fd);
+    std::vector<char> buf;
+    size_t header_size;
+    if(!read_gzip_header(reader, buf, header_size)){
+        if(reader.get_error()) log << vcd_filename << ": " << std::strerror(reader.get_error()) << std::endl;
+        else log << vcd_filename << ": $enddefinitions is not found" << std::endl;
         return -1;
     }
-    while(!std::feof(ifp)){
-        size_t copied;
-        for(copied = 0; copied < buf.size() && !std::feof(ifp); ){
-            copied += std::fread(&buf.front() + copied, 1, buf.size() - copied, ifp);
+    if(!check_header_limits(vcd_filename, string_view(&buf.front(), header_size), log)) return -1;
+    stats.start("parse");
+    vcd_header *const header = parse_vcd_header(string_view(&buf.front(), header_size), !opt.flatten, opt.num_threads, log);
+    const vcd_arena &arena = header->get_arena();
+    stats.set_arena(arena.get_num_allocs(), arena.get_num_blocks(), arena.get_allocated_size());
+    stats.start("write");
+    std::vector<char> v;
+    header_writer w(v);
+    write_header(*header, w, opt.flatten, 0);
+    delete header;
+    log << "Header size " << header_size << " -> " << v.size() << std::endl;
+    return make_new_file_streamed(vcd_filename, opt.output_file.c_str(), v, header_size, opt.num_threads, &reader, buf);
+}
+
+//! modify the header of a VCD file
+//
+//! @param vcd_filename VCD file to be modified
+//! @param opt options
+//! @param log stream for messages
+//! @param stats time of each phase and memory usage of the header are recorded
+//! @return 0 if succeeded
+int process_file(const char *vcd_filename, const options &opt, std::ostream &log, file_stats &stats){
+    if(is_gzip_file(vcd_filename)) return process_gzip_file(vcd_filename, opt, log, stats);
+    stats.start("scan");
+    //only the header modified in-place is written through the mapping
+    const bool inplace = opt.output_file.empty() && !opt.query && !opt.count && !opt.activity && opt.split.empty() && !opt.split_depth;
+    mmap_manager vcd_file(vcd_filename, inplace ? mmap_manager::read_write : mmap_manager::read_only, header_scan_window, mmap_manager::sequential);
+    if(vcd_file.get_error()){
+        log << vcd_filename << ": " << std::strerror(vcd_file.get_error()) << std::endl;
+        return -1;
+    }
+    //the header loaded from the index refers to the strings in the index
+    const std::string index_file = get_index_name(vcd_filename);
+    const vcd_index index(opt.index ? index_file.c_str() : NULL);
+    vcd_header *header = NULL;
+    size_t header_size;
+    if(opt.index){
+        stats.start("load");
+        header = index.load(vcd_file, !opt.flatten, header_size, log);
+        if(header) log << "Header is loaded from " << index_file << std::endl;
+    }
+    if(!header){
+        if(opt.index) stats.start("scan");
+        if(!get_vcd_header_size(vcd_file, header_size)){
+            log << vcd_filename << ": $enddefinitions is not found" << std::endl;
+            return -1;
+        }
+        const string_view all(static_cast<const char *>(vcd_file.get_ptr()), header_size);
+        if(!check_header_limits(vcd_filename, all, log)) return -1;
+        //the hierarchy is established while parsing
+        stats.start("parse");
+        header = parse_vcd_header(all, !opt.flatten, opt.num_threads, log);
+        //an index of the header modified in-place would be out of date at once
+        if(opt.index && (!opt.output_file.empty() || opt.query || opt.count || opt.activity)){
+            stats.start("index");
+            if(write_index(index_file.c_str(), *header, all, !opt.flatten) == 0) log << "Index is written to " << index_file << std::endl;
+        }
+    }
+    const string_view all(static_cast<const char *>(vcd_file.get_ptr()), header_size);
+    const vcd_arena &arena = header->get_arena();
+    stats.set_arena(arena.get_num_allocs(), arena.get_num_blocks(), arena.get_allocated_size());
+    //header->dump(std::cout);
+    //queries only read the header
+    if(opt.query || opt.count){
+        stats.start("query");
+        size_t num_modules;
+        const size_t n = query_signals(*header, opt.query_pattern, opt.query != 2, opt.count ? NULL : &std::cout, num_modules);
+        if(opt.count) std::cout << n << " signals in " << num_modules << " modules" << std::endl;
+        delete header;
+        return 0;
+    }
+    if(opt.activity){
+        stats.start("activity");
+        const int ret = report_activity(vcd_filename, *header, header_size, opt.activity_top, opt.num_threads, std::cout, log);
+        delete header;
+        return ret;
+    }
+    if(opt.slice){
+        stats.start("slice");
+        const int ret = make_slice_file(vcd_filename, opt.output_file.c_str(), *header, all, opt.flatten, opt.from, opt.to, opt.index, opt.num_threads, log);
+        delete header;
+        return ret;
+    }
+    if(!opt.split.empty() || opt.split_depth){
+        stats.start("split");
+        std::vector<split_spec> specs(opt.split);
+        if(opt.split_depth) get_split_specs(*header, opt.split_depth, opt.output_file, specs);
+        const int ret = make_split_files(vcd_filename, *header, header_size, specs, opt.flatten, opt.num_threads, log);
+        delete header;
+        return ret;
+    }
+    const bool filter = !opt.keep.empty() || !opt.drop.empty();
+    if(filter){
+        stats.start("select");
+        std::vector<const vcd_signal *> sigs;
+        header->get_signals(sigs);
+        const size_t kept = select_signals(*header, opt.keep, opt.drop);
+        log << "Kept " << kept << " of " << sigs.size() << " signals" << std::endl;
+    }
+    if(opt.columnar){
+        stats.start("export");
+        const int ret = export_columnar(vcd_filename, opt.output_file.c_str(), *header, !opt.flatten, header_size, log);
+        delete header;
+        return ret;
+    }
+    if(opt.compact || filter){
+        //the body is rewritten, so the header is written at size level 0 like --output
+        stats.start(opt.compact ? "compact" : "filter");
+        const int ret = opt.compact ?
+            make_compact_file(vcd_filename, opt.output_file.c_str(), *header, opt.flatten, 0, header_size, opt.num_threads, log) :
+            make_filtered_file(vcd_filename, opt.output_file.c_str(), *header, opt.flatten, 0, header_size, opt.num_threads, log);
+        delete header;
+        return ret;
+    }
+    //the size level is chosen from the exact sizes without writing the header
+    stats.start("size");
+    size_t sizes[vcd_header::max_size_level + 1];
+    header->get_sizes(opt.flatten, sizes);
+    int level = 0;
+    for(int i = 0; opt.fit && opt.output_file.empty() && i <= vcd_header::max_size_level; ++i){
+        if(sizes[i] <= header_size){
+            level = i;
+            break;
         }
-        for(size_t written = 0; written < copied; ){
-            written += std::fwrite(&buf.front() + written, 1, copied - written, ofp);
+    }
+    log << "Header size " << std::dec << header_size << " -> " << sizes[level];
+    if(level > 0) log << " (size level " << level << ")";
+    log << std::endl;
+    stats.start("write");
+    int ret;
+    if(!opt.output_file.empty()){
+        std::vector<char> v;
+        v.reserve(sizes[level]);
+        header_writer w(v);
+        write_header(*header, w, opt.flatten, level);
+        ret = is_gzip_name(opt.output_file.c_str()) ?
+            make_new_file_streamed(vcd_filename, opt.output_file.c_str(), v, header_size, opt.num_threads, NULL, std::vector<char>()) :
+            make_new_file_and_write(vcd_filename, opt.output_file.c_str(), v, header_size);
+    }
+    else if(sizes[level] <= header_size){
+        header_writer counter;
+        counter.set_guard(all);
+        write_header(*header, counter, opt.flatten, level);
+        assert(counter.size() == sizes[level]);
+        ret = inplace_mod(vcd_file.get_ptr(), *header, opt.flatten, level, counter.size(), counter.is_overwritten(), header_size);
+        vcd_file.mark_dirty(0, header_size);
+    }
+    else{
+        //the header must be rendered before inserting space because it refers to the mapped header
+        std::vector<char> v;
+        v.reserve(sizes[level]);
+        header_writer w(v);
+        write_header(*header, w, opt.flatten, level);
+        ret = grow_mod(vcd_file, vcd_filename, v, header_size, log);
+        if(ret){
+            log
+                << "Could not complete. Because modified header cannot be smaller than the original one.\n"
+                << "Please add --output option" << std::endl;
         }
     }
-    return 0;
+    delete header;
+    return ret;
+}
+
+//! files processed in batch mode
+struct batch{
+    //! options applied to all files
+    const options *opt;
+    //! VCD files
+    std::vector<std::string> files;
+    //! messages for each file
+    std::vector<std::string> logs;
+    //! result of each file
+    std::vector<int> results;
+    //! statistics of each file
+    std::vector<file_stats> stats;
+};
 
+//! process a file of the batch, called by the workers
+//
+//! @param idx index of the file
+//! @param arg batch
+void process_batch_file(size_t idx, void *arg){
+    batch &b = *static_cast<batch *>(arg);
+    std::ostringstream log;
+    b.stats[idx].set_file(b.files[idx], true);
+    b.results[idx] = process_file(b.files[idx].c_str(), *b.opt, log, b.stats[idx]);
+    //the file is unmapped and synchronized in the last phase
+    b.stats[idx].stop();
+    b.logs[idx] = log.str();
 }
 
-//! update the header in-place
+//! read filenames, one per line
 //
-//! @param dst start point of VCD to be modified
-//! @param v_ data to be written
-//! @param header_size VCD header size
-int inplace_mod(void *dst, const std::vector<char> &v_, size_t header_size){
-    std::vector<char> v = v_;
-    const unsigned int fill_unit = 80;
-    for(size_t cur = v.size(); cur < header_size; cur += fill_unit + 1){
-        const unsigned int fill_size = std::min<unsigned int>(fill_unit + 1, header_size - cur);
-        v.insert(v.end(), fill_size - 1, ' ');
-        if(fill_size) v.push_back('\n');
-    }
-    assert(header_size == v.size());
-    std::memcpy(dst, &v.front(), v.size());
-    return 0;
+//! @param list_file file that lists VCD files, "-" for the standard input
+//! @param files filenames are appended
+//! @return false if the list cannot be read
+bool read_file_list(const char *list_file, std::vector<std::string> &files){
+    std::ifstream ifs;
+    if(std::strcmp(list_file, "-") != 0){
+        ifs.open(list_file);
+        if(!ifs) return false;
+    }
+    std::istream &is = ifs.is_open() ? static_cast<std::istream &>(ifs) : std::cin;
+    for(std::string line; std::getline(is, line); ){
+        if(!line.empty()) files.push_back(line);
+    }
+    return true;
 }
- 
+
+//! parse the time of --from or --to
+//
+//! @param s decimal number in the unit of $timescale
+//! @param t the time is stored
+//! @return false if s is not a number
+bool parse_time_option(const char *s, uint64_t &t){
+    if(*s < '0' || '9' < *s) return false;
+    errno = 0;
+    char *end;
+    const unsigned long long v = std::strtoull(s, &end, 10);
+    if(*end || errno) return false;
+    t = v;
+    return true;
+}
+
 } //end of unnamed namespace
 
 int main(int argc, char *argv[]){
-    bool flatten = false;
-    std::string output_file;
+    const double start_time = get_monotonic_time();
+    options opt;
+    unsigned int num_jobs = 1;
+    bool batch_mode = false;
+    bool threads_given = false;
+    //0 for no statistics, 1 for text, 2 for JSON
+    int stats_mode = 0;
+    batch b;
     for(;;){
         struct option long_options[] = {
             {"flatten", 0, NULL, 0},
             {"output", 1, NULL, 1},
+            {"fit", 0, NULL, 2},
+            {"jobs", 1, NULL, 3},
+            {"files-from", 1, NULL, 4},
+            {"threads", 1, NULL, 5},
+            {"compact", 0, NULL, 6},
+            {"keep", 1, NULL, 7},
+            {"drop", 1, NULL, 8},
+            {"stats", 2, NULL, 9},
+            {"index", 0, NULL, 10},
+            {"list", 1, NULL, 11},
+            {"find", 1, NULL, 12},
+            {"count", 0, NULL, 13},
+            {"from", 1, NULL, 14},
+            {"to", 1, NULL, 15},
+            {"activity", 2, NULL, 16},
+            {"export-columnar", 0, NULL, 17},
+            {"merge", 0, NULL, 18},
+            {"merge-scope", 1, NULL, 19},
+            {"split", 1, NULL, 20},
+            {"split-at", 1, NULL, 21},
             {0, 0, 0, 0}
         };
         int opt_idx = -1;
@@ -115,10 +379,94 @@ int main(int argc, char *argv[]){
         if(c == -1) break;
         switch(opt_idx){
             case 0:
-                flatten = true;
+                opt.flatten = true;
                 break;
             case 1:
-                output_file = optarg;
+                opt.output_file = optarg;
+                break;
+            case 2:
+                opt.fit = true;
+                break;
+            case 3:
+                num_jobs = std::strtoul(optarg, NULL, 10);
+                batch_mode = true;
+                break;
+            case 4:
+                if(!read_file_list(optarg, b.files)){
+                    std::cerr << "Failed to read " << optarg << std::endl;
+                    return -1;
+                }
+                batch_mode = true;
+                break;
+            case 5:
+                opt.num_threads = std::strtoul(optarg, NULL, 10);
+                threads_given = true;
+                break;
+            case 6:
+                opt.compact = true;
+                break;
+            case 7:
+                opt.keep.push_back(optarg);
+                break;
+            case 8:
+                opt.drop.push_back(optarg);
+                break;
+            case 9:
+                if(optarg && std::strcmp(optarg, "json") != 0){
+                    std::cerr << "unknown format of --stats: " << optarg << std::endl;
+                    return -1;
+                }
+                stats_mode = optarg ? 2 : 1;
+                break;
+            case 10:
+                opt.index = true;
+                break;
+            case 11:
+            case 12:
+                if(opt.query){
+                    std::cerr << "only one of --list and --find can be given" << std::endl;
+                    return -1;
+                }
+                opt.query = opt_idx == 11 ? 1 : 2;
+                opt.query_pattern = optarg;
+                break;
+            case 13:
+                opt.count = true;
+                break;
+            case 14:
+            case 15:
+                if(!parse_time_option(optarg, opt_idx == 14 ? opt.from : opt.to)){
+                    std::cerr << "time of --" << long_options[opt_idx].name << " must be a decimal number: " << optarg << std::endl;
+                    return -1;
+                }
+                opt.slice = true;
+                break;
+            case 16:
+                opt.activity = true;
+                if(optarg) opt.activity_top = std::strtoul(optarg, NULL, 10);
+                break;
+            case 17:
+                opt.columnar = true;
+                break;
+            case 18:
+                opt.merge = true;
+                break;
+            case 19:
+                opt.merge_scopes.push_back(optarg);
+                break;
+            case 20:
+                opt.split.push_back(split_spec());
+                if(!parse_split_spec(optarg, opt.split.back())){
+                    std::cerr << "--split must be SCOPE=FILE: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 21:
+                opt.split_depth = std::strtoul(optarg, NULL, 10);
+                if(!opt.split_depth){
+                    std::cerr << "depth of --split-at must be a positive number: " << optarg << std::endl;
+                    return -1;
+                }
                 break;
             default:
                 std::cerr << "unknown option " << std::endl;
@@ -126,49 +474,99 @@ int main(int argc, char *argv[]){
                 break;
         }
     }
-    if(optind >= argc){
+    for(int i = optind; i < argc; ++i){
+        b.files.push_back(argv[i]);
+    }
+    if(b.files.empty()){
         std::cerr << "Input file is not specified" << std::endl;
         return -1;
     }
-    const char *vcd_filename = argv[optind];
-
-    const size_t header_size = get_vcd_header_size(vcd_filename);
-    mmap_manager vcd_file(vcd_filename, true, header_size);
-
-    string_view all(static_cast<const char *>(vcd_file.get_ptr()), vcd_file.get_size());
-    vcd_header *const orig = parse_vcd_header(all);
-    //orig->dump(std::cout);
-    if(flatten){
-        for(int level = 0; level < 1; ++level){
-            std::vector<char> v;
-            orig->flatten(v, level);
-            std::cerr << "Header size " << std::dec << header_size << " -> " << v.size() << std::endl;
-            if(!output_file.empty()){
-                return make_new_file_and_write(vcd_filename, output_file.c_str(), v, header_size);
-            }
-            else if(v.size() <= header_size){
-                return inplace_mod(vcd_file.get_ptr(), v, header_size);
-            }
+    if(!opt.merge_scopes.empty() && (!opt.merge || opt.merge_scopes.size() != b.files.size())){
+        std::cerr << "--merge-scope needs --merge and must be given for every input file" << std::endl;
+        return -1;
+    }
+    if(opt.merge){
+        if(opt.output_file.empty() || batch_mode || opt.flatten || opt.fit || opt.compact || opt.index || !opt.keep.empty() || !opt.drop.empty() || opt.query || opt.count || opt.slice || opt.activity || opt.columnar || !opt.split.empty() || opt.split_depth){
+            std::cerr << "--merge needs --output and cannot be used with other modes or --jobs, --files-from, --flatten, --fit or --index" << std::endl;
+            return -1;
         }
- 
+        b.stats.resize(1);
+        b.stats.front().set_file(opt.output_file, false);
+        b.stats.front().start("merge");
+        const int ret = merge_files(b.files, opt.merge_scopes, opt.output_file.c_str(), opt.num_threads, std::cerr);
+        b.stats.front().stop();
+        if(stats_mode) write_run_stats(stats_mode == 2 ? std::cout : std::cerr, b.stats, get_monotonic_time() - start_time, stats_mode == 2);
+        return ret;
     }
-    else{
-        vcd_header *const hier = orig->make_hierarchy();
-        //hier->dump(std::cout);
-        for(int level = 0; level < 1; ++level){
-            std::vector<char> v;
-            hier->to_str(v, level);
-            std::cerr << "Header size " << std::dec << header_size << " -> " << v.size() << std::endl;
-            if(!output_file.empty()){
-                return make_new_file_and_write(vcd_filename, output_file.c_str(), v, header_size);
-            }
-            else if(v.size() <= header_size){
-                return inplace_mod(vcd_file.get_ptr(), v, header_size);
-            }
+    if(opt.compact && opt.output_file.empty()){
+        std::cerr << "--compact needs --output" << std::endl;
+        return -1;
+    }
+    if((!opt.keep.empty() || !opt.drop.empty()) && opt.output_file.empty()){
+        std::cerr << "--keep and --drop need --output" << std::endl;
+        return -1;
+    }
+    if(opt.activity && (opt.query || opt.count)){
+        std::cerr << "--activity cannot be used with --list, --find or --count" << std::endl;
+        return -1;
+    }
+    if((opt.query || opt.count || opt.activity) && (batch_mode || b.files.size() != 1 || !opt.output_file.empty() || opt.compact || opt.fit || !opt.keep.empty() || !opt.drop.empty())){
+        std::cerr << "--list, --find, --count and --activity take only one file and cannot be used with options that write a file" << std::endl;
+        return -1;
+    }
+    if(opt.slice && (opt.output_file.empty() || opt.compact || opt.fit || !opt.keep.empty() || !opt.drop.empty() || opt.query || opt.count)){
+        std::cerr << "--from and --to need --output and cannot be used with --compact, --fit, --keep, --drop or queries" << std::endl;
+        return -1;
+    }
+    if(opt.columnar && (opt.output_file.empty() || opt.compact || opt.fit || opt.slice || opt.activity || opt.query || opt.count)){
+        std::cerr << "--export-columnar needs --output and cannot be used with --compact, --fit, --from, --to, --activity or queries" << std::endl;
+        return -1;
+    }
+    if(!opt.split.empty() || opt.split_depth){
+        if((!opt.split.empty() && opt.split_depth) || opt.output_file.empty() != !opt.split_depth){
+            std::cerr << "either --split or --split-at must be given, and only --split-at takes --output as the name of the outputs" << std::endl;
+            return -1;
+        }
+        if(batch_mode || b.files.size() != 1 || opt.fit || opt.compact || !opt.keep.empty() || !opt.drop.empty() || opt.query || opt.count || opt.slice || opt.activity || opt.columnar){
+            std::cerr << "--split and --split-at take only one file and cannot be used with other modes or --fit" << std::endl;
+            return -1;
+        }
+    }
+    if(opt.from > opt.to){
+        std::cerr << "--from must not be later than --to" << std::endl;
+        return -1;
+    }
+    if(!batch_mode && b.files.size() == 1){
+        b.stats.resize(1);
+        b.stats.front().set_file(b.files.front(), false);
+        const int ret = process_file(b.files.front().c_str(), opt, std::cerr, b.stats.front());
+        b.stats.front().stop();
+        if(stats_mode) write_run_stats(stats_mode == 2 ? std::cout : std::cerr, b.stats, get_monotonic_time() - start_time, stats_mode == 2);
+        return ret;
+    }
+    if(!opt.output_file.empty()){
+        std::cerr << "--output cannot be used with multiple files" << std::endl;
+        return -1;
+    }
+    //files are already processed concurrently
+    if(!threads_given) opt.num_threads = 1;
+
+    //each worker parses its own files, messages are reported in the order of the files
+    b.opt = &opt;
+    b.logs.resize(b.files.size());
+    b.results.resize(b.files.size());
+    b.stats.resize(b.files.size());
+    run_tasks(num_jobs, b.files.size(), process_batch_file, &b);
+    size_t num_failed = 0;
+    for(size_t i = 0; i < b.files.size(); ++i){
+        std::cerr << b.files[i] << ": " << (b.results[i] ? "FAILED" : "OK") << "\n";
+        std::istringstream log(b.logs[i]);
+        for(std::string line; std::getline(log, line); ){
+            std::cerr << "    " << line << "\n";
         }
+        if(b.results[i]) ++num_failed;
     }
-    std::cerr
-        << "Could not complete. Because modified header cannot be smaller than the original one.\n"
-        << "Please add --output option" << std::endl;
-    return 0;
+    std::cerr << b.files.size() << " files, " << num_failed << " failed" << std::endl;
+    if(stats_mode) write_run_stats(stats_mode == 2 ? std::cout : std::cerr, b.stats, get_monotonic_time() - start_time, stats_mode == 2);
+    return num_failed ? 1 : 0;
 }
@@ -0,0 +1,280 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <stdint.h> //SIZE_MAX
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_index.h"
+
+namespace{
+
+//! magic number at the head of an index
+const char index_magic[8] = {'V', 'C', 'D', 'I', 'D', 'X', '\n', '\0'};
+//! written as is to detect an index of another byte order
+const uint32_t index_byte_order = 0x01020304;
+//! format version of the index
+const uint32_t index_version = 1;
+
+//! head of an index, followed by the modules, the signals and the strings
+struct index_file_header{
+    //! index_magic
+    char magic[8];
+    //! index_byte_order
+    uint32_t byte_order;
+    //! index_version
+    uint32_t version;
+    //! size of the VCD header, which is the byte range from the head of the VCD
+    uint64_t header_size;
+    //! hash_header() of the VCD header
+    uint64_t header_hash;
+    //! 1 if the hierarchy was established from the signal names
+    uint32_t hierarchy;
+    //! number of top modules
+    uint32_t num_tops;
+    //! number of modules
+    uint64_t num_modules;
+    //! number of signals
+    uint64_t num_signals;
+    //! length of the strings
+    uint64_t strings_size;
+    //! offsets and lengths of $date, $version, $timescale and $comment in the strings
+    uint32_t sections[8];
+};
+
+//! rotate left
+inline uint64_t rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+//! final mix of MurmurHash3
+inline uint64_t fmix(uint64_t h){
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//! check if a string is in the strings of an index
+inline bool in_strings(uint64_t off, uint64_t len, uint64_t strings_size){
+    return off <= strings_size && len <= strings_size - off;
+}
+
+//! check the records of an index
+//
+//! @param h head of the index
+//! @param file_size size of the index
+//! @param p view of the records
+//! @return false if the index is broken
+bool check_records(const index_file_header &h, size_t file_size, const packed_header &p){
+    const uint64_t records = sizeof(h) + h.num_modules * sizeof(packed_module) + h.num_signals * sizeof(packed_signal);
+    if(h.num_modules > file_size || h.num_signals > file_size) return false;
+    if(records + h.strings_size != file_size) return false;
+    return check_packed_header(p);
+}
+
+//! check if the line at the end of the header starts with "$enddefinitions"
+//
+//! @param p head of the line
+//! @param len length available at p
+bool is_enddefinitions_line(const char *p, size_t len){
+    static const char keyword[] = "$enddefinitions";
+    const size_t keyword_len = sizeof(keyword) - 1;
+    size_t i = 0;
+    while(i < len && (p[i] == ' ' || p[i] == '\t')) ++i;
+    return len - i >= keyword_len && std::memcmp(p + i, keyword, keyword_len) == 0;
+}
+
+} //end of unnamed namespace
+
+//! check the records of a serialized header read from a file
+//
+//! Children and signals must be assigned in breadth-first order as vcd_header::pack() does,
+//! so every module except the top modules is a child of exactly one module and the tree has no cycle.
+//! @param p view of the records, whose arrays and strings are in the file
+//! @return false if the records are broken
+bool check_packed_header(const packed_header &p){
+    if(p.strings_size >= UINT32_MAX || p.num_tops > p.num_modules) return false;
+    for(size_t i = 0; i < 4; ++i){
+        if(!in_strings(p.sections[i * 2], p.sections[i * 2 + 1], p.strings_size)) return false;
+    }
+    uint64_t next_child = p.num_tops, next_signal = 0;
+    for(size_t i = 0; i < p.num_modules; ++i){
+        const packed_module &m = p.modules[i];
+        if(!in_strings(m.name_off, m.name_len, p.strings_size)) return false;
+        if(m.first_child != next_child || m.first_signal != next_signal) return false;
+        if(i < p.num_tops ? m.parent != UINT32_MAX : m.parent >= i) return false;
+        next_child += m.num_children;
+        next_signal += m.num_signals;
+        if(next_child > p.num_modules || next_signal > p.num_signals) return false;
+        for(uint32_t j = 0; j < m.num_children; ++j){
+            if(p.modules[m.first_child + j].parent != i) return false;
+        }
+    }
+    if(next_child != p.num_modules || next_signal != p.num_signals) return false;
+    for(size_t i = 0; i < p.num_signals; ++i){
+        const packed_signal &s = p.signals[i];
+        if(!in_strings(s.name_off, s.name_len, p.strings_size) || !in_strings(s.symbol_off, s.symbol_len, p.strings_size)) return false;
+    }
+    return true;
+}
+
+//! get the name of the index of a VCD
+//
+//! @param vcd_filename VCD file
+//! @return name of the sidecar file
+std::string get_index_name(const char *vcd_filename){
+    return std::string(vcd_filename) + ".idx";
+}
+
+//! hash the VCD header to detect changes
+//
+//! 8 Byte are mixed at a time, so hashing is much faster than parsing.
+//! @param p head of the header
+//! @param len length of the header
+//! @return 64-bit hash
+uint64_t hash_header(const char *p, size_t len){
+    const uint64_t m1 = 0x87c37b91114253d5ULL, m2 = 0x4cf57a0f2a1d1e3bULL;
+    uint64_t h = len * m2;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8){
+        uint64_t w;
+        std::memcpy(&w, p + i, sizeof(w));
+        h = rotl(h ^ (rotl(w * m1, 31) * m2), 27) * 5 + 0x52dce729;
+    }
+    uint64_t w = 0;
+    if(i < len) std::memcpy(&w, p + i, len - i);
+    h ^= rotl(w * m1, 31) * m2;
+    return fmix(h);
+}
+
+//! write the index of a VCD header
+//
+//! The index is written to a temporary file and renamed, so a reader never sees a partial index.
+//! @param index_file name of the index
+//! @param header header parsed from header_text
+//! @param header_text header of the VCD, whose size and hash are recorded
+//! @param hierarchy true if the hierarchy of header was established from the signal names
+//! @return 0 if succeeded
+int write_index(const char *index_file, const vcd_header &header, const string_view &header_text, bool hierarchy){
+    std::vector<char> strings;
+    std::vector<packed_module> modules;
+    std::vector<packed_signal> signals;
+    packed_header p;
+    header.pack(strings, modules, signals, p);
+    index_file_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, index_magic, sizeof(h.magic));
+    h.byte_order = index_byte_order;
+    h.version = index_version;
+    h.header_size = header_text.size();
+    h.header_hash = hash_header(header_text.size() ? &header_text[0] : NULL, header_text.size());
+    h.hierarchy = hierarchy ? 1 : 0;
+    h.num_tops = p.num_tops;
+    h.num_modules = p.num_modules;
+    h.num_signals = p.num_signals;
+    h.strings_size = p.strings_size;
+    std::memcpy(h.sections, p.sections, sizeof(h.sections));
+
+    std::vector<char> tmp_name(index_file, index_file + std::strlen(index_file));
+    const char suffix[] = ".XXXXXX";
+    tmp_name.insert(tmp_name.end(), suffix, suffix + sizeof(suffix));
+    bool ok;
+    {
+        fd_raii fd(mkstemp(&tmp_name.front()));
+        if(fd < 0){
+            perror(index_file);
+            return -1;
+        }
+        body_writer out(fd);
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        if(!modules.empty()) out.write(reinterpret_cast<const char *>(&modules.front()), modules.size() * sizeof(packed_module));
+        if(!signals.empty()) out.write(reinterpret_cast<const char *>(&signals.front()), signals.size() * sizeof(packed_signal));
+        if(!strings.empty()) out.write(&strings.front(), strings.size());
+        ok = out.flush() && fchmod(fd, 0644) == 0;
+        if(!ok && out.get_error()) errno = out.get_error();
+    }
+    if(ok && rename(&tmp_name.front(), index_file) == 0) return 0;
+    perror(index_file);
+    unlink(&tmp_name.front());
+    return -1;
+}
+
+//! constructor
+//
+//! @param index_file name of the index, which may not exist, NULL not to use any index
+vcd_index::vcd_index(const char *index_file) : map(index_file ? new mmap_manager(index_file, mmap_manager::read_only, SIZE_MAX, mmap_manager::populate) : NULL){
+    if(map && map->get_error()){
+        delete map;
+        map = NULL;
+    }
+}
+
+//! destructor
+//
+//! Headers loaded from the index must be deleted before this.
+vcd_index::~vcd_index(){
+    delete map;
+}
+
+//! rebuild the header from the index if it is up to date
+//
+//! @param vcd_file mapped VCD, whose window is grown to check the header
+//! @param hierarchy true if the hierarchy should be established from the signal names
+//! @param header_size size of the VCD header is stored
+//! @param log stream for the reason why the index is not used
+//! @return header that refers to the index, NULL if the index is missing, broken or out of date
+vcd_header *vcd_index::load(mmap_manager &vcd_file, bool hierarchy, size_t &header_size, std::ostream &log)const{
+    if(!map) return NULL;
+    const char *const base = static_cast<const char *>(map->get_ptr());
+    const size_t file_size = map->get_size();
+    index_file_header h;
+    if(file_size < sizeof(h)){
+        log << "Index is broken" << std::endl;
+        return NULL;
+    }
+    std::memcpy(&h, base, sizeof(h));
+    if(std::memcmp(h.magic, index_magic, sizeof(h.magic)) != 0 || h.byte_order != index_byte_order || h.version != index_version){
+        log << "Index is not of this version" << std::endl;
+        return NULL;
+    }
+    if(h.hierarchy != (hierarchy ? 1u : 0u)){
+        log << "Index was written " << (h.hierarchy ? "without" : "with") << " --flatten" << std::endl;
+        return NULL;
+    }
+    //the header and the line of "$enddefinitions" must be unchanged
+    if(h.header_size >= vcd_file.get_file_size() || vcd_file.remap(h.header_size + 4096) <= h.header_size){
+        log << "Index is out of date" << std::endl;
+        return NULL;
+    }
+    const char *const vcd = static_cast<const char *>(vcd_file.get_ptr());
+    if(!is_enddefinitions_line(vcd + h.header_size, vcd_file.get_size() - h.header_size) || hash_header(vcd, h.header_size) != h.header_hash){
+        log << "Index is out of date" << std::endl;
+        return NULL;
+    }
+    packed_header p;
+    p.modules = reinterpret_cast<const packed_module *>(base + sizeof(h));
+    p.num_modules = h.num_modules;
+    p.num_tops = h.num_tops;
+    p.signals = reinterpret_cast<const packed_signal *>(base + sizeof(h) + h.num_modules * sizeof(packed_module));
+    p.num_signals = h.num_signals;
+    p.strings = base + sizeof(h) + h.num_modules * sizeof(packed_module) + h.num_signals * sizeof(packed_signal);
+    p.strings_size = h.strings_size;
+    std::memcpy(p.sections, h.sections, sizeof(p.sections));
+    if(!check_records(h, file_size, p)){
+        log << "Index is broken" << std::endl;
+        return NULL;
+    }
+    header_size = h.header_size;
+    return new vcd_header(p);
+}
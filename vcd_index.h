@@ -0,0 +1,33 @@
+#ifndef VCD_INDEX_H
+#define VCD_INDEX_H
+#include <iosfwd>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+class mmap_manager;
+class vcd_header;
+class string_view;
+struct packed_header;
+
+//! binary index of a VCD header kept in a sidecar file
+//
+//! The index is mapped and the header is rebuilt from the records without parsing.
+//! It is used only if the header of the VCD has the same size and hash as when the index was written.
+class vcd_index{
+    //! mapped index, NULL if the file cannot be mapped
+    mmap_manager *map;
+    vcd_index(const vcd_index &);
+    vcd_index & operator = (const vcd_index &);
+    public:
+    explicit vcd_index(const char *);
+    ~vcd_index();
+    vcd_header *load(mmap_manager &, bool, size_t &, std::ostream &)const;
+};
+
+std::string get_index_name(const char *);
+uint64_t hash_header(const char *, size_t);
+int write_index(const char *, const vcd_header &, const string_view &, bool);
+bool check_packed_header(const packed_header &);
+
+#endif
@@ -0,0 +1,224 @@
+#include <ostream>
+#include <vector>
+#include "vcd_header.h"
+#include "vcd_file.h"
+#include "vcd_lib.h"
+
+namespace{
+
+//! parse a non-negative decimal number
+//
+//! @param s string of digits
+//! @param val the number is stored
+//! @return false if s is not a number or overflows
+bool parse_width(const string_view &s, uint32_t &val){
+    uint64_t v = 0;
+    for(size_t i = 0; i < s.size(); ++i){
+        if(s[i] < '0' || '9' < s[i]) return false;
+        v = v * 10 + (s[i] - '0');
+        if(v > UINT32_MAX) return false;
+    }
+    val = v;
+    return true;
+}
+
+//! check that the parser accepts the header
+//
+//! The parser trusts its input and stops at an assertion,
+//! so everything it relies on is checked here in one pass over the tokens.
+//! Parameters that the parser would drop with a warning are unsupported, so nothing is lost silently.
+//! @param toks tokens of the header
+//! @param head head of the header
+//! @param error_offset offset of the offending token from head is stored
+//! @return vcd_ok if the header can be parsed
+vcd_status check_header(token_list &toks, const char *head, size_t &error_offset){
+    const char *const sections[] = {"$date", "$version", "$timescale", "$comment"};
+    bool seen[4] = {false, false, false, false};
+    size_t depth = 0, next = 0;
+    for(size_t key, end; toks.get_param(key, end); next = end + 1){
+        const string_view param = toks[key];
+        error_offset = &param[0] - head;
+        if(param[0] != '$' || param == "$end") return vcd_syntax_error;
+        if(param == "$scope"){
+            if(key + 3 > end) return vcd_syntax_error;
+            if(toks[key + 1] != "module") return vcd_unsupported;
+            ++depth;
+        }
+        else if(param == "$upscope"){
+            if(depth == 0) return vcd_unsupported;
+            --depth;
+        }
+        else if(param == "$var"){
+            if(depth == 0) return vcd_unsupported;
+            if(key + 5 > end) return vcd_syntax_error;
+            const string_view type = toks[key + 1];
+            if(type != "wire" && type != "real") return vcd_unsupported;
+            uint32_t width;
+            if(!parse_width(toks[key + 2], width) || toks[key + 3].size() > UINT8_MAX || toks.span(key + 4, end).size() > UINT16_MAX){
+                return vcd_syntax_error;
+            }
+            //the hierarchy cannot be established from a name like "x." that has no reference
+            const string_view ref = toks[key + 4];
+            if(ref[ref.size() - 1] == '.') return vcd_unsupported;
+        }
+        else if(depth){
+            return vcd_unsupported;
+        }
+        else if(param != "$enddefinitions"){
+            //each section can be given only once
+            size_t i = 0;
+            while(i < 4 && sections[i] != param) ++i;
+            if(i == 4) return vcd_unsupported;
+            if(seen[i]) return vcd_syntax_error;
+            seen[i] = true;
+        }
+    }
+    //tokens left without "$end"
+    if(toks.has(next)){
+        error_offset = &toks[next][0] - head;
+        return vcd_syntax_error;
+    }
+    error_offset = 0;
+    return vcd_ok;
+}
+
+} //end of unnamed namespace
+
+//! get the message of a status
+//
+//! @param status status returned by vcd_hier_parser
+//! @return static string
+const char *get_status_str(vcd_status status){
+    switch(status){
+        case vcd_ok: return "Success";
+        case vcd_no_enddefinitions: return "$enddefinitions is not found";
+        case vcd_syntax_error: return "Malformed header";
+        case vcd_unsupported: return "Unsupported header";
+        case vcd_too_large: return "Header is larger than 4 GB";
+        case vcd_buffer_too_small: return "Output buffer is too small";
+        case vcd_output_failed: return "Output callback failed";
+        case vcd_invalid_argument: return "Invalid argument";
+    }
+    return "Unknown status";
+}
+
+//! state kept across parse() calls
+struct vcd_hier_parser::impl{
+    //! tokens of the header
+    token_list toks;
+    //! working memory of the parser
+    vcd_scratch scratch;
+    //! stream without a buffer that discards the warnings of the parser, which are reported as vcd_status
+    std::ostream quiet;
+    //! parsed header, NULL before the first successful parse()
+    vcd_header *header;
+    //! buffer of write() with callback
+    std::vector<char> out;
+    //! size of the parsed header
+    size_t header_size;
+    //! offset of the token that made parse() fail
+    size_t error_offset;
+    //! true if the header was parsed without hierarchy to be flattened
+    bool flatten;
+    //! true if header has the result of the last parse()
+    bool parsed;
+    impl() : toks(string_view()), quiet(NULL), header(NULL), header_size(0), error_offset(0), flatten(false), parsed(false){
+        scratch.log = &quiet;
+    }
+    ~impl(){
+        delete header;
+    }
+};
+
+//! constructor
+vcd_hier_parser::vcd_hier_parser() : pimpl(new impl){
+}
+
+//! destructor
+vcd_hier_parser::~vcd_hier_parser(){
+    delete pimpl;
+}
+
+//! parse the header at the head of VCD
+//
+//! The hierarchy is established from the signal names unless flatten is true.
+//! The parsed header refers to vcd, which must be kept until the next parse() or the destruction.
+//! @param vcd head of VCD, which may or may not contain the body
+//! @param len length of vcd
+//! @param flatten true to write the signals under each top module without hierarchy
+//! @return vcd_ok if succeeded
+vcd_status vcd_hier_parser::parse(const char *vcd, size_t len, bool flatten){
+    impl &p = *pimpl;
+    p.parsed = false;
+    p.error_offset = 0;
+    if(!get_vcd_header_size(vcd, len, p.header_size)) return vcd_no_enddefinitions;
+    if(p.header_size > UINT32_MAX) return vcd_too_large;
+    const string_view all(vcd, p.header_size);
+    p.toks.reset(all);
+    const vcd_status status = check_header(p.toks, vcd, p.error_offset);
+    if(status != vcd_ok) return status;
+    p.toks.reset(all);
+    if(p.header) p.header->reparse(p.toks, all, !flatten, p.scratch);
+    else p.header = new vcd_header(p.toks, all, !flatten, p.scratch);
+    //the order of signals is computed with the scratch not to allocate while writing
+    if(flatten) p.header->make_flat_order(p.scratch);
+    p.flatten = flatten;
+    p.parsed = true;
+    return vcd_ok;
+}
+
+//! get the size of the header in the input, the body starts there
+size_t vcd_hier_parser::get_header_size()const{
+    return pimpl->header_size;
+}
+
+//! get the offset of the token that made parse() fail from the head of VCD
+size_t vcd_hier_parser::get_error_offset()const{
+    return pimpl->error_offset;
+}
+
+//! get the size of the header to be written
+//
+//! @param size_level size level from 0 to vcd_header::max_size_level, see vcd_header::to_str()
+//! @param size the size is stored
+//! @return vcd_ok if succeeded
+vcd_status vcd_hier_parser::get_output_size(int size_level, size_t &size)const{
+    if(!pimpl->parsed || size_level < 0 || size_level > vcd_header::max_size_level) return vcd_invalid_argument;
+    size_t sizes[vcd_header::max_size_level + 1];
+    pimpl->header->get_sizes(pimpl->flatten, sizes);
+    size = sizes[size_level];
+    return vcd_ok;
+}
+
+//! write the header into a buffer
+//
+//! @param buf buffer to be written to
+//! @param cap size of buf
+//! @param size_level size level from 0 to vcd_header::max_size_level
+//! @param len length of the header is stored, which is the required size if buf is too small
+//! @return vcd_ok if succeeded
+vcd_status vcd_hier_parser::write(char *buf, size_t cap, int size_level, size_t &len)const{
+    const vcd_status status = get_output_size(size_level, len);
+    if(status != vcd_ok) return status;
+    if(len > cap) return vcd_buffer_too_small;
+    header_writer w(buf);
+    write_header(*pimpl->header, w, pimpl->flatten, size_level);
+    return vcd_ok;
+}
+
+//! write the header through a callback
+//
+//! The header is rendered in a buffer kept by the parser and passed at once.
+//! @param func function that receives the header
+//! @param arg context passed to func
+//! @param size_level size level from 0 to vcd_header::max_size_level
+//! @return vcd_ok if succeeded
+vcd_status vcd_hier_parser::write(vcd_output_func func, void *arg, int size_level)const{
+    if(!pimpl->parsed || size_level < 0 || size_level > vcd_header::max_size_level) return vcd_invalid_argument;
+    std::vector<char> &out = pimpl->out;
+    out.clear();
+    header_writer w(out);
+    write_header(*pimpl->header, w, pimpl->flatten, size_level);
+    if(!func(out.empty() ? NULL : &out.front(), out.size(), arg)) return vcd_output_failed;
+    return vcd_ok;
+}
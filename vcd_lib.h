@@ -0,0 +1,53 @@
+#ifndef VCD_LIB_H
+#define VCD_LIB_H
+#include <cstddef>
+
+//! result of vcd_hier_parser
+enum vcd_status{
+    //! succeeded
+    vcd_ok = 0,
+    //! "$enddefinitions" is not found in the buffer
+    vcd_no_enddefinitions,
+    //! the header is malformed, see vcd_hier_parser::get_error_offset()
+    vcd_syntax_error,
+    //! the header is valid VCD that cannot be handled, such as "$var reg", "$scope task", "$comment" in a scope or "$var" out of scopes
+    vcd_unsupported,
+    //! the header is larger than 4 GB
+    vcd_too_large,
+    //! the output buffer is too small, the required size is returned
+    vcd_buffer_too_small,
+    //! the output callback returned false
+    vcd_output_failed,
+    //! an argument is out of range or no header has been parsed
+    vcd_invalid_argument
+};
+
+const char *get_status_str(vcd_status);
+
+//! function that receives the serialized header
+//
+//! The arguments are the data, its length and the context. Return false to report a failure.
+typedef bool (*vcd_output_func)(const char *, size_t, void *);
+
+//! parser that fixes the hierarchy of VCD headers in memory
+//
+//! Errors are returned as vcd_status instead of aborting, and nothing is written to std::cerr.
+//! The parser keeps its memory across parse() calls,
+//! so parsing headers of a similar size repeatedly does not allocate heap memory after the first calls.
+class vcd_hier_parser{
+    struct impl;
+    impl *pimpl;
+    vcd_hier_parser(const vcd_hier_parser &);
+    vcd_hier_parser & operator = (const vcd_hier_parser &);
+    public:
+    vcd_hier_parser();
+    ~vcd_hier_parser();
+    vcd_status parse(const char *, size_t, bool);
+    size_t get_header_size()const;
+    size_t get_error_offset()const;
+    vcd_status get_output_size(int, size_t &)const;
+    vcd_status write(char *, size_t, int, size_t &)const;
+    vcd_status write(vcd_output_func, void *, int)const;
+};
+
+#endif
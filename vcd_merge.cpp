@@ -0,0 +1,428 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_merge.h"
+
+namespace{
+
+//! length of the body tokenized at once, which keeps the token boundaries in the cache
+const size_t merge_block_size = 1024 * 1024;
+
+//! length of the body mapped at once, which bounds the memory mapped for each file
+const size_t merge_window_size = 64 * 1024 * 1024;
+
+//! check if the keyword starts a section of value changes
+bool is_dump_keyword(const string_view &key){
+    return key == "$dumpvars" || key == "$dumpall" || key == "$dumpon" || key == "$dumpoff";
+}
+
+//! context of new_symbol()
+struct symbol_map{
+    //! index of the original codes
+    const code_table *table;
+    //! new identifier code of each code
+    const std::vector<std::string> *codes;
+};
+
+//! get the new symbol of a signal, called by vcd_header::replace_symbols()
+string_view new_symbol(const string_view &old, void *arg){
+    const symbol_map &m = *static_cast<const symbol_map *>(arg);
+    const std::string &s = (*m.codes)[m.table->find(old)];
+    return string_view(s.data(), s.size());
+}
+
+//! VCD to be merged, whose body is tokenized from the mapping block by block
+class merge_source{
+    //! VCD file
+    const std::string name;
+    //! mapped header of the VCD
+    mmap_manager map;
+    //! window of the body, which slides through the body
+    mmap_manager body;
+    //! parsed header, NULL if not parsed
+    vcd_header *header;
+    //! index of identifier codes in the header
+    code_table table;
+    //! new identifier code of each code
+    std::vector<std::string> codes;
+    //! part of the body not fed to the lexer yet
+    const char *pos;
+    //! end of the last line in the window of the body
+    const char *end;
+    //! lexer of the body
+    body_lexer lexer;
+    //! true if the value left by the lexer at the end has been taken
+    bool finished;
+    //! true after $enddefinitions at the head of the body until its $end
+    bool in_definitions;
+    //! time of the timestamp read last
+    uint64_t time;
+    //! number of timestamps read
+    uint64_t num_timestamps;
+    //! number of value changes dropped because their codes are not in the header
+    uint64_t num_unknown;
+    void set_window();
+    bool slide();
+    bool next(body_token &);
+    merge_source(const merge_source &);
+    merge_source & operator = (const merge_source &);
+    public:
+    explicit merge_source(const std::string &);
+    ~merge_source();
+    bool open(unsigned int, std::ostream &);
+    void assign_codes(std::set<uint64_t> &, code_generator &);
+    int copy_changes(body_writer &, std::ostream &);
+    const std::string &get_name()const{return name;}
+    const vcd_header &get_header()const{return *header;}
+    uint64_t get_time()const{return time;}
+    uint64_t get_num_timestamps()const{return num_timestamps;}
+    uint64_t get_num_unknown()const{return num_unknown;}
+};
+
+//! constructor
+//
+//! @param n VCD file, whose header is mapped read-only, and whose body is mapped by open()
+merge_source::merge_source(const std::string &n) : name(n), map(n.c_str(), mmap_manager::read_only, header_scan_window, mmap_manager::sequential),
+    body(n.c_str(), mmap_manager::read_only, 0, mmap_manager::sequential | mmap_manager::will_need), header(NULL), pos(NULL), end(NULL), finished(false), in_definitions(false), time(0), num_timestamps(0), num_unknown(0){
+}
+
+//! destructor
+merge_source::~merge_source(){
+    delete header;
+}
+
+//! parse the header
+//
+//! @param num_threads number of threads to parse the header, 0 for the number of CPUs
+//! @param log stream for messages
+//! @return false if failed
+bool merge_source::open(unsigned int num_threads, std::ostream &log){
+    if(map.get_error()){
+        log << name << ": " << std::strerror(map.get_error()) << std::endl;
+        return false;
+    }
+    size_t header_size;
+    if(!get_vcd_header_size(map, header_size)){
+        log << name << ": $enddefinitions is not found" << std::endl;
+        return false;
+    }
+    const char *const head = static_cast<const char *>(map.get_ptr());
+    if(!check_header_limits(name.c_str(), string_view(head, header_size), log)) return false;
+    header = parse_vcd_header(string_view(head, header_size), true, num_threads, log);
+    std::vector<const vcd_signal *> sigs;
+    header->get_signals(sigs);
+    if(!table.build(sigs)){
+        log << name << ": identifier codes that are not base-94 integers cannot be merged" << std::endl;
+        return false;
+    }
+    body.slide(header_size, merge_window_size);
+    if(body.get_error()){
+        log << name << ": " << std::strerror(body.get_error()) << std::endl;
+        return false;
+    }
+    set_window();
+    return true;
+}
+
+//! take the lines in the window of the body
+//
+//! The window is cut at the end of its last line unless it reaches the end of the file, so a line is not split by the windows.
+void merge_source::set_window(){
+    pos = static_cast<const char *>(body.get_ptr());
+    end = pos + body.get_size();
+    if(body.get_offset() + body.get_size() < body.get_file_size()){
+        const char *const nl = static_cast<const char *>(memrchr(pos, '\n', body.get_size()));
+        if(nl) end = nl + 1;
+    }
+}
+
+//! move the window of the body to the rest of the body
+//
+//! The tokens of the old window must have been taken because they refer to the window.
+//! @return false at the end of the body or if the rest cannot be mapped, see the error of body
+bool merge_source::slide(){
+    const size_t offset = body.get_offset() + (pos - static_cast<const char *>(body.get_ptr()));
+    if(offset >= body.get_file_size()) return false;
+    if(!body.slide(offset, merge_window_size)) return false;
+    set_window();
+    return true;
+}
+
+//! give the identifier codes that do not collide with those of the other VCDs
+//
+//! A code is kept if no VCD merged before uses it, and renamed to an unused code otherwise.
+//! Signals that share a code keep sharing the new code. The header is given the new codes,
+//! and the body is still looked up by the original codes.
+//! @param used codes used so far decoded by decode_id_code(), the codes of this VCD are added
+//! @param gen generator of new codes shared by all VCDs
+void merge_source::assign_codes(std::set<uint64_t> &used, code_generator &gen){
+    std::vector<const vcd_signal *> sigs;
+    header->get_signals(sigs);
+    codes.assign(table.size(), std::string());
+    std::vector<bool> renamed(table.size(), false);
+    //codes that do not collide are kept first, so that no new code takes the code of a later signal
+    for(size_t i = 0; i < sigs.size(); ++i){
+        const string_view &sym = sigs[i]->get_symbol();
+        const uint32_t idx = table.find(sym);
+        if(!codes[idx].empty() || renamed[idx]) continue;
+        uint64_t n;
+        decode_id_code(sym, n);
+        if(used.insert(n).second) codes[idx].assign(&sym[0], sym.size());
+        else renamed[idx] = true;
+    }
+    for(size_t i = 0; i < codes.size(); ++i){
+        if(!renamed[i]) continue;
+        uint64_t n;
+        do{
+            codes[i] = gen.next();
+            decode_id_code(string_view(codes[i].data(), codes[i].size()), n);
+        }while(!used.insert(n).second);
+    }
+    symbol_map m = {&table, &codes};
+    header->replace_symbols(new_symbol, &m);
+}
+
+//! get the next token of the body
+//
+//! @param tok the token is stored, which is valid until the next call
+//! @return false at the end of the body
+bool merge_source::next(body_token &tok){
+    for(;;){
+        if(lexer.next(tok)) return true;
+        if(pos == end && !slide()){
+            if(finished) return false;
+            finished = true;
+            return lexer.finish(tok);
+        }
+        const char *next = pos + std::min<size_t>(merge_block_size, end - pos);
+        if(next < end){
+            const char *nl = static_cast<const char *>(memrchr(pos, '\n', next - pos));
+            if(!nl) nl = static_cast<const char *>(std::memchr(next, '\n', end - next));
+            next = nl ? nl + 1 : end;
+        }
+        lexer.feed(string_view(pos, next - pos));
+        pos = next;
+    }
+}
+
+//! copy the tokens until the next timestamp with the new identifier codes
+//
+//! The line of $enddefinitions at the head of the body is skipped because the merged header has its own.
+//! @param out output
+//! @param log stream for messages
+//! @return 1 if a timestamp is read, whose time is get_time(), 0 at the end of the body, -1 if the timestamp is broken
+int merge_source::copy_changes(body_writer &out, std::ostream &log){
+    body_token tok;
+    while(next(tok)){
+        switch(tok.kind){
+            case body_token::timestamp:{
+                uint64_t t;
+                if(!parse_timestamp(tok.value, t)){
+                    log << name << ": broken timestamp " << tok.value << std::endl;
+                    return -1;
+                }
+                if(num_timestamps++ && t < time){
+                    log << name << ": time goes back from #" << time << " to " << tok.value << std::endl;
+                    return -1;
+                }
+                time = t;
+                return 1;
+            }
+            case body_token::scalar:
+            case body_token::vector:
+            case body_token::real:
+            case body_token::string:{
+                const uint32_t idx = table.find(tok.code);
+                if(idx == code_table::npos){
+                    ++num_unknown;
+                    break;
+                }
+                out.write(tok.value);
+                if(tok.kind != body_token::scalar) out.put(' ');
+                out.write(codes[idx].data(), codes[idx].size());
+                out.put('\n');
+                break;
+            }
+            case body_token::keyword:
+                //the line of $enddefinitions is replaced with that of the merged header
+                if(tok.value == "$enddefinitions" && !num_timestamps){
+                    in_definitions = true;
+                    break;
+                }
+                if(in_definitions && tok.value == "$end"){
+                    in_definitions = false;
+                    break;
+                }
+                out.write(tok.value);
+                //"$comment" and its text are kept in a line until "$end"
+                out.put(is_dump_keyword(tok.value) || tok.value == "$end" ? '\n' : ' ');
+                break;
+            default:
+                out.write(tok.value);
+                out.put(' ');
+                break;
+        }
+    }
+    if(body.get_error()){
+        log << name << ": " << std::strerror(body.get_error()) << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+//! owns the sources
+struct source_list{
+    std::vector<merge_source *> sources;
+    ~source_list(){
+        for(size_t i = 0; i < sources.size(); ++i){
+            delete sources[i];
+        }
+    }
+};
+
+//! get $timescale without whitespace to compare the units of VCDs
+std::string get_time_unit(const vcd_header &header){
+    const string_view &ts = header.get_timescale();
+    std::string s;
+    for(size_t i = 0; i < ts.size(); ++i){
+        if(ts[i] != ' ' && ts[i] != '\t' && ts[i] != '\n' && ts[i] != '\r') s.push_back(ts[i]);
+    }
+    return s;
+}
+
+//! get the default top module of a VCD from its filename
+//
+//! The directory and the extensions are removed and whitespace is replaced with '_'.
+std::string get_scope_name(const std::string &filename){
+    const size_t slash = filename.rfind('/');
+    std::string s = filename.substr(slash == std::string::npos ? 0 : slash + 1);
+    s = s.substr(0, s.find('.'));
+    for(size_t i = 0; i < s.size(); ++i){
+        if(s[i] == ' ' || s[i] == '\t') s[i] = '_';
+    }
+    return s.empty() ? std::string("vcd") : s;
+}
+
+} //end of unnamed namespace
+
+//! merge VCD files into one VCD
+//
+//! The hierarchy of each VCD is put under a top module of its own, and identifier codes that collide
+//! with those of the VCDs before are renamed. The bodies are mapped and merged by time
+//! with a heap of the next timestamp of each VCD, and the changes of all VCDs at the same time
+//! are written under one timestamp in the order of the VCDs. Each body is tokenized block by block
+//! from the mapping and the output is written through a fixed size buffer, so the memory does not depend on the sizes.
+//! Changes before the first timestamp, such as $dumpvars without a timestamp, are written first.
+//! @param inputs VCD files, which must have the same $timescale
+//! @param scopes top modules of the VCDs, empty to name them after the files
+//! @param output_file merged VCD, compressed if its name ends with ".gz"
+//! @param num_threads number of threads to parse headers and to compress the output, 0 for the number of CPUs
+//! @param log stream for messages
+//! @return 0 if succeeded
+int merge_files(const std::vector<std::string> &inputs, const std::vector<std::string> &scopes, const char *output_file, unsigned int num_threads, std::ostream &log){
+    source_list list;
+    std::set<uint64_t> used;
+    std::set<std::string> names;
+    code_generator gen;
+    std::vector<std::string> tops(inputs.size());
+    for(size_t i = 0; i < inputs.size(); ++i){
+        list.sources.push_back(new merge_source(inputs[i]));
+        merge_source &src = *list.sources.back();
+        if(is_gzip_file(inputs[i].c_str())){
+            log << inputs[i] << ": compressed VCD cannot be merged" << std::endl;
+            return -1;
+        }
+        if(!src.open(num_threads, log)) return -1;
+        if(i > 0 && get_time_unit(src.get_header()) != get_time_unit(list.sources.front()->get_header())){
+            log << inputs[i] << ": $timescale differs from that of " << inputs.front() << std::endl;
+            return -1;
+        }
+        src.assign_codes(used, gen);
+        tops[i] = scopes.empty() ? get_scope_name(inputs[i]) : scopes[i];
+        //files of the same name in different directories get distinct top modules
+        for(size_t n = 1; !names.insert(tops[i]).second; ++n){
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), "_%lu", static_cast<unsigned long>(n));
+            tops[i] = (scopes.empty() ? get_scope_name(inputs[i]) : scopes[i]) + suffix;
+        }
+    }
+    //the mapped inputs must not be truncated
+    struct stat ost, ist;
+    for(size_t i = 0; i < inputs.size() && stat(output_file, &ost) == 0; ++i){
+        if(stat(inputs[i].c_str(), &ist) == 0 && ist.st_dev == ost.st_dev && ist.st_ino == ost.st_ino){
+            log << output_file << ": output cannot be one of the inputs" << std::endl;
+            return -1;
+        }
+    }
+    std::vector<char> v;
+    header_writer w(v);
+    for(size_t i = 0; i < inputs.size(); ++i){
+        list.sources[i]->get_header().nest_to_str(w, 0, string_view(tops[i].data(), tops[i].size()), i == 0);
+    }
+
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    body_writer out(ofd, is_gzip_name(output_file), num_threads);
+    if(!v.empty()) out.write(&v.front(), v.size());
+    static const char enddefinitions[] = "$enddefinitions $end\n";
+    out.write(enddefinitions, sizeof(enddefinitions) - 1);
+
+    //the next timestamp and the index of each VCD, the earliest and then the first VCD on the top
+    typedef std::pair<uint64_t, size_t> merge_key;
+    std::priority_queue<merge_key, std::vector<merge_key>, std::greater<merge_key> > heap;
+    for(size_t i = 0; i < list.sources.size(); ++i){
+        const int ret = list.sources[i]->copy_changes(out, log);
+        if(ret < 0) return -1;
+        if(ret > 0) heap.push(merge_key(list.sources[i]->get_time(), i));
+    }
+    uint64_t num_timestamps = 0, last = 0;
+    while(!heap.empty()){
+        const merge_key k = heap.top();
+        heap.pop();
+        //changes of all VCDs at the same time are coalesced under one timestamp
+        if(!num_timestamps || k.first != last){
+            char stamp[32];
+            const int len = std::snprintf(stamp, sizeof(stamp), "#%llu\n", static_cast<unsigned long long>(k.first));
+            out.write(stamp, len);
+            last = k.first;
+            ++num_timestamps;
+        }
+        merge_source &src = *list.sources[k.second];
+        const int ret = src.copy_changes(out, log);
+        if(ret < 0) return -1;
+        if(ret > 0) heap.push(merge_key(src.get_time(), k.second));
+    }
+    if(!out.flush()){
+        errno = out.get_error();
+        perror(output_file);
+        return -1;
+    }
+    uint64_t num_read = 0, num_unknown = 0;
+    for(size_t i = 0; i < list.sources.size(); ++i){
+        num_read += list.sources[i]->get_num_timestamps();
+        num_unknown += list.sources[i]->get_num_unknown();
+    }
+    log << "Merged " << inputs.size() << " files: header size " << v.size() << ", body size " << out.get_written() - v.size()
+        << ", " << num_timestamps << " timestamps from " << num_read << std::endl;
+    if(num_unknown) log << num_unknown << " value changes of signals not in the headers are dropped" << std::endl;
+    return 0;
+}
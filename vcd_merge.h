@@ -0,0 +1,9 @@
+#ifndef VCD_MERGE_H
+#define VCD_MERGE_H
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+int merge_files(const std::vector<std::string> &, const std::vector<std::string> &, const char *, unsigned int, std::ostream &);
+
+#endif
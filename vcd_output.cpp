@@ -0,0 +1,227 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h> //FICLONERANGE
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "vcd_output.h"
+#include "vcd_stats.h"
+
+namespace{
+
+//! write the whole data at the offset
+//
+//! The offset is ignored if fd is not seekable such as a pipe.
+//! @param fd destination file
+//! @param p data to be written
+//! @param len length of data
+//! @param off offset in the file
+//! @return false if failed
+bool pwrite_all(int fd, const char *p, size_t len, off_t off){
+    while(len > 0){
+        ssize_t w = pwrite(fd, p, len, off);
+        if(w < 0 && errno == ESPIPE) w = write(fd, p, len);
+        if(w < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        count_written(w);
+        p += w;
+        len -= w;
+        off += w;
+    }
+    return true;
+}
+
+//! copy a range of file by read()/write() through a user-space buffer
+//
+//! @return false if failed
+bool copy_range_by_buffer(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len){
+    std::vector<char> buf(1024 * 1024);
+    while(len > 0){
+        const ssize_t r = pread(in_fd, &buf.front(), std::min(len, buf.size()), in_off);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return false;
+        count_read(r);
+        if(!pwrite_all(out_fd, &buf.front(), r, out_off)) return false;
+        in_off += r;
+        out_off += r;
+        len -= r;
+    }
+    return true;
+}
+
+//! copy a range of file without passing the data through user space
+//
+//! copy_file_range() is tried first, which also shares extents on filesystems that support it.
+//! sendfile() is used if copy_file_range() is not supported for the files,
+//! and read()/write() is the last resort.
+//! @param in_fd source file
+//! @param in_off offset in the source file
+//! @param out_fd destination file
+//! @param out_off offset in the destination file
+//! @param len length to copy
+//! @return false if failed
+bool copy_range(int in_fd, off_t in_off, int out_fd, off_t out_off, size_t len){
+    while(len > 0){
+        const ssize_t c = copy_file_range(in_fd, &in_off, out_fd, &out_off, len, 0);
+        if(c > 0){
+            count_read(c);
+            count_written(c);
+            len -= c;
+            continue;
+        }
+        if(c == 0) return false; //unexpected end of file
+        if(errno == EINTR) continue;
+        if(errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP && errno != EBADF) return false;
+        break;
+    }
+    if(lseek(out_fd, out_off, SEEK_SET) < 0 && errno != ESPIPE) return false;
+    while(len > 0){
+        const ssize_t c = sendfile(out_fd, in_fd, &in_off, len);
+        if(c > 0){
+            count_read(c);
+            count_written(c);
+            out_off += c;
+            len -= c;
+            continue;
+        }
+        if(c == 0) return false;
+        if(errno == EINTR) continue;
+        if(errno != EINVAL && errno != ENOSYS) return false;
+        break;
+    }
+    return copy_range_by_buffer(in_fd, in_off, out_fd, out_off, len);
+}
+
+//! share the extents of the body with the output file
+//
+//! The body is cloned from the first block boundary after the header.
+//! The destination offset must also be on a block boundary, so the new header is padded
+//! to have the same remainder as the original header size.
+//! @param in_fd source file
+//! @param out_fd destination file
+//! @param file_size size of the source file
+//! @param header_size size of the original header
+//! @param new_size size of the new header
+//! @param block_size block size of the filesystem
+//! @param padded_size size of the padded new header is stored
+//! @return false if the filesystem does not support cloning
+bool clone_body(int in_fd, int out_fd, size_t file_size, size_t header_size, size_t new_size, size_t block_size, size_t &padded_size){
+#ifdef FICLONERANGE
+    const size_t src_aligned = (header_size + block_size - 1) / block_size * block_size;
+    if(src_aligned >= file_size) return false;
+    padded_size = new_size + (header_size + block_size - new_size % block_size) % block_size;
+    struct file_clone_range range;
+    range.src_fd = in_fd;
+    range.src_offset = src_aligned;
+    range.src_length = 0; //to the end of file
+    range.dest_offset = padded_size + (src_aligned - header_size);
+    //some filesystems refuse to clone beyond the end of destination
+    if(ftruncate(out_fd, range.dest_offset)) return false;
+    if(ioctl(out_fd, FICLONERANGE, &range) == 0) return true;
+    if(ftruncate(out_fd, 0)) perror("ftruncate");
+    return false;
+#else
+    return false;
+#endif
+}
+
+} //end of unnamed namespace
+
+//! fill the region with white spaces
+//
+//! Lines of 80 spaces are written so that the file is still readable by text editors.
+//! @param dst head of the region to be filled
+//! @param size size of the region
+void fill_padding(char *dst, size_t size){
+    const unsigned int fill_unit = 80;
+    for(size_t cur = 0; cur < size; cur += fill_unit + 1){
+        const unsigned int fill_size = std::min<size_t>(fill_unit + 1, size - cur);
+        std::memset(dst + cur, ' ', fill_size - 1);
+        dst[cur + fill_size - 1] = '\n';
+    }
+}
+
+//! Open File in create mode and write the whole data
+//
+//! The body is shared with the original file by FICLONERANGE if the filesystem supports reflinks,
+//! otherwise it is copied in the kernel by copy_file_range() or sendfile().
+//! @param orig_vcd Original VCD filename
+//! @param output_file New VCD file
+//! @param v header information
+//! @param header_size size of vcd header
+int make_new_file_and_write(const char *orig_vcd, const char *output_file, const std::vector<char> &v, size_t header_size){
+    fd_raii ifd(open(orig_vcd, O_RDONLY));
+    if(ifd < 0){
+        perror(orig_vcd);
+        return -1;
+    }
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    struct stat ist, ost;
+    if(fstat(ifd, &ist) || fstat(ofd, &ost)){
+        perror("fstat");
+        return -1;
+    }
+    const size_t file_size = ist.st_size;
+    const size_t block_size = ost.st_blksize > 0 ? ost.st_blksize : 4096;
+    size_t padded_size = v.size();
+    if(clone_body(ifd, ofd, file_size, header_size, v.size(), block_size, padded_size)){
+        //only the header and the head of body before the first block boundary are written
+        std::vector<char> head(v);
+        head.resize(padded_size);
+        fill_padding(&head.front() + v.size(), padded_size - v.size());
+        const size_t src_aligned = (header_size + block_size - 1) / block_size * block_size;
+        if(pwrite_all(ofd, &head.front(), head.size(), 0) && copy_range(ifd, header_size, ofd, padded_size, src_aligned - header_size)){
+            return 0;
+        }
+        perror(output_file);
+        return -1;
+    }
+    if(!pwrite_all(ofd, v.empty() ? NULL : &v.front(), v.size(), 0) || !copy_range(ifd, header_size, ofd, v.size(), file_size - header_size)){
+        perror(output_file);
+        return -1;
+    }
+    return 0;
+}
+
+//! Replace the VCD file with the new header and the original body
+//
+//! The new file is written next to the original one and renamed over it,
+//! so the original file is kept intact if something fails on the way.
+//! @param vcd_file VCD file to be modified
+//! @param v header information
+//! @param header_size size of vcd header
+int rewrite_file(const char *vcd_file, const std::vector<char> &v, size_t header_size){
+    struct stat st;
+    if(stat(vcd_file, &st)){
+        perror(vcd_file);
+        return -1;
+    }
+    std::vector<char> tmp_name(vcd_file, vcd_file + std::strlen(vcd_file));
+    const char suffix[] = ".XXXXXX";
+    tmp_name.insert(tmp_name.end(), suffix, suffix + sizeof(suffix));
+    const int fd = mkstemp(&tmp_name.front());
+    if(fd < 0){
+        perror(vcd_file);
+        return -1;
+    }
+    close(fd);
+    if(make_new_file_and_write(vcd_file, &tmp_name.front(), v, header_size) == 0){
+        if(chmod(&tmp_name.front(), st.st_mode & 07777) == 0 && rename(&tmp_name.front(), vcd_file) == 0) return 0;
+        perror(vcd_file);
+    }
+    unlink(&tmp_name.front());
+    return -1;
+}
@@ -0,0 +1,19 @@
+#ifndef VCD_OUTPUT_H
+#define VCD_OUTPUT_H
+#include <vector>
+#include <cstddef>
+#include <unistd.h>
+
+//! RAII idiom for file descriptor
+struct fd_raii{
+    const int fd;
+    explicit fd_raii(int f) : fd(f){}
+    ~fd_raii(){if(fd >= 0) close(fd);}
+    operator int()const{return fd;}
+};
+
+void fill_padding(char *, size_t);
+int make_new_file_and_write(const char *, const char *, const std::vector<char> &, size_t);
+int rewrite_file(const char *, const std::vector<char> &, size_t);
+
+#endif
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "vcd_header.h"
+#include "vcd_query.h"
+
+namespace{
+
+//! size of the output written at once
+const size_t query_output_chunk = 64 * 1024;
+//! segment that matches any number of levels
+const char any_levels[] = "**";
+
+//! check if a segment matches a glob pattern
+//
+//! '*' matches any characters and '?' matches one character.
+//! @param pat pattern
+//! @param s segment
+bool match_glob(const string_view &pat, const string_view &s){
+    const size_t no_star = static_cast<size_t>(-1);
+    size_t p = 0, i = 0, star = no_star, mark = 0;
+    while(i < s.size()){
+        if(p < pat.size() && pat[p] == '*'){
+            star = p++;
+            mark = i;
+        }
+        else if(p < pat.size() && (pat[p] == '?' || pat[p] == s[i])){
+            ++p;
+            ++i;
+        }
+        else if(star != no_star){
+            p = star + 1;
+            i = ++mark;
+        }
+        else{
+            return false;
+        }
+    }
+    while(p < pat.size() && pat[p] == '*') ++p;
+    return p == pat.size();
+}
+
+//! get the part of a pattern before the first wildcard
+string_view literal_prefix(const string_view &pat){
+    size_t n = 0;
+    while(n < pat.size() && pat[n] != '*' && pat[n] != '?') ++n;
+    return string_view(n ? &pat[0] : NULL, n);
+}
+
+//! check if a string starts with a prefix
+bool starts_with(const string_view &s, const string_view &prefix){
+    return s.size() >= prefix.size() && (prefix.size() == 0 || std::memcmp(&s[0], &prefix[0], prefix.size()) == 0);
+}
+
+//! query that walks down the hierarchy matching a path pattern segment by segment
+//
+//! The pattern is split at '.' and each segment is matched against a module name or a part of a signal name.
+//! "**" matches any number of levels. The matching positions in the pattern are kept as a set while walking,
+//! so a subtree is skipped as soon as no position is left, and a sub module is looked up by binary search
+//! when the next segment starts with literal characters.
+//! The path of a module is built only while the module is visited.
+class path_query{
+    //! positions in the pattern, which are the numbers of segments matched so far
+    typedef std::vector<uint32_t> state_type;
+    //! the pattern that segs refer to
+    const std::string pattern;
+    //! segments of the pattern
+    std::vector<string_view> segs;
+    //! true to list the signals under the matching scopes, false to find the matching signals
+    bool scope;
+    //! output stream, NULL to count only
+    std::ostream *os;
+    //! path of the current module from the child of the top module, followed by '.'
+    std::vector<char> path;
+    //! lines to be written
+    std::vector<char> out;
+    //! states while matching a signal name
+    state_type cur, next;
+    //! number of matching signals
+    size_t num_signals;
+    //! number of modules that have matching signals
+    size_t num_modules;
+    void close(state_type &)const;
+    void step(const state_type &, const string_view &, state_type &)const;
+    bool accepts(const state_type &)const;
+    bool match_signal(const state_type &, const string_view &);
+    void emit(const vcd_signal &);
+    void emit_all(const vcd_module &);
+    void walk(const vcd_module &, const state_type &);
+    void flush();
+    public:
+    path_query(const std::string &, bool, std::ostream *);
+    void run(const vcd_header &);
+    size_t get_num_signals()const;
+    size_t get_num_modules()const;
+};
+
+//! constructor
+//
+//! @param pat pattern of the path from the child of the top module, empty segments are ignored
+//! @param scope true to list the signals under the matching scopes, false to find the matching signals
+//! @param os output stream, NULL to count only
+path_query::path_query(const std::string &pat, bool scope, std::ostream *os) : pattern(pat), scope(scope), os(os), num_signals(0), num_modules(0){
+    for(size_t head = 0; head < pattern.size(); ){
+        size_t dot = pattern.find('.', head);
+        if(dot == std::string::npos) dot = pattern.size();
+        if(dot != head) segs.push_back(string_view(pattern.data() + head, dot - head));
+        head = dot + 1;
+    }
+}
+
+//! add the positions after "**", which may match no level
+void path_query::close(state_type &s)const{
+    for(size_t i = 0; i < s.size(); ++i){
+        if(s[i] < segs.size() && segs[s[i]] == any_levels && std::find(s.begin(), s.end(), s[i] + 1) == s.end()) s.push_back(s[i] + 1);
+    }
+}
+
+//! match a level of the path
+//
+//! @param s closed states before the level
+//! @param name module name or a part of a signal name
+//! @param t closed states after the level are stored
+void path_query::step(const state_type &s, const string_view &name, state_type &t)const{
+    t.clear();
+    for(size_t i = 0; i < s.size(); ++i){
+        if(s[i] >= segs.size()) continue;
+        uint32_t n;
+        if(segs[s[i]] == any_levels) n = s[i];
+        else if(match_glob(segs[s[i]], name)) n = s[i] + 1;
+        else continue;
+        if(std::find(t.begin(), t.end(), n) == t.end()) t.push_back(n);
+    }
+    close(t);
+}
+
+//! check if the whole pattern is matched
+bool path_query::accepts(const state_type &s)const{
+    return std::find(s.begin(), s.end(), static_cast<uint32_t>(segs.size())) != s.end();
+}
+
+//! check if a signal matches, whose name may contain '.' without hierarchy
+//
+//! @param s closed states of the module of the signal
+//! @param name name of the signal
+bool path_query::match_signal(const state_type &s, const string_view &name){
+    cur = s;
+    const char *head = name.size() ? &name[0] : NULL;
+    const char *const end = head + name.size();
+    for(const char *dot; head < end; head = dot + 1){
+        dot = static_cast<const char *>(std::memchr(head, '.', end - head));
+        if(!dot) dot = end;
+        if(dot == head) continue;
+        //a scope must be a proper prefix of the signal
+        if(scope && dot == end) return false;
+        step(cur, string_view(head, dot - head), next);
+        cur.swap(next);
+        if(cur.empty()) return false;
+        if(scope && accepts(cur)) return true;
+    }
+    return !scope && accepts(cur);
+}
+
+//! write a line of a signal: path, identifier code and width separated by tab
+void path_query::emit(const vcd_signal &sig){
+    ++num_signals;
+    if(!os) return;
+    const string_view name = sig.get_name(), symbol = sig.get_symbol();
+    char width[16];
+    const int width_len = std::snprintf(width, sizeof(width), "\t%u\n", sig.get_width());
+    out.insert(out.end(), path.begin(), path.end());
+    if(name.size()) out.insert(out.end(), &name[0], &name[0] + name.size());
+    out.push_back('\t');
+    if(symbol.size()) out.insert(out.end(), &symbol[0], &symbol[0] + symbol.size());
+    out.insert(out.end(), width, width + width_len);
+    if(out.size() >= query_output_chunk) flush();
+}
+
+//! write all signals of a module and its descendants
+void path_query::emit_all(const vcd_module &mod){
+    for(size_t i = 0; i < mod.get_num_signals(); ++i){
+        emit(mod.get_signal(i));
+    }
+    if(mod.get_num_signals()) ++num_modules;
+    for(size_t i = 0; i < mod.get_num_sub_modules(); ++i){
+        const vcd_module &sub = mod.get_sub_module(i);
+        const string_view name = sub.get_name();
+        const size_t len = path.size();
+        if(name.size()) path.insert(path.end(), &name[0], &name[0] + name.size());
+        path.push_back('.');
+        emit_all(sub);
+        path.resize(len);
+    }
+}
+
+//! match the signals of a module and walk down to the sub modules
+//
+//! @param mod module, whose path is in path
+//! @param s closed states of the module, which is not empty
+void path_query::walk(const vcd_module &mod, const state_type &s){
+    if(scope && accepts(s)){
+        emit_all(mod);
+        return;
+    }
+    const size_t found = num_signals;
+    for(size_t i = 0; i < mod.get_num_signals(); ++i){
+        const vcd_signal &sig = mod.get_signal(i);
+        if(match_signal(s, sig.get_name())) emit(sig);
+    }
+    if(num_signals != found) ++num_modules;
+
+    //sub modules are sorted by name, so only those that start with the literal prefix are visited
+    size_t first = 0, last = mod.get_num_sub_modules();
+    string_view prefix;
+    if(s.size() == 1 && s[0] < segs.size() && segs[s[0]] != any_levels) prefix = literal_prefix(segs[s[0]]);
+    if(prefix.size()){
+        for(size_t n = last; n > 0; ){
+            const size_t half = n / 2;
+            if(mod.get_sub_module(first + half).get_name() < prefix){
+                first += half + 1;
+                n -= half + 1;
+            }
+            else{
+                n = half;
+            }
+        }
+    }
+    state_type t;
+    for(size_t i = first; i < last; ++i){
+        const vcd_module &sub = mod.get_sub_module(i);
+        const string_view name = sub.get_name();
+        if(!starts_with(name, prefix)) break;
+        step(s, name, t);
+        if(t.empty()) continue;
+        const size_t len = path.size();
+        if(name.size()) path.insert(path.end(), &name[0], &name[0] + name.size());
+        path.push_back('.');
+        walk(sub, t);
+        path.resize(len);
+    }
+}
+
+//! write the buffered lines
+void path_query::flush(){
+    if(os && !out.empty()) os->write(&out.front(), out.size());
+    out.clear();
+}
+
+//! run the query over all top modules
+//
+//! Paths start from the child of the top module like --keep, so the name of the top module is not matched.
+void path_query::run(const vcd_header &header){
+    state_type s(1, 0);
+    close(s);
+    for(size_t i = 0; i < header.get_num_top_modules(); ++i){
+        path.clear();
+        walk(header.get_top_module(i), s);
+    }
+    flush();
+}
+
+//! get the number of matching signals
+size_t path_query::get_num_signals()const{
+    return num_signals;
+}
+
+//! get the number of modules that have matching signals
+size_t path_query::get_num_modules()const{
+    return num_modules;
+}
+
+} //end of unnamed namespace
+
+//! list or find signals by a path pattern
+//
+//! Each matching signal is written in a line of its path, identifier code and width separated by tab.
+//! @param header header to be searched
+//! @param pattern pattern of the path from the child of the top module, with '*', '?' and "**" segments
+//! @param scope true to list all signals under the matching scopes, false to find the signals matching the pattern
+//! @param os output stream, NULL to count only
+//! @param num_modules number of modules that have matching signals is stored
+//! @return number of matching signals
+size_t query_signals(const vcd_header &header, const std::string &pattern, bool scope, std::ostream *os, size_t &num_modules){
+    path_query q(pattern, scope, os);
+    q.run(header);
+    num_modules = q.get_num_modules();
+    return q.get_num_signals();
+}
@@ -0,0 +1,11 @@
+#ifndef VCD_QUERY_H
+#define VCD_QUERY_H
+#include <iosfwd>
+#include <string>
+#include <cstddef>
+
+class vcd_header;
+
+size_t query_signals(const vcd_header &, const std::string &, bool, std::ostream *, size_t &);
+
+#endif
@@ -0,0 +1,502 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "mmap_manager.h"
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_index.h"
+#include "vcd_stats.h"
+#include "vcd_slice.h"
+
+namespace{
+
+//! magic number at the head of a time index
+const char time_index_magic[8] = {'V', 'C', 'D', 'T', 'I', 'D', 'X', '\n'};
+//! written as is to detect an index of another byte order
+const uint32_t time_index_byte_order = 0x01020304;
+//! format version of the time index
+const uint32_t time_index_version = 1;
+//! minimum length of the body between checkpoints
+const uint64_t min_checkpoint_interval = 1024 * 1024;
+//! length of the body between checkpoints for each identifier code, which keeps the snapshots small against the body
+const uint64_t checkpoint_interval_per_code = 64;
+//! length read to check the timestamp at a checkpoint
+const size_t timestamp_check_size = 32;
+
+//! head of a time index, followed by the checkpoints and the snapshots
+struct time_index_header{
+    //! time_index_magic
+    char magic[8];
+    //! time_index_byte_order
+    uint32_t byte_order;
+    //! time_index_version
+    uint32_t version;
+    //! size of the VCD header
+    uint64_t header_size;
+    //! hash_header() of the VCD header
+    uint64_t header_hash;
+    //! size of the VCD file
+    uint64_t file_size;
+    //! number of distinct identifier codes
+    uint64_t num_codes;
+    //! number of checkpoints
+    uint64_t num_checkpoints;
+    //! length of the snapshots
+    uint64_t snapshots_size;
+};
+
+//! position in the body where the values of all signals are recorded
+struct time_checkpoint{
+    //! time of the timestamp at offset, 0 for the first checkpoint
+    uint64_t time;
+    //! offset of the timestamp, or of the body for the first checkpoint
+    uint64_t offset;
+    //! offset of the snapshot, which has a line of the value of each code before the timestamp
+    uint64_t snapshot_off;
+};
+
+//! functor used to find the checkpoint of a time by std::upper_bound
+struct earlier_time{
+    bool operator () (uint64_t t, const time_checkpoint &c)const{
+        return t < c.time;
+    }
+};
+
+//! check if a token is a value change
+inline bool is_value_change(const body_token &tok){
+    return tok.kind == body_token::scalar || tok.kind == body_token::vector || tok.kind == body_token::real || tok.kind == body_token::string;
+}
+
+//! current value of each identifier code
+class signal_values{
+    //! index of identifier codes
+    const code_table &table;
+    //! identifier code of each index
+    std::vector<string_view> codes;
+    //! value including the prefix of each index, empty if not changed yet
+    std::vector<std::string> values;
+    public:
+    //! constructor
+    //
+    //! @param t index of the identifier codes of sigs
+    //! @param sigs signals in the header
+    signal_values(const code_table &t, const std::vector<const vcd_signal *> &sigs) : table(t), codes(t.size()), values(t.size()){
+        for(size_t i = 0; i < sigs.size(); ++i){
+            codes[table.find(sigs[i]->get_symbol())] = sigs[i]->get_symbol();
+        }
+    }
+    //! apply a value change, whose code may not be in the table
+    void apply(const body_token &tok){
+        const uint32_t idx = table.find(tok.code);
+        if(idx != code_table::npos) values[idx].assign(&tok.value[0], tok.value.size());
+    }
+    //! append the snapshot of the values, one line for each code
+    void save(std::vector<char> &out)const{
+        for(size_t i = 0; i < values.size(); ++i){
+            out.insert(out.end(), values[i].begin(), values[i].end());
+            out.push_back('\n');
+        }
+    }
+    //! restore the values from a snapshot
+    //
+    //! @param p head of the snapshot
+    //! @param len length available at p
+    //! @return false if the snapshot is broken
+    bool restore(const char *p, size_t len){
+        const char *const end = p + len;
+        for(size_t i = 0; i < values.size(); ++i){
+            const char *const nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+            if(!nl) return false;
+            values[i].assign(p, nl);
+            p = nl + 1;
+        }
+        return true;
+    }
+    //! write the values as $dumpvars at a time
+    void write_dumpvars(uint64_t time, body_writer &out)const{
+        char head[32];
+        const int len = std::snprintf(head, sizeof(head), "#%llu\n", static_cast<unsigned long long>(time));
+        out.write(head, len);
+        static const char dumpvars[] = "$dumpvars\n", end[] = "$end\n";
+        out.write(dumpvars, sizeof(dumpvars) - 1);
+        for(size_t i = 0; i < values.size(); ++i){
+            const std::string &v = values[i];
+            if(v.empty()) continue;
+            out.write(v.data(), v.size());
+            //only scalar values are followed by the code without space
+            const char c = v[0] | 0x20;
+            if(c == 'b' || c == 'r' || c == 's') out.put(' ');
+            out.write(codes[i]);
+            out.put('\n');
+        }
+        out.write(end, sizeof(end) - 1);
+    }
+    //! get the number of codes
+    size_t size()const{
+        return values.size();
+    }
+};
+
+//! scan the body up to the first timestamp later than a time
+//
+//! @param fd VCD file
+//! @param begin offset to start, where no $comment or value continues from before
+//! @param end size of the file
+//! @param time time to look for
+//! @param values the value changes before the timestamp are applied, NULL to skip them
+//! @param found offset of the timestamp is stored, or end if there is no such timestamp
+//! @return false if failed to read, errno is set
+bool scan_to_time(int fd, off_t begin, off_t end, uint64_t time, signal_values *values, off_t &found){
+    body_reader reader(fd, begin, end);
+    body_lexer lexer;
+    body_token tok;
+    found = end;
+    off_t head = begin;
+    for(string_view chunk; reader.next(chunk); head += chunk.size()){
+        lexer.feed(chunk);
+        while(lexer.next(tok)){
+            uint64_t t;
+            if(tok.kind == body_token::timestamp){
+                if(parse_timestamp(tok.value, t) && t > time){
+                    found = head + (&tok.value[0] - &chunk[0]);
+                    return true;
+                }
+            }
+            else if(values && is_value_change(tok)){
+                values->apply(tok);
+            }
+        }
+    }
+    errno = reader.get_error();
+    return reader.get_error() == 0;
+}
+
+//! time index mapped from the sidecar file or built by scanning the body
+//
+//! The first checkpoint is always at the head of the body with no value, and the others are
+//! at the first timestamp after each interval. A checkpoint is skipped if the time goes back,
+//! so the checkpoints are sorted by time and a time is found by binary search.
+class time_index{
+    //! mapped index, NULL if the index is built
+    mmap_manager *map;
+    //! head of the index expected from the VCD
+    time_index_header expected;
+    //! checkpoints built by scanning the body
+    std::vector<time_checkpoint> built_checkpoints;
+    //! snapshots built by scanning the body
+    std::vector<char> built_snapshots;
+    //! checkpoints in use
+    const time_checkpoint *checkpoints;
+    //! snapshots in use
+    const char *snapshots;
+    time_index(const time_index &);
+    time_index & operator = (const time_index &);
+    void use_built();
+    public:
+    time_index(const string_view &, off_t, size_t);
+    ~time_index();
+    bool load(const char *, std::ostream &);
+    bool build(int, signal_values &);
+    int write(const char *)const;
+    const time_checkpoint &find(uint64_t)const;
+    bool restore(const time_checkpoint &, signal_values &)const;
+};
+
+//! constructor
+//
+//! Only the head of the body is in the index until load() or build().
+//! @param header_text header of the VCD
+//! @param file_size size of the VCD
+//! @param num_codes number of distinct identifier codes in the header
+time_index::time_index(const string_view &header_text, off_t file_size, size_t num_codes) : map(NULL){
+    std::memset(&expected, 0, sizeof(expected));
+    std::memcpy(expected.magic, time_index_magic, sizeof(expected.magic));
+    expected.byte_order = time_index_byte_order;
+    expected.version = time_index_version;
+    expected.header_size = header_text.size();
+    expected.header_hash = hash_header(header_text.size() ? &header_text[0] : NULL, header_text.size());
+    expected.file_size = file_size;
+    expected.num_codes = num_codes;
+    const time_checkpoint head = {0, header_text.size(), 0};
+    built_checkpoints.assign(1, head);
+    built_snapshots.assign(num_codes, '\n');
+    use_built();
+}
+
+//! destructor
+time_index::~time_index(){
+    delete map;
+}
+
+//! use the checkpoints and snapshots built
+void time_index::use_built(){
+    expected.num_checkpoints = built_checkpoints.size();
+    expected.snapshots_size = built_snapshots.size();
+    checkpoints = &built_checkpoints.front();
+    snapshots = built_snapshots.empty() ? NULL : &built_snapshots.front();
+}
+
+//! map the index if it is up to date
+//
+//! Only the head of the index is checked here, and the checkpoint in use is checked by restore()
+//! so that a cut does not read all checkpoints.
+//! @param index_file name of the index
+//! @param log stream for the reason why the index is not used
+//! @return false if the index is missing, broken or out of date
+bool time_index::load(const char *index_file, std::ostream &log){
+    mmap_manager *const m = new mmap_manager(index_file, false);
+    if(m->get_error()){
+        delete m;
+        return false;
+    }
+    const char *const base = static_cast<const char *>(m->get_ptr());
+    time_index_header h;
+    bool ok = false;
+    if(m->get_size() >= sizeof(h)) std::memcpy(&h, base, sizeof(h));
+    if(m->get_size() < sizeof(h)){
+        log << "Time index is broken" << std::endl;
+    }
+    else if(std::memcmp(h.magic, time_index_magic, sizeof(h.magic)) != 0 || h.byte_order != time_index_byte_order || h.version != time_index_version){
+        log << "Time index is not of this version" << std::endl;
+    }
+    else if(h.header_size != expected.header_size || h.header_hash != expected.header_hash || h.file_size != expected.file_size || h.num_codes != expected.num_codes){
+        log << "Time index is out of date" << std::endl;
+    }
+    else if(h.num_checkpoints == 0 || h.num_checkpoints > m->get_size() || sizeof(h) + h.num_checkpoints * sizeof(time_checkpoint) + h.snapshots_size != m->get_size()){
+        log << "Time index is broken" << std::endl;
+    }
+    else{
+        ok = true;
+    }
+    if(!ok){
+        delete m;
+        return false;
+    }
+    delete map;
+    map = m;
+    expected = h;
+    checkpoints = reinterpret_cast<const time_checkpoint *>(base + sizeof(h));
+    snapshots = base + sizeof(h) + h.num_checkpoints * sizeof(time_checkpoint);
+    return true;
+}
+
+//! scan the whole body and record the checkpoints
+//
+//! @param fd VCD file
+//! @param values values with no change, which are left at the end of the body
+//! @return false if failed to read, errno is set
+bool time_index::build(int fd, signal_values &values){
+    const uint64_t interval = std::max(min_checkpoint_interval, checkpoint_interval_per_code * values.size());
+    built_checkpoints.resize(1);
+    built_snapshots.clear();
+    values.save(built_snapshots);
+    body_reader reader(fd, expected.header_size, expected.file_size);
+    body_lexer lexer;
+    body_token tok;
+    off_t head = expected.header_size;
+    uint64_t next = expected.header_size + interval;
+    for(string_view chunk; reader.next(chunk); head += chunk.size()){
+        lexer.feed(chunk);
+        while(lexer.next(tok)){
+            if(is_value_change(tok)){
+                values.apply(tok);
+                continue;
+            }
+            if(tok.kind != body_token::timestamp) continue;
+            const uint64_t off = head + (&tok.value[0] - &chunk[0]);
+            uint64_t t;
+            if(off < next || !parse_timestamp(tok.value, t) || t < built_checkpoints.back().time) continue;
+            const time_checkpoint c = {t, off, built_snapshots.size()};
+            built_checkpoints.push_back(c);
+            values.save(built_snapshots);
+            next = off + interval;
+        }
+    }
+    delete map;
+    map = NULL;
+    use_built();
+    errno = reader.get_error();
+    return reader.get_error() == 0;
+}
+
+//! write the index
+//
+//! The index is written to a temporary file and renamed, so a reader never sees a partial index.
+//! @param index_file name of the index
+//! @return 0 if succeeded
+int time_index::write(const char *index_file)const{
+    std::vector<char> tmp_name(index_file, index_file + std::strlen(index_file));
+    const char suffix[] = ".XXXXXX";
+    tmp_name.insert(tmp_name.end(), suffix, suffix + sizeof(suffix));
+    bool ok;
+    {
+        fd_raii fd(mkstemp(&tmp_name.front()));
+        if(fd < 0){
+            perror(index_file);
+            return -1;
+        }
+        body_writer out(fd);
+        out.write(reinterpret_cast<const char *>(&expected), sizeof(expected));
+        out.write(reinterpret_cast<const char *>(checkpoints), expected.num_checkpoints * sizeof(time_checkpoint));
+        if(expected.snapshots_size) out.write(snapshots, expected.snapshots_size);
+        ok = out.flush() && fchmod(fd, 0644) == 0;
+        if(!ok && out.get_error()) errno = out.get_error();
+    }
+    if(ok && rename(&tmp_name.front(), index_file) == 0) return 0;
+    perror(index_file);
+    unlink(&tmp_name.front());
+    return -1;
+}
+
+//! find the last checkpoint at or before a time
+const time_checkpoint &time_index::find(uint64_t time)const{
+    const time_checkpoint *const end = checkpoints + expected.num_checkpoints;
+    const time_checkpoint *const c = std::upper_bound(checkpoints, end, time, earlier_time());
+    //the first checkpoint is at time 0
+    return c == checkpoints ? *c : c[-1];
+}
+
+//! restore the values at a checkpoint
+//
+//! @return false if the checkpoint is broken
+bool time_index::restore(const time_checkpoint &c, signal_values &values)const{
+    if(c.offset < expected.header_size || c.offset > expected.file_size || c.snapshot_off > expected.snapshots_size) return false;
+    return values.restore(snapshots + c.snapshot_off, expected.snapshots_size - c.snapshot_off);
+}
+
+//! check that a checkpoint points to its timestamp in the VCD
+//
+//! @param fd VCD file
+//! @param c checkpoint other than the first one
+bool check_timestamp(int fd, const time_checkpoint &c){
+    char buf[timestamp_check_size];
+    const ssize_t r = pread(fd, buf, sizeof(buf), c.offset);
+    if(r <= 0) return false;
+    count_read(r);
+    size_t len = 0;
+    while(len < static_cast<size_t>(r) && buf[len] != ' ' && buf[len] != '\t' && buf[len] != '\n' && buf[len] != '\r') ++len;
+    uint64_t t;
+    return parse_timestamp(string_view(buf, len), t) && t == c.time;
+}
+
+} //end of unnamed namespace
+
+//! get the name of the time index of a VCD
+//
+//! @param vcd_filename VCD file
+//! @return name of the sidecar file
+std::string get_time_index_name(const char *vcd_filename){
+    return std::string(vcd_filename) + ".tidx";
+}
+
+//! write a new VCD file of the value changes between two times
+//
+//! The values at from are replayed from the last checkpoint at or before from and written as $dumpvars at from,
+//! and the body is copied from the first timestamp after from to the first timestamp after to.
+//! Without the index, the values are replayed from the head of the body.
+//! With the index, the whole body is scanned to build the index if it is missing or out of date,
+//! and later cuts read only the body from the checkpoint to to.
+//! The index is used only if the VCD has the same size and header hash as when it was written.
+//! @param orig_vcd original VCD file
+//! @param output_file new VCD file
+//! @param header header of orig_vcd
+//! @param header_text header of orig_vcd in the file
+//! @param flatten true to remove the hierarchy
+//! @param from first time of the slice
+//! @param to last time of the slice
+//! @param use_index true to use the time index, which is built if necessary
+//! @param num_threads number of threads to compress the output if its name ends with ".gz", 0 for the number of CPUs
+//! @param log stream for messages
+//! @return 0 if succeeded
+int make_slice_file(const char *orig_vcd, const char *output_file, const vcd_header &header, const string_view &header_text, bool flatten, uint64_t from, uint64_t to, bool use_index, unsigned int num_threads, std::ostream &log){
+    std::vector<const vcd_signal *> sigs;
+    header.get_signals(sigs);
+    code_table table;
+    if(!table.build(sigs)){
+        log << orig_vcd << ": identifier codes that are not base-94 integers cannot be sliced" << std::endl;
+        return -1;
+    }
+    fd_raii ifd(open(orig_vcd, O_RDONLY));
+    struct stat st;
+    if(ifd < 0 || fstat(ifd, &st)){
+        perror(orig_vcd);
+        return -1;
+    }
+    const off_t header_size = header_text.size(), file_size = st.st_size;
+    signal_values values(table, sigs);
+    time_index index(header_text, file_size, table.size());
+    if(use_index){
+        const std::string index_file = get_time_index_name(orig_vcd);
+        if(index.load(index_file.c_str(), log)){
+            log << "Time index is loaded from " << index_file << std::endl;
+        }
+        else{
+            if(!index.build(ifd, values)){
+                perror(orig_vcd);
+                return -1;
+            }
+            if(index.write(index_file.c_str()) == 0) log << "Time index is written to " << index_file << std::endl;
+        }
+    }
+    const time_checkpoint &start = index.find(from);
+    if(!index.restore(start, values) || (start.offset != static_cast<uint64_t>(header_size) && !check_timestamp(ifd, start))){
+        log << "Time index is broken, please remove " << get_time_index_name(orig_vcd) << std::endl;
+        return -1;
+    }
+    off_t begin, end;
+    if(!scan_to_time(ifd, start.offset, file_size, from, &values, begin)){
+        perror(orig_vcd);
+        return -1;
+    }
+    //the end is looked for from the last checkpoint in the slice
+    const time_checkpoint &last = index.find(to);
+    const off_t last_offset = last.offset;
+    if(!scan_to_time(ifd, std::max(begin, last_offset), file_size, to, NULL, end)){
+        perror(orig_vcd);
+        return -1;
+    }
+
+    std::vector<char> v;
+    header_writer w(v);
+    write_header(header, w, flatten, 0);
+    fd_raii ofd(open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if(ofd < 0){
+        perror(output_file);
+        return -1;
+    }
+    body_writer out(ofd, is_gzip_name(output_file), num_threads);
+    if(!v.empty()) out.write(&v.front(), v.size());
+    //the line of $enddefinitions is in the body, which is not copied from the head
+    static const char enddefinitions[] = "$enddefinitions $end\n";
+    out.write(enddefinitions, sizeof(enddefinitions) - 1);
+    values.write_dumpvars(from, out);
+    body_reader in(ifd, begin, end);
+    for(string_view chunk; in.next(chunk); ){
+        out.write(chunk);
+    }
+    if(in.get_error()){
+        errno = in.get_error();
+        perror(orig_vcd);
+        return -1;
+    }
+    if(!out.flush()){
+        errno = out.get_error();
+        perror(output_file);
+        return -1;
+    }
+    log << "Header size " << header_size << " -> " << v.size() << "\n"
+        << "Body size " << file_size - header_size << " -> " << out.get_written() - v.size()
+        << ", " << begin - static_cast<off_t>(start.offset) << " bytes replayed to #" << from << std::endl;
+    return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef VCD_SLICE_H
+#define VCD_SLICE_H
+#include <iosfwd>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+class vcd_header;
+class string_view;
+
+std::string get_time_index_name(const char *);
+int make_slice_file(const char *, const char *, const vcd_header &, const string_view &, bool, uint64_t, uint64_t, bool, unsigned int, std::ostream &);
+
+#endif
@@ -0,0 +1,360 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include "vcd_header.h"
+#include "vcd_body.h"
+#include "vcd_output.h"
+#include "vcd_file.h"
+#include "vcd_split.h"
+
+namespace{
+
+//! check if the keyword starts a section of value changes
+bool is_dump_keyword(const string_view &key){
+    return key == "$dumpvars" || key == "$dumpall" || key == "$dumpon" || key == "$dumpoff";
+}
+
+//! check if a path is in the scope of an output
+//
+//! A path is in the scope if it or any of its '.'-separated prefixes matches the scope.
+//! @param spec output
+//! @param path path terminated by '\0', which is modified while matching
+bool in_scope(const split_spec &spec, char *path){
+    const std::string &scope = spec.scope;
+    if(spec.exact){
+        return std::strncmp(path, scope.c_str(), scope.size()) == 0 && (path[scope.size()] == '\0' || path[scope.size()] == '.');
+    }
+    if(fnmatch(scope.c_str(), path, 0) == 0) return true;
+    for(char *p = path; (p = std::strchr(p, '.')) != NULL; ++p){
+        *p = '\0';
+        const bool matched = fnmatch(scope.c_str(), path, 0) == 0;
+        *p = '.';
+        if(matched) return true;
+    }
+    return false;
+}
+
+//! context of match_scopes() and take_matched()
+//
+//! The signals are visited in the same order by vcd_header::filter_signals() of the headers made from the same packed header,
+//! so the path of each signal is matched only once for all outputs.
+struct scope_match{
+    //! outputs
+    const std::vector<split_spec> *specs;
+    //! buffer for the path
+    std::vector<char> path;
+    //! outputs of the i-th signal are outputs[heads[i]] to outputs[heads[i + 1]]
+    std::vector<uint32_t> heads;
+    //! outputs of the signals in ascending order
+    std::vector<uint32_t> outputs;
+    //! output being filtered by take_matched()
+    uint32_t output;
+    //! index of the signal visited next by take_matched()
+    size_t pos;
+};
+
+//! find the outputs of a signal, called by vcd_header::filter_signals() to keep all signals
+bool match_scopes(const vcd_signal &sig, void *arg){
+    scope_match &m = *static_cast<scope_match *>(arg);
+    m.path.clear();
+    header_writer w(m.path);
+    sig.write_full_path(w);
+    m.path.push_back('\0');
+    for(size_t k = 0; k < m.specs->size(); ++k){
+        if(in_scope((*m.specs)[k], &m.path.front())) m.outputs.push_back(k);
+    }
+    m.heads.push_back(m.outputs.size());
+    return true;
+}
+
+//! check if a signal is in the scope of the output, called by vcd_header::filter_signals() after match_scopes()
+bool take_matched(const vcd_signal &, void *arg){
+    scope_match &m = *static_cast<scope_match *>(arg);
+    if(m.heads[m.pos] == m.heads[m.pos + 1]){
+        ++m.pos;
+        return false;
+    }
+    const uint32_t *const first = &m.outputs.front() + m.heads[m.pos], *const last = &m.outputs.front() + m.heads[m.pos + 1];
+    ++m.pos;
+    return std::find(first, last, m.output) != last;
+}
+
+//! collect the modules at a depth with their paths
+//
+//! @param mod module
+//! @param depth depth of mod, 0 for a top module
+//! @param target depth of the modules to be collected
+//! @param path path of mod followed by '.', empty for a top module
+//! @param paths paths of the modules are appended
+void collect_scopes(const vcd_module &mod, size_t depth, size_t target, std::string &path, std::vector<std::string> &paths){
+    if(depth == target){
+        paths.push_back(path.substr(0, path.size() - 1));
+        return;
+    }
+    for(size_t i = 0; i < mod.get_num_sub_modules(); ++i){
+        const vcd_module &sub = mod.get_sub_module(i);
+        const string_view name = sub.get_name();
+        const size_t len = path.size();
+        if(name.size()) path.append(&name[0], name.size());
+        path.push_back('.');
+        collect_scopes(sub, depth + 1, target, path, paths);
+        path.resize(len);
+    }
+}
+
+//! file written by a split
+struct split_output{
+    //! output file
+    fd_raii fd;
+    //! buffered writer of the file
+    body_writer out;
+    //! number of value changes written
+    uint64_t num_changes;
+    //! number of signals in the header
+    size_t num_signals;
+    //! constructor
+    //
+    //! @param name output file, compressed if its name ends with ".gz"
+    //! @param num_threads number of threads to compress, 0 for the number of CPUs
+    split_output(const char *name, unsigned int num_threads) : fd(open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)), out(fd, is_gzip_name(name), num_threads), num_changes(0), num_signals(0){}
+};
+
+//! owns the outputs
+struct output_list{
+    std::vector<split_output *> outputs;
+    ~output_list(){
+        for(size_t i = 0; i < outputs.size(); ++i){
+            delete outputs[i];
+        }
+    }
+};
+
+} //end of unnamed namespace
+
+//! parse the argument of --split
+//
+//! @param arg scope and file separated by the first '=' like "u_top.u_cpu*=cpu.vcd"
+//! @param spec the output is stored, whose scope is a glob pattern
+//! @return false if the scope or the file is empty
+bool parse_split_spec(const char *arg, split_spec &spec){
+    const char *const eq = std::strchr(arg, '=');
+    if(!eq || eq == arg || !eq[1]) return false;
+    spec.scope.assign(arg, eq);
+    spec.file = eq + 1;
+    spec.exact = false;
+    return true;
+}
+
+//! make an output for each scope at a depth
+//
+//! The output of scope "u_top.u_cpu" is named like "out.u_top.u_cpu.vcd" for "out.vcd".
+//! @param header header of the VCD
+//! @param depth depth of the scopes, 1 for the children of the top modules
+//! @param output name of the output, whose extension follows the path of the scope
+//! @param specs the outputs are appended
+void get_split_specs(const vcd_header &header, size_t depth, const std::string &output, std::vector<split_spec> &specs){
+    std::vector<std::string> paths;
+    std::string path;
+    for(size_t i = 0; i < header.get_num_top_modules(); ++i){
+        collect_scopes(header.get_top_module(i), 0, depth, path, paths);
+    }
+    static const char *const extensions[] = {".vcd.gz", ".vcd", ".gz"};
+    std::string stem = output, ext = ".vcd";
+    for(size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i){
+        const size_t len = std::strlen(extensions[i]);
+        if(output.size() > len && output.compare(output.size() - len, len, extensions[i]) == 0){
+            stem = output.substr(0, output.size() - len);
+            ext = extensions[i];
+            break;
+        }
+    }
+    for(size_t i = 0; i < paths.size(); ++i){
+        split_spec s;
+        s.scope = paths[i];
+        s.file = stem + "." + paths[i] + ext;
+        s.exact = true;
+        specs.push_back(s);
+    }
+}
+
+//! write several VCD files, each of which has the signals of a scope, in one pass over the body
+//
+//! The header of each output is the hierarchy of the VCD reduced to the signals in its scope,
+//! which is rebuilt from the header packed once instead of parsing the header again for each output.
+//! A table indexed by the identifier codes gives the outputs of each value change,
+//! and each output is written through a buffer of its own. Timestamps are written to an output
+//! only before its first value change or other token after them, so an output has no run of empty timestamps.
+//! Keywords such as $dumpvars and $comment are written to all outputs.
+//! @param orig_vcd original VCD file
+//! @param header header of orig_vcd
+//! @param header_size size of the header of orig_vcd
+//! @param specs outputs
+//! @param flatten true to remove the hierarchy
+//! @param num_threads number of threads to compress the outputs, 0 for the number of CPUs
+//! @param log stream for messages
+//! @return 0 if succeeded
+int make_split_files(const char *orig_vcd, const vcd_header &header, size_t header_size, const std::vector<split_spec> &specs, bool flatten, unsigned int num_threads, std::ostream &log){
+    if(specs.empty()){
+        log << orig_vcd << ": no scope to split" << std::endl;
+        return -1;
+    }
+    std::vector<const vcd_signal *> sigs;
+    header.get_signals(sigs);
+    code_table table;
+    if(!table.build(sigs)){
+        log << orig_vcd << ": identifier codes that are not base-94 integers cannot be split" << std::endl;
+        return -1;
+    }
+    fd_raii ifd(open(orig_vcd, O_RDONLY));
+    struct stat st;
+    if(ifd < 0 || fstat(ifd, &st)){
+        perror(orig_vcd);
+        return -1;
+    }
+    //the mapped input must not be truncated
+    struct stat ost;
+    for(size_t k = 0; k < specs.size(); ++k){
+        if(stat(specs[k].file.c_str(), &ost) == 0 && ost.st_dev == st.st_dev && ost.st_ino == st.st_ino){
+            log << specs[k].file << ": output cannot be the input" << std::endl;
+            return -1;
+        }
+    }
+    const off_t file_size = st.st_size;
+    std::vector<char> strings;
+    std::vector<packed_module> modules;
+    std::vector<packed_signal> signals;
+    packed_header p;
+    header.pack(strings, modules, signals, p);
+
+    //pairs of a code and an output that has it, which become the table of the outputs of each code
+    std::vector<std::pair<uint32_t, uint32_t> > pairs;
+    scope_match m;
+    m.specs = &specs;
+    m.heads.push_back(0);
+    {
+        vcd_header all(p);
+        all.filter_signals(match_scopes, &m);
+    }
+    output_list list;
+    for(size_t k = 0; k < specs.size(); ++k){
+        vcd_header *const h = new vcd_header(p);
+        m.output = k;
+        m.pos = 0;
+        const size_t kept = h->filter_signals(take_matched, &m);
+        if(!kept){
+            log << specs[k].scope << ": no signal is in the scope" << std::endl;
+            delete h;
+            return -1;
+        }
+        std::vector<const vcd_signal *> ksigs;
+        h->get_signals(ksigs);
+        for(size_t i = 0; i < ksigs.size(); ++i){
+            pairs.push_back(std::make_pair(table.find(ksigs[i]->get_symbol()), static_cast<uint32_t>(k)));
+        }
+        std::vector<char> v;
+        header_writer w(v);
+        write_header(*h, w, flatten, 0);
+        delete h;
+        list.outputs.push_back(new split_output(specs[k].file.c_str(), num_threads));
+        split_output &o = *list.outputs.back();
+        if(o.fd < 0){
+            perror(specs[k].file.c_str());
+            return -1;
+        }
+        o.num_signals = kept;
+        if(!v.empty()) o.out.write(&v.front(), v.size());
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    //outputs of code i are targets[heads[i]] to targets[heads[i + 1]]
+    std::vector<uint32_t> heads(table.size() + 1, 0), targets(pairs.size());
+    for(size_t i = 0; i < pairs.size(); ++i){
+        ++heads[pairs[i].first + 1];
+        targets[i] = pairs[i].second;
+    }
+    for(size_t i = 0; i < table.size(); ++i){
+        heads[i + 1] += heads[i];
+    }
+
+    const size_t n = list.outputs.size();
+    //the timestamp read last and its generation, and the generation written to each output
+    std::string stamp;
+    uint64_t generation = 0;
+    std::vector<uint64_t> stamped(n, 0);
+    uint64_t num_changes = 0, num_dropped = 0;
+    body_reader reader(ifd, header_size, file_size);
+    body_lexer lexer;
+    body_token tok;
+    bool more = true;
+    for(string_view chunk; more; ){
+        more = reader.next(chunk);
+        if(more) lexer.feed(chunk);
+        while(more ? lexer.next(tok) : lexer.finish(tok)){
+            if(tok.kind == body_token::timestamp){
+                stamp.assign(&tok.value[0], tok.value.size());
+                ++generation;
+                continue;
+            }
+            const bool value = tok.kind == body_token::scalar || tok.kind == body_token::vector || tok.kind == body_token::real || tok.kind == body_token::string;
+            size_t first = 0, last = n;
+            const uint32_t *ks = NULL;
+            if(value){
+                ++num_changes;
+                const uint32_t idx = table.find(tok.code);
+                first = idx == code_table::npos ? 0 : heads[idx];
+                last = idx == code_table::npos ? 0 : heads[idx + 1];
+                if(first == last){
+                    ++num_dropped;
+                    continue;
+                }
+                ks = &targets.front();
+            }
+            for(size_t j = first; j < last; ++j){
+                const size_t k = ks ? ks[j] : j;
+                split_output &o = *list.outputs[k];
+                if(stamped[k] != generation){
+                    o.out.write(stamp.data(), stamp.size());
+                    o.out.put('\n');
+                    stamped[k] = generation;
+                }
+                o.out.write(tok.value);
+                if(value){
+                    if(tok.kind != body_token::scalar) o.out.put(' ');
+                    o.out.write(tok.code);
+                    o.out.put('\n');
+                    ++o.num_changes;
+                }
+                else{
+                    //"$comment" and its text are kept in a line until "$end"
+                    o.out.put(tok.kind == body_token::keyword && (is_dump_keyword(tok.value) || tok.value == "$end") ? '\n' : ' ');
+                }
+            }
+            if(!more) break;
+        }
+    }
+    if(reader.get_error()){
+        errno = reader.get_error();
+        perror(orig_vcd);
+        return -1;
+    }
+    for(size_t k = 0; k < n; ++k){
+        split_output &o = *list.outputs[k];
+        if(!o.out.flush()){
+            errno = o.out.get_error();
+            perror(specs[k].file.c_str());
+            return -1;
+        }
+        log << specs[k].file << ": " << o.num_signals << " signals, " << o.num_changes << " value changes, " << o.out.get_written() << " bytes" << std::endl;
+    }
+    log << "Body size " << file_size - static_cast<off_t>(header_size) << " is split into " << n << " files, "
+        << num_dropped << " of " << num_changes << " value changes are in no scope" << std::endl;
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef VCD_SPLIT_H
+#define VCD_SPLIT_H
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+class vcd_header;
+
+//! output of a split VCD
+struct split_spec{
+    //! scope whose signals are written, a glob pattern unless exact
+    std::string scope;
+    //! output file
+    std::string file;
+    //! true to match scope as it is
+    bool exact;
+};
+
+bool parse_split_spec(const char *, split_spec &);
+void get_split_specs(const vcd_header &, size_t, const std::string &, std::vector<split_spec> &);
+int make_split_files(const char *, const vcd_header &, size_t, const std::vector<split_spec> &, bool, unsigned int, std::ostream &);
+
+#endif
@@ -0,0 +1,195 @@
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include "vcd_stats.h"
+
+namespace{
+
+//! counters updated by count_*()
+io_counters counters;
+
+//! convert timespec to seconds
+double to_seconds(const struct timespec &ts){
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! convert timeval to seconds
+double to_seconds(const struct timeval &tv){
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//! write a string as a JSON string
+void write_json_string(std::ostream &os, const std::string &s){
+    os << '"';
+    for(size_t i = 0; i < s.size(); ++i){
+        const unsigned char c = s[i];
+        if(c == '"' || c == '\\'){
+            os << '\\' << c;
+        }
+        else if(c < 0x20){
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            os << buf;
+        }
+        else{
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+} //end of unnamed namespace
+
+//! add the length of a new mapping
+void count_mapped(size_t len){
+    __sync_fetch_and_add(&counters.bytes_mapped, len);
+}
+
+//! add the length of data read from a file
+void count_read(size_t len){
+    __sync_fetch_and_add(&counters.bytes_read, len);
+}
+
+//! add the length of data written to a file
+void count_written(size_t len){
+    __sync_fetch_and_add(&counters.bytes_written, len);
+}
+
+//! add an msync() call
+//
+//! @param ns duration of the call in nanoseconds
+void count_msync(uint64_t ns){
+    __sync_fetch_and_add(&counters.num_msync, 1);
+    __sync_fetch_and_add(&counters.msync_ns, ns);
+}
+
+//! get the I/O counters of the process
+io_counters get_io_counters(){
+    __sync_synchronize();
+    return counters;
+}
+
+//! get the monotonic time in seconds
+double get_monotonic_time(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return to_seconds(ts);
+}
+
+// ********** file_stats **********
+
+//! constructor
+file_stats::file_stats() : cpu_clock(CLOCK_PROCESS_CPUTIME_ID), running(NULL), wall_start(0), cpu_start(0), num_nodes(0), num_blocks(0), arena_bytes(0){}
+
+//! set the file to be processed
+//
+//! @param f name of the file
+//! @param per_thread true to measure the CPU time of the calling thread instead of the process,
+//! which is used when files are processed concurrently
+void file_stats::set_file(const std::string &f, bool per_thread){
+    file = f;
+    cpu_clock = per_thread ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID;
+}
+
+//! get the CPU time in seconds
+double file_stats::get_cpu_time()const{
+    struct timespec ts;
+    clock_gettime(cpu_clock, &ts);
+    return to_seconds(ts);
+}
+
+//! start a phase, the running phase is stopped
+//
+//! @param name name of the phase, which must be a string literal
+void file_stats::start(const char *name){
+    stop();
+    running = name;
+    wall_start = get_monotonic_time();
+    cpu_start = get_cpu_time();
+}
+
+//! stop the running phase
+void file_stats::stop(){
+    if(!running) return;
+    const phase p = {running, get_monotonic_time() - wall_start, get_cpu_time() - cpu_start};
+    phases.push_back(p);
+    running = NULL;
+}
+
+//! set the memory usage of the header
+//
+//! @param nodes number of modules and signal arrays allocated from the arena
+//! @param blocks number of heap blocks of the arena
+//! @param bytes bytes of heap blocks of the arena
+void file_stats::set_arena(size_t nodes, size_t blocks, size_t bytes){
+    num_nodes = nodes;
+    num_blocks = blocks;
+    arena_bytes = bytes;
+}
+
+//! write the statistics in text
+void file_stats::write_text(std::ostream &os)const{
+    os << "Stats of " << file << "\n" << std::fixed << std::setprecision(6);
+    for(size_t i = 0; i < phases.size(); ++i){
+        os << "    " << std::left << std::setw(8) << phases[i].name << std::right
+            << phases[i].wall << " s wall, " << phases[i].cpu << " s CPU\n";
+    }
+    os << "    header arena: " << num_nodes << " nodes in " << num_blocks << " heap blocks of " << arena_bytes << " bytes\n";
+}
+
+//! write the statistics as a JSON object
+void file_stats::write_json(std::ostream &os)const{
+    os << "{\"file\":";
+    write_json_string(os, file);
+    os << ",\"phases\":[" << std::fixed << std::setprecision(6);
+    for(size_t i = 0; i < phases.size(); ++i){
+        if(i) os << ",";
+        os << "{\"name\":\"" << phases[i].name << "\",\"wall\":" << phases[i].wall << ",\"cpu\":" << phases[i].cpu << "}";
+    }
+    os << "],\"arena\":{\"nodes\":" << num_nodes << ",\"blocks\":" << num_blocks << ",\"bytes\":" << arena_bytes << "}}";
+}
+
+//! write the statistics of the files and the whole process
+//
+//! CPU time and page faults of the process are taken by getrusage().
+//! @param os output stream
+//! @param files statistics of the files
+//! @param wall wall time of the whole run in seconds
+//! @param json true to write a JSON object in a line, false to write text
+void write_run_stats(std::ostream &os, const std::vector<file_stats> &files, double wall, bool json){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    const io_counters c = get_io_counters();
+    const double user = to_seconds(ru.ru_utime), sys = to_seconds(ru.ru_stime);
+    if(json){
+        os << "{\"files\":[";
+        for(size_t i = 0; i < files.size(); ++i){
+            if(i) os << ",";
+            files[i].write_json(os);
+        }
+        os << "]" << std::fixed << std::setprecision(6)
+            << ",\"wall\":" << wall
+            << ",\"cpu_user\":" << user
+            << ",\"cpu_sys\":" << sys
+            << ",\"bytes_mapped\":" << c.bytes_mapped
+            << ",\"bytes_read\":" << c.bytes_read
+            << ",\"bytes_written\":" << c.bytes_written
+            << ",\"major_faults\":" << ru.ru_majflt
+            << ",\"minor_faults\":" << ru.ru_minflt
+            << ",\"msync_calls\":" << c.num_msync
+            << ",\"msync\":" << c.msync_ns * 1e-9
+            << ",\"max_rss_kb\":" << ru.ru_maxrss
+            << "}" << std::endl;
+        return;
+    }
+    for(size_t i = 0; i < files.size(); ++i){
+        files[i].write_text(os);
+    }
+    os << "Stats of the run\n" << std::fixed << std::setprecision(6)
+        << "    " << wall << " s wall, " << user + sys << " s CPU (" << user << " s user, " << sys << " s system)\n"
+        << "    " << c.bytes_mapped << " bytes mapped, " << c.bytes_read << " bytes read, " << c.bytes_written << " bytes written\n"
+        << "    " << ru.ru_majflt << " major and " << ru.ru_minflt << " minor page faults, max RSS " << ru.ru_maxrss << " KB\n"
+        << "    " << c.num_msync << " msync calls in " << c.msync_ns * 1e-9 << " s" << std::endl;
+}
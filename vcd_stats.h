@@ -0,0 +1,74 @@
+#ifndef VCD_STATS_H
+#define VCD_STATS_H
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <time.h>
+
+//! I/O counters of the whole process
+//
+//! They are updated by all threads, so the counters of a file cannot be separated in batch mode.
+struct io_counters{
+    //! bytes mapped by mmap_manager
+    uint64_t bytes_mapped;
+    //! bytes read by read(), pread() and copied in the kernel
+    uint64_t bytes_read;
+    //! bytes written by write(), pwrite(), copied in the kernel and stored to mapped headers
+    uint64_t bytes_written;
+    //! number of msync() calls
+    uint64_t num_msync;
+    //! total duration of msync() in nanoseconds
+    uint64_t msync_ns;
+};
+
+void count_mapped(size_t);
+void count_read(size_t);
+void count_written(size_t);
+void count_msync(uint64_t);
+io_counters get_io_counters();
+double get_monotonic_time();
+
+//! statistics of processing a file
+//
+//! Wall and CPU time are recorded for each phase such as "scan" or "parse".
+class file_stats{
+    //! time spent in a phase
+    struct phase{
+        const char *name;
+        double wall;
+        double cpu;
+    };
+    //! name of the file
+    std::string file;
+    //! finished phases in the order of execution
+    std::vector<phase> phases;
+    //! clock to measure CPU time
+    clockid_t cpu_clock;
+    //! name of the running phase, NULL if no phase is running
+    const char *running;
+    //! wall time when the running phase started
+    double wall_start;
+    //! CPU time when the running phase started
+    double cpu_start;
+    //! number of nodes allocated from the arena of the header
+    size_t num_nodes;
+    //! number of heap blocks of the arena of the header
+    size_t num_blocks;
+    //! bytes of heap blocks of the arena of the header
+    size_t arena_bytes;
+    double get_cpu_time()const;
+    public:
+    file_stats();
+    void set_file(const std::string &, bool);
+    void start(const char *);
+    void stop();
+    void set_arena(size_t, size_t, size_t);
+    void write_text(std::ostream &)const;
+    void write_json(std::ostream &)const;
+};
+
+void write_run_stats(std::ostream &, const std::vector<file_stats> &, double, bool);
+
+#endif
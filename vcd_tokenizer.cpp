@@ -0,0 +1,170 @@
+#include <cassert>
+#include <algorithm>
+#include "vcd_tokenizer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define VCD_TOKENIZER_X86 1
+#include <immintrin.h>
+#endif
+
+namespace{
+
+//! appends boundaries to the output vector without checking the capacity for each boundary
+class boundary_writer{
+    //! output vector, which is larger than the valid entries while writing
+    std::vector<uint32_t> &bounds;
+    //! number of valid entries in bounds
+    size_t num;
+    public:
+    //! constructor
+    //
+    //! @param b output vector
+    //! @param len length of the string to be tokenized, used to estimate the number of tokens
+    boundary_writer(std::vector<uint32_t> &b, size_t len) : bounds(b), num(b.size()){
+        bounds.resize(num + len / 4 + 64);
+    }
+    //! destructor, drops unused entries
+    ~boundary_writer(){
+        bounds.resize(num);
+    }
+    //! make sure that n boundaries can be written
+    void reserve(size_t n){
+        if(bounds.size() < num + n) bounds.resize(std::max(bounds.size() * 2, num + n));
+    }
+    //! write a boundary, reserve() must be called beforehand
+    void push(uint32_t offset){
+        bounds[num++] = offset;
+    }
+    //! write boundaries indicated by a bit mask
+    //
+    //! @param trans bit n is set if a token starts or ends at offset + n
+    //! @param offset offset of bit 0
+    void push_mask(uint64_t trans, uint32_t offset){
+        for(; trans; trans &= trans - 1){
+            push(offset + __builtin_ctzll(trans));
+        }
+    }
+};
+
+//! check if c is one of ' ', '\t' and '\n'
+inline bool is_separator(char c){
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+//! tokenizer kernel
+//
+//! @param str string to be tokenized
+//! @param i offset to start
+//! @param len length of str
+//! @param w boundary output
+//! @param in_token true if the previous character belongs to a token. updated when returns.
+//! @return the offset where the kernel stopped
+typedef size_t (*kernel_type)(const char *str, size_t i, size_t len, boundary_writer &w, bool &in_token);
+
+//! scalar kernel, processes all remaining characters
+size_t scan_scalar(const char *str, size_t i, size_t len, boundary_writer &w, bool &in_token){
+    for(; i < len; ++i){
+        const bool t = !is_separator(str[i]);
+        if(t != in_token){
+            w.reserve(1);
+            w.push(i);
+            in_token = t;
+        }
+    }
+    return i;
+}
+
+#ifdef VCD_TOKENIZER_X86
+//! SSE2 kernel, processes 16 characters at a time
+size_t scan_sse2(const char *str, size_t i, size_t len, boundary_writer &w, bool &in_token){
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n');
+    uint64_t carry = in_token ? 1 : 0;
+    for(; i + 16 <= len; i += 16){
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+        const __m128i sep = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, sp), _mm_cmpeq_epi8(c, tab)), _mm_cmpeq_epi8(c, nl));
+        const uint64_t tok = ~static_cast<uint64_t>(_mm_movemask_epi8(sep)) & 0xffffu;
+        const uint64_t trans = (tok ^ ((tok << 1) | carry)) & 0xffffu;
+        carry = tok >> 15;
+        if(trans){
+            w.reserve(16);
+            w.push_mask(trans, i);
+        }
+    }
+    in_token = carry;
+    return i;
+}
+
+//! AVX2 kernel, processes 32 characters at a time
+__attribute__((target("avx2")))
+size_t scan_avx2(const char *str, size_t i, size_t len, boundary_writer &w, bool &in_token){
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n');
+    uint64_t carry = in_token ? 1 : 0;
+    for(; i + 32 <= len; i += 32){
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + i));
+        const __m256i sep = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, sp), _mm256_cmpeq_epi8(c, tab)), _mm256_cmpeq_epi8(c, nl));
+        const uint64_t tok = ~static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(sep))) & 0xffffffffu;
+        const uint64_t trans = (tok ^ ((tok << 1) | carry)) & 0xffffffffu;
+        carry = tok >> 31;
+        if(trans){
+            w.reserve(32);
+            w.push_mask(trans, i);
+        }
+    }
+    in_token = carry;
+    return i;
+}
+#endif
+
+//! a kernel and its name
+struct kernel_entry{
+    kernel_type kernel;
+    const char *name;
+};
+
+//! choose the fastest kernel supported by the CPU
+kernel_entry select_kernel(){
+#ifdef VCD_TOKENIZER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        const kernel_entry e = {scan_avx2, "avx2"};
+        return e;
+    }
+    const kernel_entry e = {scan_sse2, "sse2"};
+    return e;
+#else
+    const kernel_entry e = {scan_scalar, "scalar"};
+    return e;
+#endif
+}
+
+//! kernel chosen at the start-up
+const kernel_entry selected_kernel = select_kernel();
+
+} //end of unnamed namespace
+
+//! find the boundaries of tokens separated by ' ', '\t' or '\n'
+//
+//! The string is classified 32 (AVX2) or 16 (SSE2) characters at a time.
+//! The kernel is chosen by the CPU at the start-up and the scalar loop handles the tail.
+//! @param str string to be tokenized
+//! @param begin offset to start tokenizing. str[begin - 1] must be a separator if begin > 0.
+//! @param len length of str in Byte
+//! @param bounds offsets from str are appended. Even entries are the heads of tokens and odd entries are the ends.
+void find_token_boundaries(const char *str, size_t begin, size_t len, std::vector<uint32_t> &bounds){
+    assert(begin <= len && len <= UINT32_MAX);
+    boundary_writer w(bounds, len - begin);
+    bool in_token = false;
+    const size_t done = selected_kernel.kernel(str, begin, len, w, in_token);
+    scan_scalar(str, done, len, w, in_token);
+    if(in_token){
+        w.reserve(1);
+        w.push(len);
+    }
+}
+
+//! get the name of the kernel used by find_token_boundaries()
+//
+//! @return "avx2", "sse2" or "scalar"
+const char *token_kernel_name(){
+    return selected_kernel.name;
+}
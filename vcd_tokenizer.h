@@ -0,0 +1,10 @@
+#ifndef VCD_TOKENIZER_H
+#define VCD_TOKENIZER_H
+#include <vector>
+#include <stdint.h>
+
+void find_token_boundaries(const char *, size_t, size_t, std::vector<uint32_t> &);
+
+const char *token_kernel_name();
+
+#endif